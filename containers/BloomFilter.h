@@ -0,0 +1,139 @@
+#ifndef BINARY_TREE_BLOOMFILTER_H
+#define BINARY_TREE_BLOOMFILTER_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// std::hash of integers is often identity, so hash value is mixed first;
+// returns first position of double hashing and sets the step.
+inline uint64_t bloomFirstPosition(uint64_t hash_value, uint64_t &step) {
+    uint64_t mixed = hash_value;
+    mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+    mixed ^= mixed >> 31;
+    step = (mixed >> 32) | 1;
+    return mixed & 0xffffffffULL;
+}
+
+inline unsigned int bloomHashesCount(unsigned int slots_per_element) {
+    unsigned int count = (unsigned int) std::lround(slots_per_element * std::log(2.0));
+    return count < 1 ? 1 : count > 16 ? 16 : count;
+}
+
+// Approximate set membership: mayContain never misses an added element and
+// answers true for an absent one with probability about 0.6185^bits_per_element
+// (1% at the default 10 bits). Element positions come from double hashing of
+// one Hash value.
+template<typename Element, typename Hash = std::hash<Element>>
+class BloomFilter {
+public:
+    BloomFilter(size_t expected_elements, unsigned int bits_per_element = 10, Hash hash = Hash())
+            : hash(hash) {
+        bit_count = expected_elements * bits_per_element;
+        if ( bit_count < 64 ) {
+            bit_count = 64;
+        }
+        bits.assign((bit_count + 63) / 64, 0);
+        hashes_count = bloomHashesCount(bits_per_element);
+    }
+
+    void add(const Element &el) {
+        uint64_t step, position = firstPosition(el, step);
+        for (unsigned int i = 0; i < hashes_count; i++, position += step) {
+            size_t bit = (size_t) (position % bit_count);
+            bits[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+    }
+
+    bool mayContain(const Element &el) const {
+        uint64_t step, position = firstPosition(el, step);
+        for (unsigned int i = 0; i < hashes_count; i++, position += step) {
+            size_t bit = (size_t) (position % bit_count);
+            if ( (bits[bit / 64] & (uint64_t(1) << (bit % 64))) == 0 ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    uint64_t firstPosition(const Element &el, uint64_t &step) const {
+        return bloomFirstPosition((uint64_t) hash(el), step);
+    }
+
+    std::vector<uint64_t> bits;
+    size_t bit_count;
+    unsigned int hashes_count;
+    Hash hash;
+};
+
+// Bloom filter with 4 bit counters instead of bits, so elements can be
+// removed: same false positive rate as BloomFilter with as many bits per
+// element as counters, at four times the memory. A counter reaching 15
+// sticks there, since its true count is lost; removals then leave false
+// positives behind but never cause misses.
+template<typename Element, typename Hash = std::hash<Element>>
+class CountingBloomFilter {
+public:
+    CountingBloomFilter(size_t expected_elements, unsigned int counters_per_element = 10, Hash hash = Hash())
+            : hash(hash) {
+        counter_count = expected_elements * counters_per_element;
+        if ( counter_count < 64 ) {
+            counter_count = 64;
+        }
+        words.assign((counter_count + 15) / 16, 0);
+        hashes_count = bloomHashesCount(counters_per_element);
+    }
+
+    void add(const Element &el) {
+        uint64_t step, position = bloomFirstPosition((uint64_t) hash(el), step);
+        for (unsigned int i = 0; i < hashes_count; i++, position += step) {
+            size_t counter = (size_t) (position % counter_count);
+            if ( get(counter) != SATURATED ) {
+                words[counter / 16] += uint64_t(1) << (counter % 16 * 4);
+            }
+        }
+    }
+
+    // el must have been added before
+    void remove(const Element &el) {
+        uint64_t step, position = bloomFirstPosition((uint64_t) hash(el), step);
+        for (unsigned int i = 0; i < hashes_count; i++, position += step) {
+            size_t counter = (size_t) (position % counter_count);
+            unsigned int value = get(counter);
+            if ( value != SATURATED && value != 0 ) {
+                words[counter / 16] -= uint64_t(1) << (counter % 16 * 4);
+            }
+        }
+    }
+
+    bool mayContain(const Element &el) const {
+        uint64_t step, position = bloomFirstPosition((uint64_t) hash(el), step);
+        for (unsigned int i = 0; i < hashes_count; i++, position += step) {
+            if ( get((size_t) (position % counter_count)) == 0 ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t memoryBytes() const {
+        return words.size() * sizeof(uint64_t);
+    }
+
+private:
+    static const unsigned int SATURATED = 15;
+
+    unsigned int get(size_t counter) const {
+        return (unsigned int) (words[counter / 16] >> (counter % 16 * 4)) & 0xf;
+    }
+
+    std::vector<uint64_t> words;
+    size_t counter_count;
+    unsigned int hashes_count;
+    Hash hash;
+};
+
+#endif //BINARY_TREE_BLOOMFILTER_H
@@ -0,0 +1,213 @@
+#ifndef BINARY_TREE_BUFFERPOOL_H
+#define BINARY_TREE_BUFFERPOOL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+struct BufferPoolStats {
+    uint64_t hits = 0;
+    // page faults: requests that had to read the page from file
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t writes = 0;
+
+    double hitRate() const {
+        return hits + misses == 0 ? 0.0 : (double) hits / (hits + misses);
+    }
+};
+
+// Fixed number of page sized frames caching pages of a file.
+//
+// Pages are pinned while a PageHandle refers to them; least recently used
+// unpinned page is evicted when a frame is needed, and written back first
+// when it was changed. File descriptor stays owned by the caller.
+class BufferPool {
+    struct Frame;
+
+public:
+    class PageHandle {
+    public:
+        PageHandle() : frame(nullptr) { }
+        explicit PageHandle(Frame *frame) : frame(frame) {
+            frame->pins++;
+        }
+        PageHandle(PageHandle &&other) : frame(other.frame) {
+            other.frame = nullptr;
+        }
+        PageHandle &operator=(PageHandle &&other) {
+            release();
+            frame = other.frame;
+            other.frame = nullptr;
+            return *this;
+        }
+        ~PageHandle() {
+            release();
+        }
+
+        PageHandle(const PageHandle &) = delete;
+        PageHandle &operator=(const PageHandle &) = delete;
+
+        uint32_t id() const {
+            return frame->page_id;
+        }
+        const char *data() const {
+            return frame->data.data();
+        }
+        // Marks page changed, it is written back before eviction.
+        char *mutableData() {
+            frame->dirty = true;
+            return frame->data.data();
+        }
+
+    private:
+        void release() {
+            if ( frame != nullptr ) {
+                frame->pins--;
+                frame = nullptr;
+            }
+        }
+
+        Frame *frame;
+    };
+
+    BufferPool(int fd, size_t page_size, size_t capacity)
+            : fd(fd), page_size(page_size), frames(capacity) {
+        for (auto &frame : frames) {
+            frame.data.resize(page_size);
+            free_frames.push_back(&frame);
+        }
+    }
+
+    // Returns page read from file or found in cache.
+    PageHandle fetch(uint32_t page_id) {
+        auto cached = pages.find(page_id);
+        if ( cached != pages.end() ) {
+            statistics.hits++;
+            Frame *frame = cached->second;
+            recently_used.splice(recently_used.begin(), recently_used, frame->position);
+            return PageHandle(frame);
+        }
+        statistics.misses++;
+        Frame *frame = takeFrame(page_id);
+        off_t offset = (off_t) page_id * page_size;
+        size_t done = 0;
+        while ( done < page_size ) {
+            ssize_t result = pread(fd, frame->data.data() + done, page_size - done, offset + done);
+            if ( result < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( result <= 0 ) {
+                dropFrame(frame);
+                throw std::string("Failed to read page.");
+            }
+            done += (size_t) result;
+        }
+        return PageHandle(frame);
+    }
+
+    // Returns zeroed page that does not exist in file yet.
+    PageHandle create(uint32_t page_id) {
+        Frame *frame = takeFrame(page_id);
+        std::memset(frame->data.data(), 0, page_size);
+        frame->dirty = true;
+        return PageHandle(frame);
+    }
+
+    // Writes every changed page back to file.
+    void flush() {
+        for (auto &frame : frames) {
+            if ( frame.dirty ) {
+                writeBack(&frame);
+            }
+        }
+    }
+
+    size_t pageSize() const {
+        return page_size;
+    }
+    const BufferPoolStats &stats() const {
+        return statistics;
+    }
+    void resetStats() {
+        statistics = BufferPoolStats();
+    }
+
+private:
+    struct Frame {
+        uint32_t page_id = 0;
+        unsigned int pins = 0;
+        bool dirty = false;
+        std::vector<char> data;
+        std::list<Frame*>::iterator position;
+    };
+
+    Frame *takeFrame(uint32_t page_id) {
+        Frame *frame = nullptr;
+        if ( !free_frames.empty() ) {
+            frame = free_frames.back();
+            free_frames.pop_back();
+        } else {
+            for (auto iter = recently_used.rbegin(); iter != recently_used.rend(); ++iter) {
+                if ( (*iter)->pins == 0 ) {
+                    frame = *iter;
+                    break;
+                }
+            }
+            if ( frame == nullptr ) {
+                throw std::string("All buffer pool pages are pinned.");
+            }
+            if ( frame->dirty ) {
+                writeBack(frame);
+            }
+            statistics.evictions++;
+            pages.erase(frame->page_id);
+            recently_used.erase(frame->position);
+        }
+        frame->page_id = page_id;
+        frame->dirty = false;
+        recently_used.push_front(frame);
+        frame->position = recently_used.begin();
+        pages[page_id] = frame;
+        return frame;
+    }
+
+    void dropFrame(Frame *frame) {
+        pages.erase(frame->page_id);
+        recently_used.erase(frame->position);
+        free_frames.push_back(frame);
+    }
+
+    void writeBack(Frame *frame) {
+        off_t offset = (off_t) frame->page_id * page_size;
+        size_t done = 0;
+        while ( done < page_size ) {
+            ssize_t result = pwrite(fd, frame->data.data() + done, page_size - done, offset + done);
+            if ( result < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( result <= 0 ) {
+                throw std::string("Failed to write page.");
+            }
+            done += (size_t) result;
+        }
+        frame->dirty = false;
+        statistics.writes++;
+    }
+
+    int fd;
+    size_t page_size;
+    std::vector<Frame> frames;
+    std::vector<Frame*> free_frames;
+    std::list<Frame*> recently_used;
+    std::unordered_map<uint32_t, Frame*> pages;
+    BufferPoolStats statistics;
+};
+
+#endif //BINARY_TREE_BUFFERPOOL_H
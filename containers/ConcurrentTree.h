@@ -0,0 +1,110 @@
+#ifndef BINARY_TREE_CONCURRENTTREE_H
+#define BINARY_TREE_CONCURRENTTREE_H
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+
+#include "Tree.h"
+#include "EpochReclaimer.h"
+
+// Tree for many reader threads and concurrent writers.
+//
+// Readers never lock: they pin an epoch, load the current immutable version
+// and traverse it with plain pointers. Writers serialize among themselves,
+// build the next version from the current one (Tree copies share nodes and
+// clone only the changed path) and publish it with a single atomic store.
+// Replaced versions are destroyed once no reader can observe them, which
+// drops the nodes they no longer share with the newer version.
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
+class ConcurrentTree {
+public:
+    typedef Tree<Element, Compare> Version;
+    typedef typename Version::ConstElementsTraverseFunc ElementsTraverseFunc;
+    typedef typename Version::ElementPredicate ElementPredicate;
+
+    ConcurrentTree(Compare compare = Compare()) : current(new Version(compare)) { }
+    ~ConcurrentTree() {
+        delete current.load();
+    }
+
+    ConcurrentTree(const ConcurrentTree &) = delete;
+    ConcurrentTree &operator=(const ConcurrentTree &) = delete;
+
+    /// Readers, lock free
+
+    bool isMember(const Element &el) const {
+        return read([&](const Version &tree) { return tree.isMember(el); });
+    }
+    unsigned int countElements(const Element &el) const {
+        return read([&](const Version &tree) { return tree.countElements(el); });
+    }
+    unsigned int countElements(const Element &low, const Element &high) const {
+        return read([&](const Version &tree) { return tree.countElements(low, high); });
+    }
+    unsigned int size() const {
+        return read([&](const Version &tree) { return tree.size(); });
+    }
+    // whole traversal observes one consistent version
+    void inOrderTraverse(ElementsTraverseFunc func) const {
+        read([&](const Version &tree) { tree.inOrderTraverse(func); return 0; });
+    }
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const {
+        read([&](const Version &tree) { tree.inRangeTraverse(low, high, func); return 0; });
+    }
+
+    // Runs func over current version; the version stays valid until func returns.
+    template<typename ReadFunc>
+    auto read(ReadFunc func) const -> decltype(func(std::declval<const Version &>())) {
+        auto guard = reclaimer.pin();
+        return func(*current.load());
+    }
+
+    /// Writers
+
+    void insert(const Element &el) {
+        write([&](Version &tree) { tree.insert(el); return 1u; });
+    }
+    unsigned int removeAll(const Element &el) {
+        return write([&](Version &tree) { return tree.removeAll(el); });
+    }
+    unsigned int removeAll(ElementPredicate func) {
+        return write([&](Version &tree) { return tree.removeAll(func); });
+    }
+    unsigned int remove(const Element &el, unsigned int count = 1) {
+        return write([&](Version &tree) { return tree.remove(el, count); });
+    }
+    void clear() {
+        write([&](Version &tree) { tree.clear(); return 1u; });
+    }
+
+    // Applies mutation to a private copy of current version and publishes it.
+    template<typename WriteFunc>
+    unsigned int write(WriteFunc mutation);
+
+private:
+    std::atomic<const Version*> current;
+    std::mutex writers_lock;
+    mutable EpochReclaimer reclaimer;
+};
+
+template<typename Element, typename Compare>
+template<typename WriteFunc>
+unsigned int ConcurrentTree<Element, Compare>::write(WriteFunc mutation) {
+    std::lock_guard<std::mutex> lock(writers_lock);
+    const Version *previous = current.load();
+    Version *next = new Version(*previous);
+    unsigned int changed = mutation(*next);
+    if ( changed == 0 ) {
+        delete next;
+        return changed;
+    }
+    current.store(next);
+    reclaimer.retire([previous]() {
+        delete previous;
+    });
+    reclaimer.reclaim();
+    return changed;
+}
+
+#endif //BINARY_TREE_CONCURRENTTREE_H
@@ -0,0 +1,450 @@
+#ifndef BINARY_TREE_DURABLETREE_H
+#define BINARY_TREE_DURABLETREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Tree.h"
+
+struct DurableTreeOptions {
+    // Group commit: that many operations share one write and fdatasync.
+    // 1 makes every operation durable before it returns.
+    unsigned int operations_per_sync = 64;
+    // Checkpoint is started automatically once log grows beyond this size.
+    uint64_t checkpoint_log_bytes = 64ULL << 20;
+};
+
+// Tree that survives process crashes.
+//
+// Every successful insert, remove and removeAll is appended to a write
+// ahead log in the tree directory. Operations are grouped into batches,
+// each batch is written and synced at once and carries its own checksum,
+// so recovery replays whole batches and drops a torn one at the log tail.
+// Operations of an unfinished batch are lost on crash; call sync() to make
+// everything done so far durable.
+//
+// Checkpoints store the whole tree in Tree::serialize format. Checkpoint
+// switches writes to a new log generation and serializes an O(1) copy of
+// the tree on a background thread while the tree keeps changing, then
+// atomically renames the finished file and deletes logs it covers.
+// Startup loads the newest checkpoint and replays the logs written after it.
+//
+// Directory layout, N is a generation number:
+//   checkpoint.N    state before any operation of log.N
+//   log.N           batches: uint32 count, operations, uint64 FNV-1a checksum
+//
+// Like Tree, DurableTree is not thread safe. I/O errors are reported by
+// throwing std::string. A failed log write leaves the tree failed: the log
+// is cut back to the last synced batch, and every later change throws,
+// since the tree already holds operations the log lost. Reopen the
+// directory to continue from the durable state.
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
+class DurableTree {
+public:
+    typedef Tree<Element, Compare> State;
+    typedef typename State::ConstElementsTraverseFunc ElementsTraverseFunc;
+
+    // Recovers tree stored in directory, creating an empty one when the directory is empty.
+    explicit DurableTree(const std::string &directory, DurableTreeOptions options = DurableTreeOptions(),
+                         Compare compare = Compare());
+    // Syncs pending operations and waits for running checkpoint.
+    ~DurableTree();
+
+    DurableTree(const DurableTree &) = delete;
+    DurableTree &operator=(const DurableTree &) = delete;
+
+    void insert(const Element &el);
+    unsigned int remove(const Element &el, unsigned int count = 1);
+    unsigned int removeAll(const Element &el) {
+        return remove(el, UINT_MAX);
+    }
+
+    bool isMember(const Element &el) const {
+        return state.isMember(el);
+    }
+    unsigned int countElements(const Element &el) const {
+        return state.countElements(el);
+    }
+    unsigned int size() const {
+        return state.size();
+    }
+    // Read only access for the rest of Tree queries and traversals.
+    const State &tree() const {
+        return state;
+    }
+
+    // Writes and syncs operations of the unfinished batch.
+    void sync();
+    // Starts background checkpoint of current state, waiting for previous one first.
+    void checkpoint();
+    // Waits for running checkpoint and rethrows its error.
+    void waitForCheckpoint();
+
+private:
+
+    enum Operation : uint8_t { Insert = 1, Remove = 2 };
+
+    struct LogRecord {
+        Operation operation;
+        uint32_t count;
+        Element element;
+    };
+
+    std::string fileName(const char *prefix, uint64_t generation) const {
+        return directory + "/" + prefix + std::to_string(generation);
+    }
+
+    void recover();
+    void replayLog(const std::string &file_name);
+    void openLog(uint64_t generation);
+    void appendRecord(Operation operation, uint32_t count, const Element &el);
+    void ensureWritable() const;
+    void writeBatch();
+    void checkpointIfLogIsLong();
+    void writeCheckpoint(const State &copy, uint64_t generation);
+    void removeObsoleteFiles(uint64_t generation);
+    void syncDirectory();
+
+    std::string directory;
+    DurableTreeOptions options;
+    Compare compare;
+    State state;
+
+    int log_fd;
+    uint64_t log_generation;
+    uint64_t log_bytes;
+    std::ostringstream batch;
+    std::unique_ptr<TreeWriter> batch_writer;
+    uint32_t batch_operations;
+    bool failed;
+
+    std::thread checkpoint_thread;
+    std::atomic<bool> checkpoint_running;
+    std::string checkpoint_error;
+};
+
+template<typename Element, typename Compare>
+DurableTree<Element, Compare>::DurableTree(const std::string &directory, DurableTreeOptions options,
+                                           Compare compare)
+        : directory(directory), options(options), compare(compare), state(compare), log_fd(-1), log_generation(0),
+          log_bytes(0), batch_operations(0), failed(false), checkpoint_running(false) {
+    if ( mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST ) {
+        throw std::string("Failed to create durable tree directory.");
+    }
+    recover();
+}
+
+template<typename Element, typename Compare>
+DurableTree<Element, Compare>::~DurableTree() {
+    try {
+        writeBatch();
+    } catch (const std::string &) {
+        // nothing to report to from destructor, unsynced batch is lost as on crash
+    }
+    if ( checkpoint_thread.joinable() ) {
+        checkpoint_thread.join();
+    }
+    if ( log_fd >= 0 ) {
+        close(log_fd);
+    }
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::recover() {
+    std::vector<uint64_t> checkpoints, logs;
+    DIR *dir = opendir(directory.c_str());
+    if ( dir == nullptr ) {
+        throw std::string("Failed to read durable tree directory.");
+    }
+    while ( dirent *entry = readdir(dir) ) {
+        std::string name = entry->d_name;
+        if ( name.find(".tmp") != std::string::npos ) {
+            unlink((directory + "/" + name).c_str());
+        } else if ( name.compare(0, 11, "checkpoint.") == 0 ) {
+            checkpoints.push_back(std::strtoull(name.c_str() + 11, nullptr, 10));
+        } else if ( name.compare(0, 4, "log.") == 0 ) {
+            logs.push_back(std::strtoull(name.c_str() + 4, nullptr, 10));
+        }
+    }
+    closedir(dir);
+
+    uint64_t base = 0;
+    if ( !checkpoints.empty() ) {
+        base = *std::max_element(checkpoints.begin(), checkpoints.end());
+        std::ifstream in(fileName("checkpoint.", base).c_str(), std::ios::binary);
+        state = State::deserialize(in, compare);
+    }
+    std::sort(logs.begin(), logs.end());
+    uint64_t last = base;
+    for (uint64_t generation : logs) {
+        if ( generation >= base ) {
+            replayLog(fileName("log.", generation));
+            last = generation;
+        }
+    }
+    // Never append after a possibly torn tail, continue in a fresh log.
+    openLog(logs.empty() && checkpoints.empty() ? 0 : last + 1);
+    removeObsoleteFiles(base);
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::replayLog(const std::string &file_name) {
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+    TreeReader reader(in);
+    std::vector<LogRecord> records;
+    while ( !reader.atEnd() ) {
+        records.clear();
+        try {
+            uint32_t count = reader.readValue<uint32_t>();
+            for (uint32_t i = 0; i < count; i++) {
+                Operation operation = (Operation) reader.readValue<uint8_t>();
+                uint32_t times = reader.readValue<uint32_t>();
+                records.push_back(LogRecord{operation, times, ElementCodec<Element>::read(reader)});
+            }
+            reader.verifyChecksum();
+        } catch (...) {
+            // torn batch of interrupted write, nothing after it was ever synced;
+            // codecs of own element types may throw anything on such garbage
+            return;
+        }
+        for (auto &record : records) {
+            if ( record.operation == Insert ) {
+                for (uint32_t i = 0; i < record.count; i++) {
+                    state.insert(record.element);
+                }
+            } else {
+                state.remove(record.element, record.count);
+            }
+        }
+    }
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::openLog(uint64_t generation) {
+    int fd = open(fileName("log.", generation).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if ( fd < 0 ) {
+        throw std::string("Failed to open durable tree log.");
+    }
+    if ( log_fd >= 0 ) {
+        close(log_fd);
+    }
+    log_fd = fd;
+    log_generation = generation;
+    log_bytes = 0;
+    syncDirectory();
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::insert(const Element &el) {
+    ensureWritable();
+    state.insert(el);
+    appendRecord(Insert, 1, el);
+}
+
+template<typename Element, typename Compare>
+unsigned int DurableTree<Element, Compare>::remove(const Element &el, unsigned int count) {
+    ensureWritable();
+    unsigned int removed = state.remove(el, count);
+    if ( removed != 0 ) {
+        appendRecord(Remove, removed, el);
+    }
+    return removed;
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::appendRecord(Operation operation, uint32_t count, const Element &el) {
+    if ( batch_writer == nullptr ) {
+        batch.str(std::string());
+        batch_writer.reset(new TreeWriter(batch));
+    }
+    batch_writer->writeValue<uint8_t>(operation);
+    batch_writer->writeValue<uint32_t>(count);
+    ElementCodec<Element>::write(*batch_writer, el);
+    if ( ++batch_operations >= options.operations_per_sync ) {
+        sync();
+    }
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::sync() {
+    writeBatch();
+    checkpointIfLogIsLong();
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::ensureWritable() const {
+    if ( failed ) {
+        throw std::string("Durable tree log failed, reopen the tree.");
+    }
+}
+
+// Batch is dropped only once it is synced. On error the log is truncated
+// to its synced length, so a torn frame never stays in front of anything,
+// and the tree is marked failed, as its state is ahead of the log.
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::writeBatch() {
+    if ( batch_writer == nullptr ) {
+        return;
+    }
+    ensureWritable();
+    batch_writer->flush();
+
+    // Operations count is known only now, so records are framed once more
+    // to get count in front and one checksum over the whole batch.
+    std::ostringstream framed;
+    TreeWriter frame(framed);
+    frame.writeValue<uint32_t>(batch_operations);
+    std::string records = batch.str();
+    frame.writeBytes(records.data(), records.size());
+    frame.writeChecksum();
+    frame.flush();
+
+    std::string data = framed.str();
+    size_t written = 0;
+    const char *error = nullptr;
+    while ( written < data.size() ) {
+        ssize_t result = write(log_fd, data.data() + written, data.size() - written);
+        if ( result < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            error = "Failed to write durable tree log.";
+            break;
+        }
+        written += (size_t) result;
+    }
+    if ( error == nullptr && fdatasync(log_fd) != 0 ) {
+        error = "Failed to sync durable tree log.";
+    }
+    if ( error != nullptr ) {
+        failed = true;
+        // best effort: a torn frame left at the tail is dropped by recovery anyway
+        if ( ftruncate(log_fd, (off_t) log_bytes) == 0 ) {
+            fdatasync(log_fd);
+        }
+        throw std::string(error);
+    }
+    log_bytes += data.size();
+    batch_writer.reset();
+    batch_operations = 0;
+}
+
+// Automatic checkpoint never waits for running one, the log is checked
+// again after next batch.
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::checkpointIfLogIsLong() {
+    if ( log_bytes >= options.checkpoint_log_bytes && !checkpoint_running ) {
+        checkpoint();
+    }
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::checkpoint() {
+    ensureWritable();
+    waitForCheckpoint();
+    writeBatch();
+    uint64_t generation = log_generation + 1;
+    openLog(generation);
+    // Copy shares nodes with the tree, which copies them before changing,
+    // so the background thread reads a stable version without locks.
+    State copy = state;
+    checkpoint_running = true;
+    checkpoint_thread = std::thread([this, copy, generation]() {
+        try {
+            writeCheckpoint(copy, generation);
+            removeObsoleteFiles(generation);
+        } catch (const std::string &error) {
+            checkpoint_error = error;
+        }
+        checkpoint_running = false;
+    });
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::waitForCheckpoint() {
+    if ( checkpoint_thread.joinable() ) {
+        checkpoint_thread.join();
+    }
+    if ( !checkpoint_error.empty() ) {
+        std::string error;
+        std::swap(error, checkpoint_error);
+        throw error;
+    }
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::writeCheckpoint(const State &copy, uint64_t generation) {
+    std::string final_name = fileName("checkpoint.", generation);
+    std::string temporary_name = final_name + ".tmp";
+    {
+        std::ofstream out(temporary_name.c_str(), std::ios::binary | std::ios::trunc);
+        copy.serialize(out);
+        out.flush();
+        if ( !out ) {
+            throw std::string("Failed to write durable tree checkpoint.");
+        }
+    }
+    int fd = open(temporary_name.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if ( fd >= 0 ) {
+        close(fd);
+    }
+    if ( !synced || rename(temporary_name.c_str(), final_name.c_str()) != 0 ) {
+        throw std::string("Failed to store durable tree checkpoint.");
+    }
+    syncDirectory();
+}
+
+// Deletes checkpoints and logs older than given generation.
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::removeObsoleteFiles(uint64_t generation) {
+    DIR *dir = opendir(directory.c_str());
+    if ( dir == nullptr ) {
+        return;
+    }
+    std::vector<std::string> obsolete;
+    while ( dirent *entry = readdir(dir) ) {
+        std::string name = entry->d_name;
+        if ( name.find(".tmp") != std::string::npos ) {
+            continue;
+        }
+        if ( (name.compare(0, 11, "checkpoint.") == 0 && std::strtoull(name.c_str() + 11, nullptr, 10) < generation) ||
+             (name.compare(0, 4, "log.") == 0 && std::strtoull(name.c_str() + 4, nullptr, 10) < generation) ) {
+            obsolete.push_back(directory + "/" + name);
+        }
+    }
+    closedir(dir);
+    for (auto &name : obsolete) {
+        unlink(name.c_str());
+    }
+}
+
+template<typename Element, typename Compare>
+void DurableTree<Element, Compare>::syncDirectory() {
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if ( fd < 0 ) {
+        throw std::string("Failed to open durable tree directory.");
+    }
+    int result = fsync(fd);
+    close(fd);
+    if ( result != 0 ) {
+        throw std::string("Failed to sync durable tree directory.");
+    }
+}
+
+#endif //BINARY_TREE_DURABLETREE_H
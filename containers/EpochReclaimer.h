@@ -0,0 +1,152 @@
+#ifndef BINARY_TREE_EPOCHRECLAIMER_H
+#define BINARY_TREE_EPOCHRECLAIMER_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Epoch based memory reclamation for lock free readers.
+//
+// Reader pins current epoch for the duration of its traversal (see Guard).
+// Writer unlinks object from shared structure first and then retires it;
+// retired object is destroyed only after every reader that could still
+// observe it has left its critical section.
+class EpochReclaimer {
+public:
+    typedef std::function<void()> Deleter;
+
+    class Guard {
+    public:
+        Guard(const EpochReclaimer &reclaimer) : reclaimer(&reclaimer), slot(reclaimer.enter()) { }
+        Guard(Guard &&other) : reclaimer(other.reclaimer), slot(other.slot) {
+            other.reclaimer = nullptr;
+        }
+        ~Guard() {
+            if ( reclaimer != nullptr ) {
+                reclaimer->leave(slot);
+            }
+        }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+    private:
+        const EpochReclaimer *reclaimer;
+        unsigned int slot;
+    };
+
+    explicit EpochReclaimer(unsigned int slots_count = defaultSlotsCount())
+            : global_epoch(1), slots(slots_count) {
+        for (auto &slot : slots) {
+            slot.epoch.store(0);
+        }
+    }
+
+    ~EpochReclaimer() {
+        for (auto &retired_object : retired) {
+            retired_object.deleter();
+        }
+    }
+
+    EpochReclaimer(const EpochReclaimer &) = delete;
+    EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+
+    Guard pin() const {
+        return Guard(*this);
+    }
+
+    // Object must be already unreachable for readers that start after this call.
+    void retire(Deleter deleter) {
+        unsigned long epoch = global_epoch.fetch_add(1);
+        std::lock_guard<std::mutex> lock(retired_lock);
+        retired.push_back(RetiredObject{epoch, std::move(deleter)});
+    }
+
+    // Destroys retired objects that no active reader can reference any more.
+    void reclaim() {
+        std::vector<RetiredObject> reclaimable;
+        {
+            std::unique_lock<std::mutex> lock(retired_lock, std::try_to_lock);
+            if ( !lock.owns_lock() || retired.empty() ) {
+                return;
+            }
+            unsigned long oldest = oldestActiveEpoch();
+            auto keep = retired.begin();
+            for (auto iter = retired.begin(); iter != retired.end(); ++iter) {
+                if ( iter->epoch < oldest ) {
+                    reclaimable.push_back(std::move(*iter));
+                } else {
+                    *keep++ = std::move(*iter);
+                }
+            }
+            retired.erase(keep, retired.end());
+        }
+        for (auto &retired_object : reclaimable) {
+            retired_object.deleter();
+        }
+    }
+
+    unsigned int pendingCount() const {
+        std::lock_guard<std::mutex> lock(retired_lock);
+        return (unsigned int) retired.size();
+    }
+
+private:
+
+    struct RetiredObject {
+        unsigned long epoch;
+        Deleter deleter;
+    };
+
+    // one cache line per slot, so readers on different cores do not share lines
+    struct alignas(64) Slot {
+        std::atomic<unsigned long> epoch;
+    };
+
+    static unsigned int defaultSlotsCount() {
+        unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 16 ? 4 * cores : 64;
+    }
+
+    // Announces current epoch in a free slot. Announcement and every later
+    // load by the reader are sequentially consistent with writer's unlink,
+    // epoch increment and slots scan, so writer either sees the reader or
+    // the reader sees already unlinked structure.
+    unsigned int enter() const {
+        unsigned int slots_count = (unsigned int) slots.size();
+        unsigned int i = (unsigned int) (std::hash<std::thread::id>()(std::this_thread::get_id()) % slots_count);
+        for (unsigned int probes = 1; ; probes++, i = (i + 1) % slots_count) {
+            unsigned long free_slot = 0;
+            if ( slots[i].epoch.load(std::memory_order_relaxed) == 0 &&
+                 slots[i].epoch.compare_exchange_strong(free_slot, global_epoch.load()) ) {
+                return i;
+            }
+            if ( probes % slots_count == 0 ) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void leave(unsigned int slot) const {
+        slots[slot].epoch.store(0, std::memory_order_release);
+    }
+
+    unsigned long oldestActiveEpoch() const {
+        unsigned long oldest = global_epoch.load();
+        for (auto &slot : slots) {
+            unsigned long epoch = slot.epoch.load();
+            if ( epoch != 0 && epoch < oldest ) {
+                oldest = epoch;
+            }
+        }
+        return oldest;
+    }
+
+    std::atomic<unsigned long> global_epoch;
+    mutable std::vector<Slot> slots;
+    mutable std::mutex retired_lock;
+    std::vector<RetiredObject> retired;
+};
+
+#endif //BINARY_TREE_EPOCHRECLAIMER_H
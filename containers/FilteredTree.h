@@ -0,0 +1,148 @@
+#ifndef BINARY_TREE_FILTEREDTREE_H
+#define BINARY_TREE_FILTEREDTREE_H
+
+#include <cstdint>
+#include <functional>
+
+#include "Tree.h"
+#include "BloomFilter.h"
+
+struct FilteredTreeOptions {
+    // filter is sized for that many elements and rebuilt for twice as many
+    // once the tree outgrows it
+    size_t expected_elements = 1024;
+    // 4 bit counters per element: false positive rate is about
+    // 0.6185^counters_per_element (1% at 10), memory is half a byte per counter
+    unsigned int counters_per_element = 10;
+    TreeBalancing balancing = TreeBalancing::None;
+};
+
+struct TreeFilterStats {
+    // isMember and countElements(el) calls
+    uint64_t lookups = 0;
+    // lookups answered by the filter without touching the tree
+    uint64_t filtered = 0;
+    // lookups let through by the filter for elements the tree does not hold
+    uint64_t false_positives = 0;
+    // rebuilds after the tree outgrew the filter
+    uint64_t rebuilds = 0;
+    size_t filter_bytes = 0;
+};
+
+// Tree with a counting Bloom filter in front of point lookups.
+//
+// Lookups of absent elements mostly end in O(1) at the filter instead of a
+// root to leaf walk through cold nodes; present elements pay for the filter
+// probe on top of the search. Every insertion and removal updates the
+// filter, removals by predicate included. Elements equal by Compare must
+// have equal Hash values. Like Tree, FilteredTree is not thread safe, and
+// statistics are updated by const lookups too.
+template<typename Element, typename Compare = ThreeWayCompare<Element>, typename Hash = std::hash<Element>>
+class FilteredTree {
+public:
+    typedef Tree<Element, Compare> Elements;
+    typedef typename Elements::ConstElementsTraverseFunc ElementsTraverseFunc;
+    typedef typename Elements::ElementPredicate ElementPredicate;
+
+    FilteredTree(FilteredTreeOptions options = FilteredTreeOptions(), Compare compare = Compare(),
+                 Hash hash = Hash())
+            : options(options), tree(options.balancing, compare), hash(hash),
+              capacity(options.expected_elements), filter(capacity, options.counters_per_element, hash) { }
+
+    void insert(const Element &el) {
+        tree.insert(el);
+        filter.add(el);
+        if ( tree.size() > capacity ) {
+            capacity *= 2;
+            rebuildFilter();
+            filter_stats.rebuilds++;
+        }
+    }
+    unsigned int remove(const Element &el, unsigned int count = 1) {
+        return forget(el, tree.remove(el, count));
+    }
+    unsigned int removeAll(const Element &el) {
+        return forget(el, tree.removeAll(el));
+    }
+    unsigned int removeAll(ElementPredicate func) {
+        return tree.removeAll([&](const Element &el) {
+            if ( !func(el) ) {
+                return false;
+            }
+            filter.remove(el);
+            return true;
+        });
+    }
+    void clear() {
+        tree.clear();
+        filter = CountingBloomFilter<Element, Hash>(capacity, options.counters_per_element, hash);
+    }
+
+    bool isMember(const Element &el) const {
+        return countElements(el) != 0;
+    }
+    unsigned int countElements(const Element &el) const {
+        filter_stats.lookups++;
+        if ( !filter.mayContain(el) ) {
+            filter_stats.filtered++;
+            return 0;
+        }
+        unsigned int count = tree.countElements(el);
+        if ( count == 0 ) {
+            filter_stats.false_positives++;
+        }
+        return count;
+    }
+    unsigned int countElements(const Element &low, const Element &high) const {
+        return tree.countElements(low, high);
+    }
+    unsigned int countElements(ElementPredicate func) const {
+        return tree.countElements(func);
+    }
+    unsigned int size() const {
+        return tree.size();
+    }
+    void inOrderTraverse(ElementsTraverseFunc func) const {
+        tree.inOrderTraverse(func);
+    }
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const {
+        tree.inRangeTraverse(low, high, func);
+    }
+    // ordered view for everything else
+    const Elements &elements() const {
+        return tree;
+    }
+
+    TreeFilterStats filterStats() const {
+        TreeFilterStats stats = filter_stats;
+        stats.filter_bytes = filter.memoryBytes();
+        return stats;
+    }
+    void resetFilterStats() {
+        filter_stats = TreeFilterStats();
+    }
+    // O(n) refill from the tree, drops counters stuck at saturation
+    void rebuildFilter() {
+        filter = CountingBloomFilter<Element, Hash>(capacity, options.counters_per_element, hash);
+        elements().inOrderTraverse([&](const Element &el) {
+            filter.add(el);
+        });
+    }
+
+private:
+    unsigned int forget(const Element &el, unsigned int removed) {
+        for (unsigned int i = 0; i < removed; i++) {
+            filter.remove(el);
+        }
+        return removed;
+    }
+
+    FilteredTreeOptions options;
+    Elements tree;
+    Hash hash;
+    size_t capacity;
+    CountingBloomFilter<Element, Hash> filter;
+    mutable TreeFilterStats filter_stats;
+};
+
+#endif //BINARY_TREE_FILTEREDTREE_H
@@ -0,0 +1,208 @@
+#ifndef BINARY_TREE_HASHINDEXEDTREE_H
+#define BINARY_TREE_HASHINDEXEDTREE_H
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "Tree.h"
+
+// Number of copies of every distinct element in an open addressing table:
+// linear probing over a power of two number of slots, at most 3/4 of them
+// used, removal shifts following entries back instead of leaving
+// tombstones. Element must be default constructible.
+template<typename Element, typename Compare = ThreeWayCompare<Element>, typename Hash = std::hash<Element>>
+class ElementCounts {
+public:
+    ElementCounts(Compare compare = Compare(), Hash hash = Hash()) : compare(compare), hash(hash) { }
+
+    unsigned int count(const Element &el) const {
+        if ( slots.empty() ) {
+            return 0;
+        }
+        for (size_t i = home(el); slots[i].count != 0; i = (i + 1) & mask) {
+            if ( compare(slots[i].element, el) == 0 ) {
+                return slots[i].count;
+            }
+        }
+        return 0;
+    }
+
+    void add(const Element &el, unsigned int count = 1) {
+        if ( (used + 1) * 4 > slots.size() * 3 ) {
+            resize(slots.empty() ? 16 : slots.size() * 2);
+        }
+        size_t i = home(el);
+        for (; slots[i].count != 0; i = (i + 1) & mask) {
+            if ( compare(slots[i].element, el) == 0 ) {
+                slots[i].count += count;
+                return;
+            }
+        }
+        slots[i].element = el;
+        slots[i].count = count;
+        used++;
+    }
+
+    // count must not exceed the stored one
+    void remove(const Element &el, unsigned int count = 1) {
+        if ( slots.empty() || count == 0 ) {
+            return;
+        }
+        size_t i = home(el);
+        for (; slots[i].count != 0; i = (i + 1) & mask) {
+            if ( compare(slots[i].element, el) == 0 ) {
+                break;
+            }
+        }
+        if ( slots[i].count == 0 || (slots[i].count -= count) != 0 ) {
+            return;
+        }
+        // entries after the hole move into it unless that puts them before their home slot
+        size_t hole = i;
+        for (size_t j = (i + 1) & mask; slots[j].count != 0; j = (j + 1) & mask) {
+            if ( ((j - home(slots[j].element)) & mask) >= ((j - hole) & mask) ) {
+                slots[hole] = std::move(slots[j]);
+                hole = j;
+            }
+        }
+        slots[hole] = Slot();
+        used--;
+    }
+
+    void clear() {
+        slots.clear();
+        used = 0;
+        mask = 0;
+    }
+
+    size_t distinct() const {
+        return used;
+    }
+    size_t memoryBytes() const {
+        return slots.capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Slot {
+        Element element = Element();
+        // 0 for empty slot
+        unsigned int count = 0;
+    };
+
+    // std::hash of integers is often identity, so hash value is mixed first
+    size_t home(const Element &el) const {
+        uint64_t mixed = (uint64_t) hash(el);
+        mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+        return (size_t) (mixed ^ (mixed >> 31)) & mask;
+    }
+
+    void resize(size_t slot_count) {
+        std::vector<Slot> old(slot_count);
+        old.swap(slots);
+        mask = slot_count - 1;
+        used = 0;
+        for (Slot &slot : old) {
+            if ( slot.count != 0 ) {
+                size_t i = home(slot.element);
+                while ( slots[i].count != 0 ) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = std::move(slot);
+                used++;
+            }
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t used = 0;
+    Compare compare;
+    Hash hash;
+};
+
+// Tree paired with a hash index of its elements for point lookups.
+//
+// isMember and countElements(el) are answered by the index in expected O(1),
+// traversals and range queries go to the tree. Every insertion and removal
+// updates both, removals by predicate included. The index keeps one copy
+// and a count per distinct element rather than pointers to nodes, since
+// copy on write and balancing replace nodes. Elements equal by Compare must
+// have equal Hash values. Like Tree, HashIndexedTree is not thread safe.
+template<typename Element, typename Compare = ThreeWayCompare<Element>, typename Hash = std::hash<Element>>
+class HashIndexedTree {
+public:
+    typedef Tree<Element, Compare> Elements;
+    typedef typename Elements::ConstElementsTraverseFunc ElementsTraverseFunc;
+    typedef typename Elements::ElementPredicate ElementPredicate;
+
+    HashIndexedTree(TreeBalancing balancing = TreeBalancing::None, Compare compare = Compare(), Hash hash = Hash())
+            : tree(balancing, compare), index(compare, hash) { }
+
+    void insert(const Element &el) {
+        tree.insert(el);
+        index.add(el);
+    }
+    unsigned int remove(const Element &el, unsigned int count = 1) {
+        if ( index.count(el) == 0 ) {
+            return 0;
+        }
+        unsigned int removed = tree.remove(el, count);
+        index.remove(el, removed);
+        return removed;
+    }
+    unsigned int removeAll(const Element &el) {
+        return remove(el, index.count(el));
+    }
+    unsigned int removeAll(ElementPredicate func) {
+        return tree.removeAll([&](const Element &el) {
+            if ( !func(el) ) {
+                return false;
+            }
+            index.remove(el);
+            return true;
+        });
+    }
+    void clear() {
+        tree.clear();
+        index.clear();
+    }
+
+    bool isMember(const Element &el) const {
+        return index.count(el) != 0;
+    }
+    unsigned int countElements(const Element &el) const {
+        return index.count(el);
+    }
+    unsigned int countElements(const Element &low, const Element &high) const {
+        return tree.countElements(low, high);
+    }
+    unsigned int countElements(ElementPredicate func) const {
+        return tree.countElements(func);
+    }
+    unsigned int size() const {
+        return tree.size();
+    }
+    void inOrderTraverse(ElementsTraverseFunc func) const {
+        tree.inOrderTraverse(func);
+    }
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const {
+        tree.inRangeTraverse(low, high, func);
+    }
+    // ordered view for everything else
+    const Elements &elements() const {
+        return tree;
+    }
+    // memory taken by the index on top of the tree
+    size_t indexBytes() const {
+        return index.memoryBytes();
+    }
+
+private:
+    Elements tree;
+    ElementCounts<Element, Compare, Hash> index;
+};
+
+#endif //BINARY_TREE_HASHINDEXEDTREE_H
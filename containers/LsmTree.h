@@ -0,0 +1,446 @@
+#ifndef BINARY_TREE_LSMTREE_H
+#define BINARY_TREE_LSMTREE_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TreeMap.h"
+#include "BloomFilter.h"
+
+struct LsmTreeOptions {
+    // distinct elements in memtable before it is frozen into a run
+    unsigned int memtable_elements = 4096;
+    // Runs of similar size form a tier, tier k holds runs of about
+    // memtable_elements * max_runs^k elements. Tier with max_runs runs is
+    // merged into one run of the next tier in background; writers stall
+    // while there are more than 2 * max_runs runs per tier.
+    unsigned int max_runs = 4;
+    unsigned int bloom_bits_per_element = 10;
+};
+
+// Write optimized multiset for ingest heavy workloads.
+//
+// Writes only touch a small in memory memtable (TreeMap of element to count
+// delta), which stays cache resident; it is a treap, so sorted ingest
+// (timestamps, counters) costs O(log n) per write as random one does.
+// Full memtable is frozen into an immutable run: sorted array of distinct
+// elements with their deltas and a Bloom filter. Background thread merges runs of one size tier once the
+// tier fills up, so every element is rewritten once per tier, O(log n)
+// times in total, and lookups check O(log n) runs. Queries sum deltas of memtable and every run; point
+// lookups skip runs whose filter rules the element out, range queries merge
+// sorted runs.
+//
+// Like Tree, LsmTree is not thread safe, only compaction runs concurrently
+// with it.
+template<typename Element, typename Compare = ThreeWayCompare<Element>, typename Hash = std::hash<Element>>
+class LsmTree {
+public:
+    typedef std::function<void(const Element &)> ElementsTraverseFunc;
+
+    LsmTree(LsmTreeOptions options = LsmTreeOptions(), Compare compare = Compare(), Hash hash = Hash());
+    ~LsmTree();
+
+    LsmTree(const LsmTree &) = delete;
+    LsmTree &operator=(const LsmTree &) = delete;
+
+    void insert(const Element &el) {
+        addDelta(el, 1);
+        number_of_elements++;
+    }
+    bool isMember(const Element &el) const {
+        return countElements(el) != 0;
+    }
+    unsigned int countElements(const Element &el) const;
+    // number of elements in closed interval [low, high]
+    unsigned int countElements(const Element &low, const Element &high) const;
+    unsigned int remove(const Element &el, unsigned int count = 1);
+    unsigned int removeAll(const Element &el) {
+        return remove(el, UINT_MAX);
+    }
+    unsigned int size() const {
+        return number_of_elements;
+    }
+
+    void inOrderTraverse(ElementsTraverseFunc func) const;
+    // in order traversal of elements from closed interval [low, high]
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const;
+
+    // Freezes memtable into a run.
+    void flush();
+    // Blocks until no tier holds max_runs runs.
+    void waitForCompaction();
+    unsigned int runsCount() const;
+    // elements written by compactions so far, divided by number of
+    // inserted elements gives write amplification
+    uint64_t compactedElements() const;
+
+private:
+
+    struct Run {
+        Run(size_t size, unsigned int bits_per_element, Hash hash) : filter(size, bits_per_element, hash) {
+            elements.reserve(size);
+            deltas.reserve(size);
+        }
+
+        std::vector<Element> elements;
+        std::vector<int> deltas;
+        BloomFilter<Element, Hash> filter;
+    };
+    typedef std::shared_ptr<const Run> RunPtr;
+
+    // Sorted sequence of distinct elements with deltas taking part in merge.
+    struct Cursor {
+        const Element *element;
+        const Element *end;
+        const int *delta;
+    };
+
+    void addDelta(const Element &el, int delta);
+    std::vector<RunPtr> currentRuns() const;
+    // Following three are called under runs_lock.
+    unsigned int tier(size_t elements) const;
+    // runs of the smallest full tier, empty when no compaction is due
+    std::vector<RunPtr> dueRuns() const;
+    size_t stallLimit() const;
+    // Merges memtable and runs over closed interval, bounds are optional.
+    // Calls visit(element, count) for elements with positive total count.
+    template<typename Visitor>
+    void mergeRange(const Element *low, const Element *high, Visitor visit) const;
+    // Calls visit(element, total) for elements with nonzero total delta.
+    template<typename Visitor>
+    void mergeCursors(std::vector<Cursor> &cursors, Visitor visit) const;
+    void compactionLoop();
+
+    LsmTreeOptions options;
+    Compare compare;
+    Hash hash;
+    TreeMap<Element, int, Compare> memtable;
+    unsigned int number_of_elements;
+
+    // newest run first
+    std::vector<RunPtr> runs;
+    mutable std::mutex runs_lock;
+    std::condition_variable runs_changed;
+    uint64_t compacted_elements;
+    bool stopping;
+    std::thread compactor;
+};
+
+template<typename Element, typename Compare, typename Hash>
+LsmTree<Element, Compare, Hash>::LsmTree(LsmTreeOptions options, Compare compare, Hash hash)
+        : options(options), compare(compare), hash(hash), memtable(TreeBalancing::Treap, compare),
+          number_of_elements(0), compacted_elements(0), stopping(false) {
+    compactor = std::thread([this]() {
+        compactionLoop();
+    });
+}
+
+template<typename Element, typename Compare, typename Hash>
+LsmTree<Element, Compare, Hash>::~LsmTree() {
+    {
+        std::lock_guard<std::mutex> lock(runs_lock);
+        stopping = true;
+    }
+    runs_changed.notify_all();
+    compactor.join();
+}
+
+template<typename Element, typename Compare, typename Hash>
+void LsmTree<Element, Compare, Hash>::addDelta(const Element &el, int delta) {
+    int &total = memtable[el];
+    total += delta;
+    if ( total == 0 ) {
+        memtable.remove(el);
+    }
+    if ( memtable.size() >= options.memtable_elements ) {
+        flush();
+    }
+}
+
+template<typename Element, typename Compare, typename Hash>
+unsigned int LsmTree<Element, Compare, Hash>::remove(const Element &el, unsigned int count) {
+    unsigned int present = countElements(el);
+    unsigned int removed = count < present ? count : present;
+    if ( removed != 0 ) {
+        addDelta(el, -(int) removed);
+        number_of_elements -= removed;
+    }
+    return removed;
+}
+
+template<typename Element, typename Compare, typename Hash>
+void LsmTree<Element, Compare, Hash>::flush() {
+    if ( memtable.size() == 0 ) {
+        return;
+    }
+    std::shared_ptr<Run> run = std::make_shared<Run>(memtable.size(), options.bloom_bits_per_element, hash);
+    memtable.inOrderTraverse([&](const Element &el, const int &delta) {
+        run->elements.push_back(el);
+        run->deltas.push_back(delta);
+        run->filter.add(el);
+    });
+    memtable.clear();
+
+    std::unique_lock<std::mutex> lock(runs_lock);
+    runs.insert(runs.begin(), run);
+    runs_changed.notify_all();
+    runs_changed.wait(lock, [&]() {
+        return runs.size() <= stallLimit();
+    });
+}
+
+template<typename Element, typename Compare, typename Hash>
+void LsmTree<Element, Compare, Hash>::waitForCompaction() {
+    std::unique_lock<std::mutex> lock(runs_lock);
+    runs_changed.wait(lock, [&]() {
+        return dueRuns().empty();
+    });
+}
+
+template<typename Element, typename Compare, typename Hash>
+unsigned int LsmTree<Element, Compare, Hash>::runsCount() const {
+    std::lock_guard<std::mutex> lock(runs_lock);
+    return (unsigned int) runs.size();
+}
+
+template<typename Element, typename Compare, typename Hash>
+uint64_t LsmTree<Element, Compare, Hash>::compactedElements() const {
+    std::lock_guard<std::mutex> lock(runs_lock);
+    return compacted_elements;
+}
+
+template<typename Element, typename Compare, typename Hash>
+std::vector<typename LsmTree<Element, Compare, Hash>::RunPtr> LsmTree<Element, Compare, Hash>::currentRuns() const {
+    std::lock_guard<std::mutex> lock(runs_lock);
+    return runs;
+}
+
+template<typename Element, typename Compare, typename Hash>
+unsigned int LsmTree<Element, Compare, Hash>::tier(size_t elements) const {
+    uint64_t fanout = std::max(options.max_runs, 2u);
+    uint64_t bound = (uint64_t) options.memtable_elements * fanout;
+    unsigned int result = 0;
+    while ( elements >= bound ) {
+        bound *= fanout;
+        result++;
+    }
+    return result;
+}
+
+template<typename Element, typename Compare, typename Hash>
+std::vector<typename LsmTree<Element, Compare, Hash>::RunPtr> LsmTree<Element, Compare, Hash>::dueRuns() const {
+    std::vector<unsigned int> tier_runs;
+    for (auto &run : runs) {
+        unsigned int run_tier = tier(run->elements.size());
+        if ( run_tier >= tier_runs.size() ) {
+            tier_runs.resize(run_tier + 1, 0);
+        }
+        tier_runs[run_tier]++;
+    }
+    std::vector<RunPtr> due;
+    for (unsigned int i = 0; i < tier_runs.size(); i++) {
+        if ( tier_runs[i] >= std::max(options.max_runs, 2u) ) {
+            for (auto &run : runs) {
+                if ( tier(run->elements.size()) == i ) {
+                    due.push_back(run);
+                }
+            }
+            break;
+        }
+    }
+    return due;
+}
+
+template<typename Element, typename Compare, typename Hash>
+size_t LsmTree<Element, Compare, Hash>::stallLimit() const {
+    size_t largest = 0;
+    for (auto &run : runs) {
+        largest = std::max(largest, run->elements.size());
+    }
+    return 2 * (size_t) std::max(options.max_runs, 1u) * (tier(largest) + 1);
+}
+
+template<typename Element, typename Compare, typename Hash>
+void LsmTree<Element, Compare, Hash>::compactionLoop() {
+    std::unique_lock<std::mutex> lock(runs_lock);
+    while ( true ) {
+        std::vector<RunPtr> merged_runs;
+        runs_changed.wait(lock, [&]() {
+            if ( stopping ) {
+                return true;
+            }
+            merged_runs = dueRuns();
+            return !merged_runs.empty();
+        });
+        if ( stopping ) {
+            return;
+        }
+        lock.unlock();
+
+        // Deltas add up in any order, so one tier is merged on its own.
+        // Only zero totals are dropped: negative ones cancel elements
+        // kept in runs outside the merge.
+        size_t estimate = 0;
+        std::vector<Cursor> cursors;
+        for (auto &run : merged_runs) {
+            estimate += run->elements.size();
+            cursors.push_back(Cursor{run->elements.data(), run->elements.data() + run->elements.size(),
+                                     run->deltas.data()});
+        }
+        std::shared_ptr<Run> merged = std::make_shared<Run>(estimate, options.bloom_bits_per_element, hash);
+        mergeCursors(cursors, [&](const Element &el, int count) {
+            merged->elements.push_back(el);
+            merged->deltas.push_back(count);
+            merged->filter.add(el);
+        });
+
+        lock.lock();
+        // runs flushed meanwhile are in front, merged run takes the place of
+        // the oldest one it replaces
+        std::vector<RunPtr> kept;
+        size_t position = 0;
+        for (auto &run : runs) {
+            if ( std::find(merged_runs.begin(), merged_runs.end(), run) != merged_runs.end() ) {
+                position = kept.size();
+            } else {
+                kept.push_back(run);
+            }
+        }
+        if ( !merged->elements.empty() ) {
+            kept.insert(kept.begin() + position, merged);
+        }
+        runs.swap(kept);
+        compacted_elements += merged->elements.size();
+        runs_changed.notify_all();
+    }
+}
+
+template<typename Element, typename Compare, typename Hash>
+template<typename Visitor>
+void LsmTree<Element, Compare, Hash>::mergeCursors(std::vector<Cursor> &cursors, Visitor visit) const {
+    // few cursors, so smallest head is found by linear scan
+    while ( true ) {
+        const Element *smallest = nullptr;
+        for (auto &cursor : cursors) {
+            if ( cursor.element != cursor.end && (smallest == nullptr || compare(*cursor.element, *smallest) < 0) ) {
+                smallest = cursor.element;
+            }
+        }
+        if ( smallest == nullptr ) {
+            return;
+        }
+        // arrays under cursors outlive the merge, so current stays valid after advancing
+        const Element &current = *smallest;
+        int total = 0;
+        for (auto &cursor : cursors) {
+            if ( cursor.element != cursor.end && compare(*cursor.element, current) == 0 ) {
+                total += *cursor.delta;
+            }
+        }
+        if ( total != 0 ) {
+            visit(current, total);
+        }
+        for (auto &cursor : cursors) {
+            if ( cursor.element != cursor.end && compare(*cursor.element, current) == 0 ) {
+                cursor.element++;
+                cursor.delta++;
+            }
+        }
+    }
+}
+
+template<typename Element, typename Compare, typename Hash>
+template<typename Visitor>
+void LsmTree<Element, Compare, Hash>::mergeRange(const Element *low, const Element *high, Visitor visit) const {
+    std::vector<Element> memtable_elements;
+    std::vector<int> memtable_deltas;
+    auto collect = [&](const Element &el, const int &delta) {
+        memtable_elements.push_back(el);
+        memtable_deltas.push_back(delta);
+    };
+    if ( low != nullptr ) {
+        memtable.inRangeTraverse(*low, *high, collect);
+    } else {
+        memtable.inOrderTraverse(collect);
+    }
+
+    std::vector<RunPtr> snapshot = currentRuns();
+    std::vector<Cursor> cursors;
+    cursors.push_back(Cursor{memtable_elements.data(), memtable_elements.data() + memtable_elements.size(),
+                             memtable_deltas.data()});
+    for (auto &run : snapshot) {
+        const Element *begin = run->elements.data();
+        const Element *end = begin + run->elements.size();
+        if ( low != nullptr ) {
+            begin = std::lower_bound(begin, end, *low, [&](const Element &a, const Element &b) {
+                return compare(a, b) < 0;
+            });
+            end = std::upper_bound(begin, end, *high, [&](const Element &a, const Element &b) {
+                return compare(a, b) < 0;
+            });
+        }
+        cursors.push_back(Cursor{begin, end, run->deltas.data() + (begin - run->elements.data())});
+    }
+    mergeCursors(cursors, visit);
+}
+
+template<typename Element, typename Compare, typename Hash>
+unsigned int LsmTree<Element, Compare, Hash>::countElements(const Element &el) const {
+    const int *memtable_delta = memtable.find(el);
+    int total = memtable_delta != nullptr ? *memtable_delta : 0;
+    for (auto &run : currentRuns()) {
+        if ( !run->filter.mayContain(el) ) {
+            continue;
+        }
+        auto position = std::lower_bound(run->elements.begin(), run->elements.end(), el,
+                                         [&](const Element &a, const Element &b) {
+                                             return compare(a, b) < 0;
+                                         });
+        if ( position != run->elements.end() && compare(*position, el) == 0 ) {
+            total += run->deltas[position - run->elements.begin()];
+        }
+    }
+    return total > 0 ? (unsigned int) total : 0;
+}
+
+template<typename Element, typename Compare, typename Hash>
+unsigned int LsmTree<Element, Compare, Hash>::countElements(const Element &low, const Element &high) const {
+    unsigned int found = 0;
+    if ( compare(low, high) <= 0 ) {
+        mergeRange(&low, &high, [&](const Element &, int count) {
+            found += count;
+        });
+    }
+    return found;
+}
+
+template<typename Element, typename Compare, typename Hash>
+void LsmTree<Element, Compare, Hash>::inOrderTraverse(ElementsTraverseFunc func) const {
+    mergeRange(nullptr, nullptr, [&](const Element &el, int count) {
+        for (int i = 0; i < count; i++) {
+            func(el);
+        }
+    });
+}
+
+template<typename Element, typename Compare, typename Hash>
+void LsmTree<Element, Compare, Hash>::inRangeTraverse(const Element &low, const Element &high,
+                                                      ElementsTraverseFunc func) const {
+    if ( compare(low, high) > 0 ) {
+        return;
+    }
+    mergeRange(&low, &high, [&](const Element &el, int count) {
+        for (int i = 0; i < count; i++) {
+            func(el);
+        }
+    });
+}
+
+#endif //BINARY_TREE_LSMTREE_H
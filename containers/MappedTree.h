@@ -0,0 +1,326 @@
+#ifndef BINARY_TREE_MAPPEDTREE_H
+#define BINARY_TREE_MAPPEDTREE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Tree.h"
+
+// Read only tree opened straight from a memory mapped file.
+//
+// File keeps elements in order as a plain array after a fixed header, so it
+// holds no pointers and is valid at any mapping address. Tree shape is
+// implicit: root of every range is its middle element, which makes the
+// mapped tree perfectly balanced. Opening only maps the file, all queries
+// run over the mapping and the page cache is shared by every process that
+// maps the same file.
+//
+// Elements are stored in native representation, so Element must be trivially
+// copyable and files are only portable between hosts with same byte order
+// and element layout. Errors are reported by throwing std::string.
+//
+// File layout:
+//
+//   magic           4 bytes  "BTRM"
+//   version         uint16   MappedTreeFormat::VERSION
+//   element size    uint16   sizeof(Element)
+//   byte order      uint32   MappedTreeFormat::BYTE_ORDER_MARK as written by host
+//   count           uint64   number of elements
+//   padding         up to MappedTreeFormat::ELEMENTS_OFFSET
+//   elements        count * sizeof(Element), in order
+
+namespace MappedTreeFormat {
+    static const char MAGIC[4] = {'B', 'T', 'R', 'M'};
+    static const uint16_t VERSION = 1;
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static const size_t ELEMENTS_OFFSET = 64;
+
+    struct Header {
+        char magic[4];
+        uint16_t version;
+        uint16_t element_size;
+        uint32_t byte_order;
+        uint32_t reserved;
+        uint64_t count;
+    };
+}
+
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
+class MappedTree {
+    static_assert(std::is_trivially_copyable<Element>::value, "mapped elements must be trivially copyable");
+    static_assert(MappedTreeFormat::ELEMENTS_OFFSET % alignof(Element) == 0, "elements must stay aligned");
+
+public:
+    typedef std::function<void(const Element &)> ElementsTraverseFunc;
+    typedef std::function<bool(const Element &)> ElementPredicate;
+
+    // O(1): maps the file and validates its header.
+    explicit MappedTree(const std::string &path, Compare compare = Compare());
+    ~MappedTree();
+
+    MappedTree(MappedTree &&other);
+    MappedTree(const MappedTree &) = delete;
+    MappedTree &operator=(const MappedTree &) = delete;
+
+    // Writes elements of tree in mapped format and atomically replaces the
+    // file, mappings of the old file stay valid.
+    template<typename TreeCompare>
+    static void build(const Tree<Element, TreeCompare> &tree, const std::string &path);
+
+    bool isMember(const Element &el) const {
+        return countElements(el) != 0;
+    }
+    unsigned int countElements(const Element &el) const {
+        return (unsigned int) (upperBound(el) - lowerBound(el));
+    }
+    // number of elements in closed interval [low, high]
+    unsigned int countElements(const Element &low, const Element &high) const;
+    unsigned int size() const {
+        return (unsigned int) count;
+    }
+
+    // Traversals of implicit tree shape. Stop predicate works as in Tree:
+    // the element it holds for is still visited, then no more subtrees are
+    // entered, and only their roots and elements waiting for a post order
+    // visit are visited. In order traversals stop before that element.
+    void preLeftTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        shapeTraverse(func, stop, true, true);
+    }
+    void postLeftTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        shapeTraverse(func, stop, false, true);
+    }
+    void preRightTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        shapeTraverse(func, stop, true, false);
+    }
+    void postRightTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        shapeTraverse(func, stop, false, false);
+    }
+    void inOrderTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        for (const Element *iter = elements; iter != elements + count && !stop(*iter); iter++) {
+            func(*iter);
+        }
+    }
+    void inOppositeOrderTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        for (const Element *iter = elements + count; iter != elements && !stop(*(iter - 1)); iter--) {
+            func(*(iter - 1));
+        }
+    }
+    // in order traversal of elements from closed interval [low, high]
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const;
+
+private:
+
+    // first element not less than el
+    const Element *lowerBound(const Element &el) const;
+    // first element greater than el
+    const Element *upperBound(const Element &el) const;
+    void shapeTraverse(ElementsTraverseFunc, ElementPredicate, bool node_first, bool left_first) const;
+
+    void *mapping;
+    size_t mapping_size;
+    const Element *elements;
+    uint64_t count;
+    Compare compare;
+};
+
+template<typename Element, typename Compare>
+MappedTree<Element, Compare>::MappedTree(const std::string &path, Compare compare)
+        : mapping(nullptr), mapping_size(0), elements(nullptr), count(0), compare(compare) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if ( fd < 0 ) {
+        throw std::string("Failed to open mapped tree file.");
+    }
+    struct stat file_stat;
+    if ( fstat(fd, &file_stat) != 0 || (size_t) file_stat.st_size < MappedTreeFormat::ELEMENTS_OFFSET ) {
+        close(fd);
+        throw std::string("Mapped tree file is truncated.");
+    }
+    mapping_size = (size_t) file_stat.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( mapping == MAP_FAILED ) {
+        throw std::string("Failed to map tree file.");
+    }
+
+    MappedTreeFormat::Header header;
+    std::memcpy(&header, mapping, sizeof(header));
+    std::string error;
+    if ( std::memcmp(header.magic, MappedTreeFormat::MAGIC, sizeof(header.magic)) != 0 ) {
+        error = "Not a mapped tree file.";
+    } else if ( header.version != MappedTreeFormat::VERSION ) {
+        error = "Unsupported mapped tree version.";
+    } else if ( header.byte_order != MappedTreeFormat::BYTE_ORDER_MARK || header.element_size != sizeof(Element) ) {
+        error = "Mapped tree was built for different element layout.";
+    } else if ( header.count > (mapping_size - MappedTreeFormat::ELEMENTS_OFFSET) / sizeof(Element) ) {
+        error = "Mapped tree file is truncated.";
+    }
+    if ( !error.empty() ) {
+        munmap(mapping, mapping_size);
+        throw error;
+    }
+    count = header.count;
+    elements = reinterpret_cast<const Element *>(static_cast<const char *>(mapping) + MappedTreeFormat::ELEMENTS_OFFSET);
+}
+
+template<typename Element, typename Compare>
+MappedTree<Element, Compare>::MappedTree(MappedTree &&other)
+        : mapping(other.mapping), mapping_size(other.mapping_size), elements(other.elements),
+          count(other.count), compare(other.compare) {
+    other.mapping = nullptr;
+    other.elements = nullptr;
+    other.count = 0;
+}
+
+template<typename Element, typename Compare>
+MappedTree<Element, Compare>::~MappedTree() {
+    if ( mapping != nullptr ) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+template<typename Element, typename Compare>
+template<typename TreeCompare>
+void MappedTree<Element, Compare>::build(const Tree<Element, TreeCompare> &tree, const std::string &path) {
+    // Processes may map the old file while it is replaced, so new file is
+    // written next to it and renamed over it: truncating the mapped file in
+    // place would make their reads fault with SIGBUS.
+    std::string temporary_path = path + ".tmp." + std::to_string(getpid());
+    std::ofstream out(temporary_path.c_str(), std::ios::binary | std::ios::trunc);
+    if ( !out ) {
+        throw std::string("Failed to create mapped tree file.");
+    }
+    MappedTreeFormat::Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MappedTreeFormat::MAGIC, sizeof(header.magic));
+    header.version = MappedTreeFormat::VERSION;
+    header.element_size = sizeof(Element);
+    header.byte_order = MappedTreeFormat::BYTE_ORDER_MARK;
+    header.count = tree.size();
+
+    std::vector<char> head(MappedTreeFormat::ELEMENTS_OFFSET, 0);
+    std::memcpy(head.data(), &header, sizeof(header));
+    out.write(head.data(), head.size());
+    tree.inOrderTraverse([&](const Element &el) {
+        out.write(reinterpret_cast<const char *>(&el), sizeof(Element));
+    });
+    out.close();
+    int fd = out ? open(temporary_path.c_str(), O_RDONLY) : -1;
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if ( fd >= 0 ) {
+        close(fd);
+    }
+    if ( !synced || rename(temporary_path.c_str(), path.c_str()) != 0 ) {
+        unlink(temporary_path.c_str());
+        throw std::string("Failed to write mapped tree file.");
+    }
+}
+
+template<typename Element, typename Compare>
+const Element *MappedTree<Element, Compare>::lowerBound(const Element &el) const {
+    const Element *first = elements;
+    uint64_t length = count;
+    while ( length > 0 ) {
+        uint64_t half = length / 2;
+        if ( compare(first[half], el) < 0 ) {
+            first += half + 1;
+            length -= half + 1;
+        } else {
+            length = half;
+        }
+    }
+    return first;
+}
+
+template<typename Element, typename Compare>
+const Element *MappedTree<Element, Compare>::upperBound(const Element &el) const {
+    const Element *first = elements;
+    uint64_t length = count;
+    while ( length > 0 ) {
+        uint64_t half = length / 2;
+        if ( compare(first[half], el) <= 0 ) {
+            first += half + 1;
+            length -= half + 1;
+        } else {
+            length = half;
+        }
+    }
+    return first;
+}
+
+template<typename Element, typename Compare>
+unsigned int MappedTree<Element, Compare>::countElements(const Element &low, const Element &high) const {
+    if ( compare(low, high) > 0 ) {
+        return 0;
+    }
+    return (unsigned int) (upperBound(high) - lowerBound(low));
+}
+
+template<typename Element, typename Compare>
+void MappedTree<Element, Compare>::inRangeTraverse(const Element &low, const Element &high,
+                                                   ElementsTraverseFunc func) const {
+    if ( compare(low, high) > 0 ) {
+        return;
+    }
+    for (const Element *iter = lowerBound(low), *end = upperBound(high); iter < end; iter++) {
+        func(*iter);
+    }
+}
+
+template<typename Element, typename Compare>
+void MappedTree<Element, Compare>::shapeTraverse(ElementsTraverseFunc func, ElementPredicate stop,
+                                                 bool node_first, bool left_first) const {
+    // Subtree is a half open range of elements, its root is the middle one.
+    // Expanded ranges wait on the stack only for their root to be visited.
+    struct Range {
+        uint64_t begin;
+        uint64_t end;
+        bool expanded;
+    };
+    std::vector<Range> ranges;
+    if ( count != 0 ) {
+        ranges.push_back(Range{0, count, false});
+    }
+    bool stopped = false;
+    while ( !ranges.empty() ) {
+        Range range = ranges.back();
+        ranges.pop_back();
+        uint64_t middle = range.begin + (range.end - range.begin) / 2;
+        if ( node_first ) {
+            func(elements[middle]);
+            if ( stopped || (stopped = stop(elements[middle])) ) {
+                continue;
+            }
+        } else if ( range.expanded || stopped ) {
+            // children done, or skipped once stopped
+            stopped = stopped || stop(elements[middle]);
+            func(elements[middle]);
+            continue;
+        } else {
+            ranges.push_back(Range{range.begin, range.end, true});
+        }
+        Range left{range.begin, middle, false};
+        Range right{middle + 1, range.end, false};
+        // pushed in reverse order of visiting
+        const Range &second = left_first ? right : left;
+        const Range &first = left_first ? left : right;
+        if ( second.begin != second.end ) {
+            ranges.push_back(second);
+        }
+        if ( first.begin != first.end ) {
+            ranges.push_back(first);
+        }
+    }
+}
+
+#endif //BINARY_TREE_MAPPEDTREE_H
@@ -0,0 +1,242 @@
+#ifndef BINARY_TREE_OPTIMISTICCONCURRENTTREE_H
+#define BINARY_TREE_OPTIMISTICCONCURRENTTREE_H
+
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "ThreeWayCompare.h"
+#include "EpochReclaimer.h"
+
+// Concurrent multiset for simultaneous insert, remove and isMember
+// from many threads.
+//
+// External (leaf oriented) binary search tree: elements live in leaves,
+// internal nodes only route searches. Searches never lock. Insert locks
+// only the parent of the affected leaf, remove locks grandparent and parent;
+// both validate that nodes found by optimistic search are still linked
+// and retry otherwise. Equal elements share one leaf with a counter.
+// Unlinked nodes are reclaimed through EpochReclaimer.
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
+class OptimisticConcurrentTree {
+public:
+    typedef std::function<void(const Element &)> ElementsTraverseFunc;
+
+    OptimisticConcurrentTree(Compare compare = Compare());
+    ~OptimisticConcurrentTree();
+
+    OptimisticConcurrentTree(const OptimisticConcurrentTree &) = delete;
+    OptimisticConcurrentTree &operator=(const OptimisticConcurrentTree &) = delete;
+
+    void insert(const Element &el);
+    bool isMember(const Element &el) const {
+        return countElements(el) != 0;
+    }
+    unsigned int countElements(const Element &el) const;
+    unsigned int remove(const Element &el, unsigned int count = 1);
+    unsigned int removeAll(const Element &el) {
+        return remove(el, UINT_MAX);
+    }
+    unsigned int size() const {
+        return number_of_elements.load(std::memory_order_relaxed);
+    }
+    // Weakly consistent: every element present during the whole traversal is visited.
+    void inOrderTraverse(ElementsTraverseFunc) const;
+
+private:
+
+    // Sentinels are greater than any element: Finite < FirstInfinity < SecondInfinity.
+    enum Rank { Finite, FirstInfinity, SecondInfinity };
+
+    struct Node {
+        Node(Rank rank, bool leaf) : rank(rank), leaf(leaf), count(0), removed(false),
+                                     left(nullptr), right(nullptr) { }
+        Node(const Element &key, Rank rank, bool leaf, unsigned int count)
+                : key(key), rank(rank), leaf(leaf), count(count), removed(false),
+                  left(nullptr), right(nullptr) { }
+
+        std::atomic<Node*>& child(bool to_left) {
+            return to_left ? left : right;
+        }
+
+        Element key;
+        const Rank rank;
+        const bool leaf;
+        std::atomic<unsigned int> count;
+        std::atomic<bool> removed;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::mutex lock;
+    };
+
+    struct SearchResult {
+        Node *grandparent;
+        Node *parent;
+        Node *leaf;
+        bool parent_to_left;
+        bool leaf_to_left;
+    };
+
+    bool goesLeft(const Element &el, const Node *node) const {
+        return node->rank != Finite || compare(el, node->key) < 0;
+    }
+
+    bool matches(const Element &el, const Node *leaf) const {
+        return leaf->rank == Finite && compare(el, leaf->key) == 0;
+    }
+
+    SearchResult search(const Element &el) const;
+    void retire(Node *node);
+
+    Node *root;
+    std::atomic<unsigned int> number_of_elements;
+    Compare compare;
+    mutable EpochReclaimer reclaimer;
+};
+
+template<typename Element, typename Compare>
+OptimisticConcurrentTree<Element, Compare>::OptimisticConcurrentTree(Compare compare)
+        : root(new Node(SecondInfinity, false)), number_of_elements(0), compare(compare) {
+    root->left.store(new Node(FirstInfinity, true));
+    root->right.store(new Node(SecondInfinity, true));
+}
+
+template<typename Element, typename Compare>
+OptimisticConcurrentTree<Element, Compare>::~OptimisticConcurrentTree() {
+    std::vector<Node*> nodes(1, root);
+    while ( !nodes.empty() ) {
+        Node *node = nodes.back();
+        nodes.pop_back();
+        if ( !node->leaf ) {
+            nodes.push_back(node->left.load());
+            nodes.push_back(node->right.load());
+        }
+        delete node;
+    }
+}
+
+// Real leaves are always at depth two or deeper, below sentinel internal nodes,
+// so grandparent of a matching leaf is never null.
+template<typename Element, typename Compare>
+typename OptimisticConcurrentTree<Element, Compare>::SearchResult
+OptimisticConcurrentTree<Element, Compare>::search(const Element &el) const {
+    SearchResult result{nullptr, root, nullptr, true, true};
+    result.leaf = root->left.load();
+    while ( !result.leaf->leaf ) {
+        result.grandparent = result.parent;
+        result.parent_to_left = result.leaf_to_left;
+        result.parent = result.leaf;
+        result.leaf_to_left = goesLeft(el, result.leaf);
+        result.leaf = result.leaf->child(result.leaf_to_left).load();
+    }
+    return result;
+}
+
+template<typename Element, typename Compare>
+void OptimisticConcurrentTree<Element, Compare>::insert(const Element &el) {
+    auto guard = reclaimer.pin();
+    while ( true ) {
+        SearchResult found = search(el);
+        Node *parent = found.parent;
+        std::lock_guard<std::mutex> lock(parent->lock);
+        if ( parent->removed.load() || parent->child(found.leaf_to_left).load() != found.leaf ) {
+            continue;
+        }
+        Node *leaf = found.leaf;
+        if ( matches(el, leaf) ) {
+            leaf->count.fetch_add(1);
+        } else {
+            Node *new_leaf = new Node(el, Finite, true, 1);
+            bool new_goes_left = goesLeft(el, leaf);
+            Node *router = new_goes_left ? new Node(leaf->key, leaf->rank, false, 0)
+                                         : new Node(el, Finite, false, 0);
+            router->left.store(new_goes_left ? new_leaf : leaf);
+            router->right.store(new_goes_left ? leaf : new_leaf);
+            parent->child(found.leaf_to_left).store(router);
+        }
+        number_of_elements.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+}
+
+template<typename Element, typename Compare>
+unsigned int OptimisticConcurrentTree<Element, Compare>::countElements(const Element &el) const {
+    auto guard = reclaimer.pin();
+    Node *leaf = search(el).leaf;
+    return matches(el, leaf) ? leaf->count.load() : 0;
+}
+
+template<typename Element, typename Compare>
+unsigned int OptimisticConcurrentTree<Element, Compare>::remove(const Element &el, unsigned int count) {
+    if ( count == 0 ) {
+        return 0;
+    }
+    auto guard = reclaimer.pin();
+    while ( true ) {
+        SearchResult found = search(el);
+        if ( !matches(el, found.leaf) ) {
+            return 0;
+        }
+        Node *grandparent = found.grandparent;
+        Node *parent = found.parent;
+        Node *leaf = found.leaf;
+        std::lock_guard<std::mutex> grandparent_lock(grandparent->lock);
+        std::lock_guard<std::mutex> parent_lock(parent->lock);
+        if ( grandparent->removed.load() || grandparent->child(found.parent_to_left).load() != parent ||
+             parent->removed.load() || parent->child(found.leaf_to_left).load() != leaf ) {
+            continue;
+        }
+
+        unsigned int present = leaf->count.load();
+        if ( present > count ) {
+            leaf->count.fetch_sub(count);
+            number_of_elements.fetch_sub(count, std::memory_order_relaxed);
+            return count;
+        }
+
+        leaf->count.store(0);
+        parent->removed.store(true);
+        leaf->removed.store(true);
+        grandparent->child(found.parent_to_left).store(parent->child(!found.leaf_to_left).load());
+        number_of_elements.fetch_sub(present, std::memory_order_relaxed);
+        retire(parent);
+        retire(leaf);
+        reclaimer.reclaim();
+        return present;
+    }
+}
+
+template<typename Element, typename Compare>
+void OptimisticConcurrentTree<Element, Compare>::retire(Node *node) {
+    reclaimer.retire([node]() {
+        delete node;
+    });
+}
+
+template<typename Element, typename Compare>
+void OptimisticConcurrentTree<Element, Compare>::inOrderTraverse(ElementsTraverseFunc func) const {
+    auto guard = reclaimer.pin();
+    std::vector<Node*> path;
+    Node *iter = root;
+    while ( iter != nullptr || !path.empty() ) {
+        while ( iter != nullptr && !iter->leaf ) {
+            path.push_back(iter);
+            iter = iter->left.load();
+        }
+        if ( iter != nullptr ) {
+            if ( iter->rank == Finite ) {
+                for (unsigned int i = iter->count.load(); i > 0; i--) {
+                    func(iter->key);
+                }
+            }
+            iter = nullptr;
+        } else {
+            iter = path.back()->right.load();
+            path.pop_back();
+        }
+    }
+}
+
+#endif //BINARY_TREE_OPTIMISTICCONCURRENTTREE_H
@@ -0,0 +1,522 @@
+#ifndef BINARY_TREE_PAGEDTREE_H
+#define BINARY_TREE_PAGEDTREE_H
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ThreeWayCompare.h"
+#include "BufferPool.h"
+
+struct PagedTreeOptions {
+    // used only when file is created, existing files keep their page size
+    size_t page_size = 4096;
+    // buffer pool size in pages
+    size_t cache_pages = 256;
+};
+
+// Ordered multiset kept in a file as B+tree, for data larger than memory.
+//
+// Pages have fixed size. Leaves hold distinct elements in order, each with
+// number of its copies, and are chained left to right, so range scans read
+// leaves sequentially. Internal pages hold separators: child i holds
+// elements in [key i - 1, key i). Pages are accessed only through an LRU
+// buffer pool of configurable size; stats() reports its hits and page
+// faults. Remove never merges pages, emptied leaves stay in the chain.
+//
+// Elements are stored in native representation, so Element must be
+// trivially copyable. Changes reach the file on eviction, flush() and
+// destruction. Errors are reported by throwing std::string.
+//
+// Page 0 holds PagedTreeFormat::Meta, 0 is also "no page" in leaf links.
+namespace PagedTreeFormat {
+    static const char MAGIC[4] = {'B', 'T', 'R', 'P'};
+    static const uint16_t VERSION = 1;
+
+    struct Meta {
+        char magic[4];
+        uint16_t version;
+        uint16_t element_size;
+        uint32_t page_size;
+        uint32_t page_count;
+        uint32_t root;
+        uint32_t first_leaf;
+        uint32_t height;
+        uint32_t reserved;
+        uint64_t count;
+    };
+
+    struct PageHeader {
+        uint16_t leaf;
+        uint16_t count;
+        uint32_t next_leaf;
+        uint64_t reserved;
+    };
+}
+
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
+class PagedTree {
+    static_assert(std::is_trivially_copyable<Element>::value, "paged elements must be trivially copyable");
+    static_assert(alignof(Element) <= sizeof(PagedTreeFormat::PageHeader), "element alignment is too big");
+
+public:
+    typedef std::function<void(const Element &)> ElementsTraverseFunc;
+
+    // Opens tree file, creating an empty tree when it does not exist.
+    explicit PagedTree(const std::string &path, PagedTreeOptions options = PagedTreeOptions(),
+                       Compare compare = Compare());
+    ~PagedTree();
+
+    PagedTree(const PagedTree &) = delete;
+    PagedTree &operator=(const PagedTree &) = delete;
+
+    void insert(const Element &el);
+    bool isMember(const Element &el) const {
+        return countElements(el) != 0;
+    }
+    unsigned int countElements(const Element &el) const;
+    // number of elements in closed interval [low, high], scans the range
+    unsigned int countElements(const Element &low, const Element &high) const;
+    unsigned int remove(const Element &el, unsigned int count = 1);
+    unsigned int removeAll(const Element &el) {
+        return remove(el, UINT_MAX);
+    }
+    unsigned int size() const {
+        return (unsigned int) meta.count;
+    }
+
+    void inOrderTraverse(ElementsTraverseFunc func) const;
+    // in order traversal of elements from closed interval [low, high]
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const;
+
+    // Writes changed pages and tree header and syncs the file.
+    void flush();
+
+    const BufferPoolStats &stats() const {
+        return pool->stats();
+    }
+    void resetStats() {
+        pool->resetStats();
+    }
+
+private:
+    typedef BufferPool::PageHandle PageHandle;
+    typedef PagedTreeFormat::PageHeader PageHeader;
+
+    struct LeafEntry {
+        Element key;
+        uint32_t count;
+    };
+
+    static PageHeader *header(char *page) {
+        return reinterpret_cast<PageHeader *>(page);
+    }
+    static const PageHeader *header(const char *page) {
+        return reinterpret_cast<const PageHeader *>(page);
+    }
+    static LeafEntry *entries(char *page) {
+        return reinterpret_cast<LeafEntry *>(page + sizeof(PageHeader));
+    }
+    static const LeafEntry *entries(const char *page) {
+        return reinterpret_cast<const LeafEntry *>(page + sizeof(PageHeader));
+    }
+    static uint32_t *children(char *page) {
+        return reinterpret_cast<uint32_t *>(page + sizeof(PageHeader));
+    }
+    static const uint32_t *children(const char *page) {
+        return reinterpret_cast<const uint32_t *>(page + sizeof(PageHeader));
+    }
+    Element *keys(char *page) const {
+        return reinterpret_cast<Element *>(page + keys_offset);
+    }
+    const Element *keys(const char *page) const {
+        return reinterpret_cast<const Element *>(page + keys_offset);
+    }
+
+    // index of first entry not less than el
+    size_t leafPosition(const char *page, const Element &el) const;
+    // index of child that may hold el
+    size_t childPosition(const char *page, const Element &el) const;
+    PageHandle findLeaf(const Element &el) const;
+    PageHandle newPage(bool leaf);
+
+    // Inserts into subtree; on split returns true with separator and new right sibling.
+    bool insertInto(uint32_t page_id, uint32_t height, const Element &el, Element &separator, uint32_t &sibling);
+    bool insertIntoLeaf(PageHandle &page, const Element &el, Element &separator, uint32_t &sibling);
+    void insertIntoInternal(PageHandle &page, size_t position, const Element &key, uint32_t child,
+                            Element &separator, uint32_t &sibling);
+
+    // Visits leaf entries from first one not less than low while visitor returns true.
+    template<typename Visitor>
+    void scanFrom(const Element *low, Visitor visitor) const;
+
+    void writeMeta();
+
+    int fd;
+    PagedTreeFormat::Meta meta;
+    std::unique_ptr<BufferPool> pool;
+    size_t leaf_capacity;
+    size_t internal_capacity;
+    size_t keys_offset;
+    Compare compare;
+};
+
+template<typename Element, typename Compare>
+PagedTree<Element, Compare>::PagedTree(const std::string &path, PagedTreeOptions options, Compare compare)
+        : compare(compare) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if ( fd < 0 ) {
+        throw std::string("Failed to open paged tree file.");
+    }
+    struct stat file_stat;
+    bool created = fstat(fd, &file_stat) == 0 && file_stat.st_size == 0;
+    std::string error;
+    if ( created ) {
+        std::memset(&meta, 0, sizeof(meta));
+        std::memcpy(meta.magic, PagedTreeFormat::MAGIC, sizeof(meta.magic));
+        meta.version = PagedTreeFormat::VERSION;
+        meta.element_size = sizeof(Element);
+        meta.page_size = (uint32_t) options.page_size;
+        meta.page_count = 1;
+        meta.height = 1;
+    } else if ( pread(fd, &meta, sizeof(meta), 0) != (ssize_t) sizeof(meta) ||
+                std::memcmp(meta.magic, PagedTreeFormat::MAGIC, sizeof(meta.magic)) != 0 ) {
+        error = "Not a paged tree file.";
+    } else if ( meta.version != PagedTreeFormat::VERSION ) {
+        error = "Unsupported paged tree version.";
+    } else if ( meta.element_size != sizeof(Element) ) {
+        error = "Paged tree was built for different element layout.";
+    }
+
+    // internal page: header, children[capacity + 1], aligned keys[capacity]
+    leaf_capacity = (meta.page_size - sizeof(PageHeader)) / sizeof(LeafEntry);
+    internal_capacity = (meta.page_size - sizeof(PageHeader) - sizeof(uint32_t) - alignof(Element)) /
+                        (sizeof(uint32_t) + sizeof(Element));
+    keys_offset = sizeof(PageHeader) + sizeof(uint32_t) * (internal_capacity + 1);
+    keys_offset = (keys_offset + alignof(Element) - 1) / alignof(Element) * alignof(Element);
+    if ( error.empty() && (meta.page_size < sizeof(meta) || leaf_capacity < 2 || internal_capacity < 3 ||
+                           leaf_capacity > UINT16_MAX || internal_capacity > UINT16_MAX) ) {
+        error = "Page size does not fit paged tree elements.";
+    }
+    if ( error.empty() && options.cache_pages < 16 ) {
+        error = "Paged tree needs at least 16 cached pages.";
+    }
+    if ( !error.empty() ) {
+        close(fd);
+        throw error;
+    }
+
+    pool.reset(new BufferPool(fd, meta.page_size, options.cache_pages));
+    if ( created ) {
+        PageHandle root = newPage(true);
+        meta.root = meta.first_leaf = root.id();
+        root = PageHandle();
+        flush();
+    }
+}
+
+template<typename Element, typename Compare>
+PagedTree<Element, Compare>::~PagedTree() {
+    try {
+        flush();
+    } catch (const std::string &) {
+        // nothing to report to from destructor
+    }
+    pool.reset();
+    close(fd);
+}
+
+template<typename Element, typename Compare>
+void PagedTree<Element, Compare>::flush() {
+    pool->flush();
+    writeMeta();
+    if ( fdatasync(fd) != 0 ) {
+        throw std::string("Failed to sync paged tree file.");
+    }
+}
+
+template<typename Element, typename Compare>
+void PagedTree<Element, Compare>::writeMeta() {
+    std::vector<char> page(meta.page_size, 0);
+    std::memcpy(page.data(), &meta, sizeof(meta));
+    if ( pwrite(fd, page.data(), page.size(), 0) != (ssize_t) page.size() ) {
+        throw std::string("Failed to write paged tree header.");
+    }
+}
+
+template<typename Element, typename Compare>
+typename PagedTree<Element, Compare>::PageHandle PagedTree<Element, Compare>::newPage(bool leaf) {
+    PageHandle page = pool->create(meta.page_count++);
+    header(page.mutableData())->leaf = leaf;
+    return page;
+}
+
+template<typename Element, typename Compare>
+size_t PagedTree<Element, Compare>::leafPosition(const char *page, const Element &el) const {
+    const LeafEntry *items = entries(page);
+    size_t first = 0, length = header(page)->count;
+    while ( length > 0 ) {
+        size_t half = length / 2;
+        if ( compare(items[first + half].key, el) < 0 ) {
+            first += half + 1;
+            length -= half + 1;
+        } else {
+            length = half;
+        }
+    }
+    return first;
+}
+
+template<typename Element, typename Compare>
+size_t PagedTree<Element, Compare>::childPosition(const char *page, const Element &el) const {
+    const Element *separators = keys(page);
+    size_t first = 0, length = header(page)->count;
+    while ( length > 0 ) {
+        size_t half = length / 2;
+        if ( compare(separators[first + half], el) <= 0 ) {
+            first += half + 1;
+            length -= half + 1;
+        } else {
+            length = half;
+        }
+    }
+    return first;
+}
+
+template<typename Element, typename Compare>
+typename PagedTree<Element, Compare>::PageHandle PagedTree<Element, Compare>::findLeaf(const Element &el) const {
+    PageHandle page = pool->fetch(meta.root);
+    for (uint32_t level = meta.height; level > 1; level--) {
+        uint32_t child = children(page.data())[childPosition(page.data(), el)];
+        page = pool->fetch(child);
+    }
+    return page;
+}
+
+template<typename Element, typename Compare>
+unsigned int PagedTree<Element, Compare>::countElements(const Element &el) const {
+    PageHandle leaf = findLeaf(el);
+    size_t position = leafPosition(leaf.data(), el);
+    if ( position < header(leaf.data())->count && compare(entries(leaf.data())[position].key, el) == 0 ) {
+        return entries(leaf.data())[position].count;
+    }
+    return 0;
+}
+
+template<typename Element, typename Compare>
+void PagedTree<Element, Compare>::insert(const Element &el) {
+    Element separator;
+    uint32_t sibling;
+    if ( insertInto(meta.root, meta.height, el, separator, sibling) ) {
+        PageHandle root = newPage(false);
+        char *data = root.mutableData();
+        header(data)->count = 1;
+        children(data)[0] = meta.root;
+        children(data)[1] = sibling;
+        keys(data)[0] = separator;
+        meta.root = root.id();
+        meta.height++;
+    }
+    meta.count++;
+}
+
+template<typename Element, typename Compare>
+bool PagedTree<Element, Compare>::insertInto(uint32_t page_id, uint32_t height, const Element &el,
+                                             Element &separator, uint32_t &sibling) {
+    PageHandle page = pool->fetch(page_id);
+    if ( height == 1 ) {
+        return insertIntoLeaf(page, el, separator, sibling);
+    }
+    size_t position = childPosition(page.data(), el);
+    Element child_separator;
+    uint32_t child_sibling;
+    if ( !insertInto(children(page.data())[position], height - 1, el, child_separator, child_sibling) ) {
+        return false;
+    }
+    insertIntoInternal(page, position, child_separator, child_sibling, separator, sibling);
+    return sibling != 0;
+}
+
+template<typename Element, typename Compare>
+bool PagedTree<Element, Compare>::insertIntoLeaf(PageHandle &page, const Element &el,
+                                                 Element &separator, uint32_t &sibling) {
+    char *data = page.mutableData();
+    size_t position = leafPosition(data, el);
+    size_t count = header(data)->count;
+    if ( position < count && compare(entries(data)[position].key, el) == 0 ) {
+        entries(data)[position].count++;
+        return false;
+    }
+
+    char *target = data;
+    PageHandle right;
+    bool split = count == leaf_capacity;
+    if ( split ) {
+        // move upper half to new right sibling, then insert into the half el belongs to
+        right = newPage(true);
+        char *right_data = right.mutableData();
+        size_t left_count = count - count / 2;
+        std::memcpy(entries(right_data), entries(data) + left_count, (count - left_count) * sizeof(LeafEntry));
+        header(right_data)->count = (uint16_t) (count - left_count);
+        header(right_data)->next_leaf = header(data)->next_leaf;
+        header(data)->next_leaf = right.id();
+        header(data)->count = (uint16_t) left_count;
+        if ( position > left_count ) {
+            target = right_data;
+            position -= left_count;
+        }
+        count = header(target)->count;
+    }
+    LeafEntry *items = entries(target);
+    std::memmove(items + position + 1, items + position, (count - position) * sizeof(LeafEntry));
+    std::memcpy(&items[position].key, &el, sizeof(Element));
+    items[position].count = 1;
+    header(target)->count++;
+
+    if ( !split ) {
+        return false;
+    }
+    std::memcpy(&separator, &entries(right.data())[0].key, sizeof(Element));
+    sibling = right.id();
+    return true;
+}
+
+// Inserts key and its right child at position; on overflow splits the page
+// and sets separator and sibling, otherwise sets sibling to 0.
+template<typename Element, typename Compare>
+void PagedTree<Element, Compare>::insertIntoInternal(PageHandle &page, size_t position, const Element &key,
+                                                     uint32_t child, Element &separator, uint32_t &sibling) {
+    char *data = page.mutableData();
+    size_t count = header(data)->count;
+    sibling = 0;
+    if ( count < internal_capacity ) {
+        Element *separators = keys(data);
+        uint32_t *links = children(data);
+        std::memmove(separators + position + 1, separators + position, (count - position) * sizeof(Element));
+        std::memmove(links + position + 2, links + position + 1, (count - position) * sizeof(uint32_t));
+        std::memcpy(separators + position, &key, sizeof(Element));
+        links[position + 1] = child;
+        header(data)->count++;
+        return;
+    }
+
+    // all count + 1 keys and count + 2 children, middle key moves up
+    std::vector<unsigned char> all_keys((count + 1) * sizeof(Element));
+    std::vector<uint32_t> all_children(count + 2);
+    Element *merged = reinterpret_cast<Element *>(all_keys.data());
+    std::memcpy(merged, keys(data), position * sizeof(Element));
+    std::memcpy(merged + position, &key, sizeof(Element));
+    std::memcpy(merged + position + 1, keys(data) + position, (count - position) * sizeof(Element));
+    std::memcpy(all_children.data(), children(data), (position + 1) * sizeof(uint32_t));
+    all_children[position + 1] = child;
+    std::memcpy(all_children.data() + position + 2, children(data) + position + 1,
+                (count - position) * sizeof(uint32_t));
+
+    size_t total = count + 1;
+    size_t middle = total / 2;
+    PageHandle right = newPage(false);
+    char *right_data = right.mutableData();
+    std::memcpy(keys(data), merged, middle * sizeof(Element));
+    std::memcpy(children(data), all_children.data(), (middle + 1) * sizeof(uint32_t));
+    header(data)->count = (uint16_t) middle;
+    std::memcpy(keys(right_data), merged + middle + 1, (total - middle - 1) * sizeof(Element));
+    std::memcpy(children(right_data), all_children.data() + middle + 1, (total - middle) * sizeof(uint32_t));
+    header(right_data)->count = (uint16_t) (total - middle - 1);
+
+    std::memcpy(&separator, merged + middle, sizeof(Element));
+    sibling = right.id();
+}
+
+template<typename Element, typename Compare>
+unsigned int PagedTree<Element, Compare>::remove(const Element &el, unsigned int count) {
+    PageHandle leaf = findLeaf(el);
+    size_t position = leafPosition(leaf.data(), el);
+    size_t leaf_count = header(leaf.data())->count;
+    if ( count == 0 || position == leaf_count || compare(entries(leaf.data())[position].key, el) != 0 ) {
+        return 0;
+    }
+    char *data = leaf.mutableData();
+    LeafEntry *items = entries(data);
+    unsigned int removed = count < items[position].count ? count : items[position].count;
+    items[position].count -= removed;
+    if ( items[position].count == 0 ) {
+        std::memmove(items + position, items + position + 1, (leaf_count - position - 1) * sizeof(LeafEntry));
+        header(data)->count--;
+    }
+    meta.count -= removed;
+    return removed;
+}
+
+template<typename Element, typename Compare>
+template<typename Visitor>
+void PagedTree<Element, Compare>::scanFrom(const Element *low, Visitor visitor) const {
+    PageHandle leaf = low != nullptr ? findLeaf(*low) : pool->fetch(meta.first_leaf);
+    size_t position = low != nullptr ? leafPosition(leaf.data(), *low) : 0;
+    while ( true ) {
+        const LeafEntry *items = entries(leaf.data());
+        for (size_t count = header(leaf.data())->count; position < count; position++) {
+            if ( !visitor(items[position]) ) {
+                return;
+            }
+        }
+        uint32_t next = header(leaf.data())->next_leaf;
+        if ( next == 0 ) {
+            return;
+        }
+        leaf = pool->fetch(next);
+        position = 0;
+    }
+}
+
+template<typename Element, typename Compare>
+unsigned int PagedTree<Element, Compare>::countElements(const Element &low, const Element &high) const {
+    unsigned int found = 0;
+    if ( compare(low, high) <= 0 ) {
+        scanFrom(&low, [&](const LeafEntry &entry) {
+            if ( compare(entry.key, high) > 0 ) {
+                return false;
+            }
+            found += entry.count;
+            return true;
+        });
+    }
+    return found;
+}
+
+template<typename Element, typename Compare>
+void PagedTree<Element, Compare>::inOrderTraverse(ElementsTraverseFunc func) const {
+    scanFrom(nullptr, [&](const LeafEntry &entry) {
+        for (uint32_t i = 0; i < entry.count; i++) {
+            func(entry.key);
+        }
+        return true;
+    });
+}
+
+template<typename Element, typename Compare>
+void PagedTree<Element, Compare>::inRangeTraverse(const Element &low, const Element &high,
+                                                  ElementsTraverseFunc func) const {
+    if ( compare(low, high) > 0 ) {
+        return;
+    }
+    scanFrom(&low, [&](const LeafEntry &entry) {
+        if ( compare(entry.key, high) > 0 ) {
+            return false;
+        }
+        for (uint32_t i = 0; i < entry.count; i++) {
+            func(entry.key);
+        }
+        return true;
+    });
+}
+
+#endif //BINARY_TREE_PAGEDTREE_H
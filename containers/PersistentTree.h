@@ -0,0 +1,100 @@
+#ifndef BINARY_TREE_PERSISTENTTREE_H
+#define BINARY_TREE_PERSISTENTTREE_H
+
+#include <climits>
+
+#include "Tree.h"
+
+// Immutable tree versions.
+//
+// Every update returns a new version and leaves the original untouched.
+// Versions share all nodes except the ones on the updated path, which are
+// copied, so insert and remove cost one search path of new nodes and taking
+// a version (copying PersistentTree) is O(1).
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
+class PersistentTree {
+public:
+    typedef Tree<Element, Compare> MutableTree;
+    typedef typename MutableTree::ConstElementsTraverseFunc ElementsTraverseFunc;
+    typedef typename MutableTree::ElementPredicate ElementPredicate;
+
+    PersistentTree(Compare compare = Compare()) : tree(compare) { }
+    // O(1), shares nodes with provided tree
+    explicit PersistentTree(const MutableTree &tree) : tree(tree) { }
+
+    PersistentTree insert(const Element &el) const {
+        return update([&](MutableTree &next) { next.insert(el); });
+    }
+    PersistentTree remove(const Element &el, unsigned int count = 1) const {
+        return update([&](MutableTree &next) { next.remove(el, count); });
+    }
+    PersistentTree removeAll(const Element &el) const {
+        return remove(el, UINT_MAX);
+    }
+    // copies every node that predicate may have to restructure, O(n)
+    PersistentTree removeAll(ElementPredicate func) const {
+        return update([&](MutableTree &next) { next.removeAll(func); });
+    }
+    PersistentTree clear() const {
+        return update([&](MutableTree &next) { next.clear(); });
+    }
+
+    bool isMember(const Element &el) const {
+        return tree.isMember(el);
+    }
+    unsigned int countElements(const Element &el) const {
+        return tree.countElements(el);
+    }
+    unsigned int countElements(const Element &low, const Element &high) const {
+        return tree.countElements(low, high);
+    }
+    unsigned int countElements(ElementPredicate func) const {
+        return tree.countElements(func);
+    }
+    unsigned int size() const {
+        return tree.size();
+    }
+
+    // O(1), returned tree shares nodes with this version and copies them on write
+    MutableTree toTree() const {
+        return tree;
+    }
+    // changes from this version to a later one, see Tree::diff
+    TreeDiff<Element> diff(const PersistentTree &later) const {
+        return MutableTree::diff(tree, later.tree);
+    }
+
+    void preLeftTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        tree.preLeftTraverse(func, stop);
+    }
+    void postLeftTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        tree.postLeftTraverse(func, stop);
+    }
+    void preRightTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        tree.preRightTraverse(func, stop);
+    }
+    void postRightTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        tree.postRightTraverse(func, stop);
+    }
+    void inOrderTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        tree.inOrderTraverse(func, stop);
+    }
+    void inOppositeOrderTraverse(ElementsTraverseFunc func, ElementPredicate stop=NEGATIVE_PREDICATE) const {
+        tree.inOppositeOrderTraverse(func, stop);
+    }
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc func) const {
+        tree.inRangeTraverse(low, high, func);
+    }
+
+private:
+    template<typename UpdateFunc>
+    PersistentTree update(UpdateFunc func) const {
+        PersistentTree next(*this);
+        func(next.tree);
+        return next;
+    }
+
+    MutableTree tree;
+};
+
+#endif //BINARY_TREE_PERSISTENTTREE_H
@@ -0,0 +1,97 @@
+#ifndef BINARY_TREE_THREEWAYCOMPARE_H
+#define BINARY_TREE_THREEWAYCOMPARE_H
+
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus > 201703L && defined(__cpp_impl_three_way_comparison)
+#include <compare>
+#endif
+
+// Three-way comparator used by Tree for every descent.
+// Returns negative, zero or positive number when first argument is
+// less than, equal to or greater than second one, so each visited node
+// costs exactly one comparison.
+//
+// Lookup order: member compare() (std::string and friends),
+// operator<=> (C++20), arithmetic, then operator> together with operator==.
+// Any functor with the same signature can be passed to Tree instead.
+
+namespace tree_detail {
+
+    template<typename T>
+    class HasCompareMember {
+        template<typename U>
+        static auto test(int) -> decltype(std::declval<const U &>().compare(std::declval<const U &>()),
+                                          std::true_type());
+        template<typename>
+        static std::false_type test(...);
+    public:
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    template<typename T>
+    class HasSpaceshipOperator {
+#if __cplusplus > 201703L && defined(__cpp_impl_three_way_comparison)
+        template<typename U>
+        static auto test(int) -> decltype(std::declval<const U &>() <=> std::declval<const U &>(),
+                                          std::true_type());
+#endif
+        template<typename>
+        static std::false_type test(...);
+    public:
+        static const bool value = decltype(test<T>(0))::value;
+    };
+
+    template<typename T>
+    int sign(const T &value) {
+        return (value > 0) - (value < 0);
+    }
+
+    enum class CompareKind { Member, Spaceship, Arithmetic, Operators };
+
+    template<typename T>
+    struct CompareKindOf {
+        static const CompareKind value =
+                HasCompareMember<T>::value ? CompareKind::Member :
+                HasSpaceshipOperator<T>::value ? CompareKind::Spaceship :
+                std::is_arithmetic<T>::value ? CompareKind::Arithmetic :
+                CompareKind::Operators;
+    };
+
+    template<typename T, CompareKind kind = CompareKindOf<T>::value>
+    struct ThreeWayCompareImpl {
+        int operator()(const T &a, const T &b) const {
+            return a > b ? 1 : (a == b ? 0 : -1);
+        }
+    };
+
+    template<typename T>
+    struct ThreeWayCompareImpl<T, CompareKind::Member> {
+        int operator()(const T &a, const T &b) const {
+            return sign(a.compare(b));
+        }
+    };
+
+    template<typename T>
+    struct ThreeWayCompareImpl<T, CompareKind::Arithmetic> {
+        int operator()(const T &a, const T &b) const {
+            return (a > b) - (a < b);
+        }
+    };
+
+#if __cplusplus > 201703L && defined(__cpp_impl_three_way_comparison)
+    template<typename T>
+    struct ThreeWayCompareImpl<T, CompareKind::Spaceship> {
+        int operator()(const T &a, const T &b) const {
+            auto order = a <=> b;
+            return (order > 0) - (order < 0);
+        }
+    };
+#endif
+}
+
+template<typename Element>
+struct ThreeWayCompare : public tree_detail::ThreeWayCompareImpl<Element> { };
+
+#endif //BINARY_TREE_THREEWAYCOMPARE_H
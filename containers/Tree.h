@@ -7,85 +7,392 @@
 
 #include <memory>
 #include <functional>
-
-template<typename Element>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <future>
+#include <thread>
+#include <limits>
+#include <atomic>
+
+#include "ThreeWayCompare.h"
+#include "TreeSerialization.h"
+#include "TreeStats.h"
+#include "TreeBalancing.h"
+#include "TreeDiff.h"
+#include "TreeCounters.h"
+#include "TreeHeatmap.h"
+
+template<typename Element, typename Compare>
+class PersistentTree;
+
+template<typename Element, typename Compare = ThreeWayCompare<Element>>
 class Tree {
 public:
     typedef std::function<void(Element &)> ElementsTraverseFunc;
+    typedef std::function<void(const Element &)> ConstElementsTraverseFunc;
     typedef std::function<bool(const Element &)> ElementPredicate;
 
     friend class TreeGraphBuilder;
+    friend class TreeDotWriter;
+    template<typename, typename, typename> friend class TreeMapBase;
+    template<typename, typename, typename> friend class TreeMap;
+    template<typename, typename, typename> friend class TreeMultiMap;
 
 #define NEGATIVE_PREDICATE [](const Element &) -> bool { return false; }
 
     Tree() : number_of_elements(0), root(nullptr) { }
+    explicit Tree(Compare compare) : number_of_elements(0), root(nullptr), compare(compare) { }
+    explicit Tree(TreeBalancing balancing, Compare compare = Compare())
+            : number_of_elements(0), root(nullptr), compare(compare), balancing(balancing) { }
+    class Finger;
+
     void insert(const Element &el);
+    // In splay mode isMember and find of a non-const tree splay the found
+    // element to the root; lookups through const references never change
+    // the tree, so shared versions and concurrent readers see a stable shape.
     bool isMember(const Element &el) const;
+    bool isMember(const Element &el);
+    // Insertion and lookup starting from a remembered position, for streams
+    // of elements close to each other; cost is O(log d) comparisons to find
+    // where to start plus the descent from there, d being the distance from
+    // the finger. Plain insert may keep a finger of its own, see
+    // trackLastInsert. Fingers are ignored in splay and treap modes, which
+    // restructure on insert.
+    void insert(Finger &finger, const Element &el);
+    // Plain insert starts from the previous insertion when the element
+    // falls right next to it; pays off for mostly sorted streams only, as
+    // other elements cost up to two comparisons more. Off by default, kept
+    // by copies.
+    void trackLastInsert(bool enabled) {
+        fingers.track_last_insert = enabled;
+    }
+    // element equal to el or nullptr
+    const Element *find(Finger &finger, const Element &el) const;
+    const Element *find(Finger &finger, const Element &el);
     unsigned int removeAll(const Element &el);
     unsigned int removeAll(ElementPredicate);
     unsigned int remove(const Element &el, unsigned int count = 1);
     unsigned int countElements(const Element &el) const;
     unsigned int countElements(ElementPredicate) const;
+    // number of elements in closed interval [low, high]
+    unsigned int countElements(const Element &low, const Element &high) const;
     unsigned int size() const {
         return number_of_elements;
     }
+    TreeBalancing balancingPolicy() const {
+        return balancing;
+    }
     void clear() {
+        invalidateFingers();
         number_of_elements = 0;
+        max_size = 0;
         root = nullptr;
+        shape_tracking.height = shape_tracking.max_depth = 0;
+    }
+
+    // Full shape statistics in one iterative pass, O(n).
+    TreeStats stats() const;
+    // Turns on cheap tracking of height and depth (see TreeShapeTracking),
+    // enabling, also when already on, starts from exact values computed by stats().
+    void trackShape(bool enabled);
+    const TreeShapeTracking &shapeTracking() const {
+        return shape_tracking;
+    }
+    // Moves elements greater than key to the returned tree. Expected
+    // O(log n) in treap mode; nodes of other modes keep no subtree sizes,
+    // so the smaller part is counted on top.
+    Tree split(const Element &key);
+    // Appends tree whose every element is greater than every element of
+    // this one, expected O(log n) in treap mode; throws otherwise.
+    void join(Tree greater);
+    // Treap recursions over both trees, top levels run on parallel threads;
+    // balanced in treap mode. Arguments stay unchanged.
+    // all elements of both trees, with duplicates
+    static Tree unite(const Tree &a, const Tree &b);
+    // elements of a equal to some element of b
+    static Tree intersect(const Tree &a, const Tree &b);
+
+    // Added, removed and moved elements between two versions. Subtrees
+    // shared by the versions (copies, snapshots) are skipped, so the cost is
+    // proportional to the changed region; unrelated trees are compared fully.
+    static TreeDiff<Element> diff(const Tree &before, const Tree &after);
+
+    // Counts accesses of nodes by every period-th lookup, 0 stops counting.
+    // Works only in builds with BINARY_TREE_HEATMAP (see TreeHeatmap.h).
+    void sampleAccesses(unsigned int period) {
+        access_sampling = period;
     }
 
+    // O(1) read only view of current state. Nodes are shared with the tree
+    // and copied only when the tree modifies them later, so the snapshot
+    // may be scanned from another thread while this tree keeps changing.
+    // Take snapshots on the thread that modifies the tree.
+    PersistentTree<Element, Compare> snapshot() const {
+        return PersistentTree<Element, Compare>(*this);
+    }
+
+    // Writes elements in order and, optionally, exact shape of the tree
+    // (see TreeSerialization.h for the format). Element types other than
+    // arithmetic and strings need ElementCodec specialization.
+    void serialize(std::ostream &out, bool with_shape = false) const;
+    // Linear time load: without stored shape builds perfectly balanced tree.
+    static Tree deserialize(std::istream &in, Compare compare = Compare());
+
     Tree makeElementsSubtree(ElementPredicate filterFunc) const;
     Tree getSubtreeFromElement(const Element &) const;
     Tree getSubtreeFromElement(ElementPredicate) const;
 
-    void preLeftTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void postLeftTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void preRightTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void postRightTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void inOrderTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void inOppositeOrderTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    // Traversals of a non-const tree may change elements, as long as their
+    // order stays the same; nodes shared with copies and snapshots are
+    // cloned on the way, so the changes stay in this tree. Traversals of
+    // const trees pass const elements and never clone.
+    void preLeftTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE);
+    void postLeftTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE);
+    void preRightTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE);
+    void postRightTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE);
+    void inOrderTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE);
+    void inOppositeOrderTraverse(ElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE);
+    // in order traversal of elements from closed interval [low, high]
+    void inRangeTraverse(const Element &low, const Element &high, ElementsTraverseFunc);
+
+    void preLeftTraverse(ConstElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    void postLeftTraverse(ConstElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    void preRightTraverse(ConstElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    void postRightTraverse(ConstElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    void inOrderTraverse(ConstElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    void inOppositeOrderTraverse(ConstElementsTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
+    void inRangeTraverse(const Element &low, const Element &high, ConstElementsTraverseFunc) const;
 
 private:
 
     class Node;
+    class ElementNode;
+    class TreapNode;
     class ConditionWrapper;
 
     typedef std::shared_ptr<Node> NodePtr;
     typedef std::function<void(NodePtr &)> NodesTraverseFunc;
 
-    Tree(NodePtr root) : root(root), number_of_elements(0) {
+public:
+
+    // Path from the root to the last element reached through the finger.
+    // Any change of the tree made not through this finger makes it stale
+    // and the next search goes from the root again; so does sharing nodes
+    // of any tree of this type (copies, subtrees, set operations) for the
+    // next insertion. One finger may serve only one tree at a time.
+    class Finger {
+    public:
+        Finger() = default;
+
+    private:
+        friend class Tree;
+
+        struct Level {
+            Node *node;
+            // levels of the nearest ancestors bounding subtree of node
+            // from below and from above, -1 for none
+            int low;
+            int high;
+        };
+
+        std::vector<Level> path;
+        const Tree *tree = nullptr;
+        uint64_t tree_id = 0;
+        uint64_t version = 0;
+        uint64_t sharing = 0;
+        // leading levels cloned by insertions, only those may be modified
+        size_t owned = 0;
+    };
+
+private:
+
+    // Identity and structural version of the tree, checked by fingers. Ids
+    // are unique, so a stale finger never matches a new tree at the same
+    // address. Sharing nodes must stop insertions from changing them in
+    // place through fingers of the source, which may be const and read by
+    // other threads meanwhile, so it advances a sharing epoch common to all
+    // trees of the type instead of writing to the source.
+    class FingerTracking {
+    public:
+        FingerTracking() : id(nextId()) { }
+        FingerTracking(const FingerTracking &other) : id(nextId()), track_last_insert(other.track_last_insert) {
+            noteSharing();
+        }
+        FingerTracking(FingerTracking &&other) : id(nextId()), track_last_insert(other.track_last_insert) {
+            other.id = nextId();
+        }
+        FingerTracking &operator=(const FingerTracking &other) {
+            id = nextId();
+            track_last_insert = other.track_last_insert;
+            last_insert = Finger();
+            noteSharing();
+            return *this;
+        }
+        FingerTracking &operator=(FingerTracking &&other) {
+            id = nextId();
+            other.id = nextId();
+            track_last_insert = other.track_last_insert;
+            last_insert = Finger();
+            return *this;
+        }
+
+        static uint64_t nextId() {
+            static std::atomic<uint64_t> ids(0);
+            return ++ids;
+        }
+        static std::atomic<uint64_t> &sharingEpoch() {
+            static std::atomic<uint64_t> epoch(0);
+            return epoch;
+        }
+        static void noteSharing() {
+            sharingEpoch().fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t id;
+        uint64_t version = 0;
+        bool track_last_insert = false;
+        Finger last_insert;
+    };
+
+    Tree(NodePtr root, Compare compare) : root(root), number_of_elements(0), compare(compare) {
         inOrderNodesTraverse([&](const NodePtr &node) {
             number_of_elements++;
         });
     }
 
-    void insertNode(NodePtr parent_node, NodePtr node_to_insert);
-
-    NodePtr findParentForNodeInsertion(const NodePtr& starting_node, const NodePtr& node_for_insertion) const;
+    // returns depth at which node was attached below subtree root
+    unsigned int insertNode(NodePtr& subtree, NodePtr node_to_insert);
+    void insertNewNode(NodePtr node_to_insert);
+    void invalidateFingers() {
+        fingers.version++;
+    }
+    bool fingerValid(const Finger &finger) const {
+        return finger.tree == this && finger.tree_id == fingers.id && finger.version == fingers.version &&
+               !finger.path.empty();
+    }
+    // whether insertion may change nodes of the finger's owned levels in place
+    bool fingerOwns(const Finger &finger) const {
+        return finger.owned > 0 &&
+               finger.sharing == FingerTracking::sharingEpoch().load(std::memory_order_relaxed);
+    }
+    template<typename Probe>
+    bool levelHolds(const Finger &finger, size_t level, const Probe &value, bool inclusive_high) const;
+    template<typename Probe>
+    size_t fingerLevel(const Finger &finger, const Probe &value, bool inclusive_high) const;
+    void fingerInsert(Finger &finger, NodePtr inserted_node, bool climb);
+    static void unshare(NodePtr& slot);
+    static void rotateUp(NodePtr& slot, bool left_child);
+    void splay(std::vector<NodePtr*> &path);
+    bool splayFind(const Element &value);
+    void splayInsert(NodePtr inserted_node);
+
+    // Node of the type the policy needs: only treap nodes carry balance data.
+    template<typename Value>
+    NodePtr makeNode(Value &&el) const {
+        if ( balancing == TreeBalancing::Treap ) {
+            return std::make_shared<TreapNode>(std::forward<Value>(el));
+        }
+        return std::make_shared<ElementNode>(std::forward<Value>(el));
+    }
+    // Set operations run on trees of any policy; nodes without treap data
+    // get priorities from their addresses and keep no sizes.
+    static uint32_t priority(const NodePtr &node) {
+        const TreapData *data = node->treapData();
+        return data != nullptr ? data->priority : (uint32_t) treapPriority(node.get());
+    }
+    static unsigned int subtreeSize(const NodePtr &node) {
+        const TreapData *data = node != nullptr ? node->treapData() : nullptr;
+        return data != nullptr ? data->subtree_size : 0;
+    }
+    static void recountSize(Node *node) {
+        if ( TreapData *data = node->treapData() ) {
+            data->subtree_size = 1 + subtreeSize(node->getLeft()) + subtreeSize(node->getRight());
+        }
+    }
+    // same elements in treap nodes, for treap operations taking over nodes of other policies
+    static Tree treapCopy(const Tree &tree);
+    static void recountSizes(const NodePtr &subtree);
+    // nodes on the path from subtree root always going left or always right
+    static unsigned int spineLength(const NodePtr &subtree, bool left);
+    static unsigned int parallelLevels();
+    static void countParts(const NodePtr &first, const NodePtr &second, unsigned int total,
+                           unsigned int &first_count);
+    void treapInsert(NodePtr inserted_node);
+    void splitNodes(NodePtr subtree, const Element &key, NodePtr &less_equal, NodePtr &greater) const;
+    static NodePtr joinNodes(NodePtr less, NodePtr greater);
+    NodePtr uniteNodes(NodePtr a, NodePtr b, unsigned int parallel_levels) const;
+    NodePtr intersectNodes(NodePtr a, NodePtr b, unsigned int parallel_levels) const;
+
+    static unsigned int scapegoatDepthLimit(unsigned int size);
+    static unsigned int countNodes(const NodePtr &subtree);
+    void scapegoatRebalance(Finger &finger);
+    void scapegoatUnlink(NodePtr& slot, NodePtr left, NodePtr right);
+    void scapegoatShrink();
+    static void rebuildBalanced(NodePtr& subtree, unsigned int size);
+    static void foldVine(NodePtr& vine, unsigned int count);
+
+    template<typename Probe>
+    NodePtr& findInsertionSlot(NodePtr& starting_node, const Probe &value, unsigned int &depth);
+    template<typename Probe>
+    NodePtr& findUniqueSlot(NodePtr& starting_node, const Probe &value, std::vector<Node*> *path = nullptr);
     NodePtr findElement(ElementPredicate) const;
     NodePtr findElement(const Element &value) const;
-    NodePtr iterStepByValue(const Element &node_value, NodePtr current_iter_pos) const;
+    template<typename Probe>
+    const NodePtr* findSlot(const NodePtr& starting_node, const Probe &value) const;
 
-    void removeRoot();
-    void removeRightNode(NodePtr node_to_remove, NodePtr parent_node);
-    void removeLeftNode(NodePtr node_to_remove, NodePtr parent_node);
-    void removeNode(NodePtr node_to_remove, NodePtr parent_node);
+    template<typename Probe>
+    unsigned int removeEqual(const Probe &value, unsigned int count);
+    void unlinkNode(NodePtr& slot, bool promote_left = false);
+
+    NodePtr loadBalanced(TreeReader &reader, uint64_t count, Node *&previous) const;
+    NodePtr loadShaped(TreeReader &reader, const std::vector<unsigned char> &shape, uint64_t count) const;
+    NodePtr loadNode(TreeReader &reader, NodePtr left, Node *&previous) const;
     void traverseWithParent(NodePtr& iter,
                             std::function<void(NodePtr&, NodePtr&)>);
 
-    void preLeftNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void postLeftNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void preRightNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void postRightNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void inOrderNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-    void inOppositeOrderNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE) const;
-
-    void preLeftTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&) const;
-    void postLeftTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&) const;
-    void preRightTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&) const;
-    void postRightTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&) const;
-    void inOrderTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&) const;
-    void inOppositeOrderTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&) const;
+    struct NodeMove {
+        Node *before;
+        Node *after;
+        unsigned int old_depth;
+        unsigned int new_depth;
+        bool subtree;
+    };
+    struct NodesDiff {
+        std::vector<Node*> added;
+        std::vector<Node*> removed;
+        std::vector<NodeMove> moved;
+        size_t examined = 0;
+    };
+    static NodesDiff diffNodes(const NodePtr &before, const NodePtr &after, const Compare &compare);
+
+    void preLeftNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE, bool clone_shared = false) const;
+    void postLeftNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE, bool clone_shared = false) const;
+    void preRightNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE, bool clone_shared = false) const;
+    void postRightNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE, bool clone_shared = false) const;
+    void inOrderNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE, bool clone_shared = false) const;
+    void inOppositeOrderNodesTraverse(NodesTraverseFunc, ElementPredicate=NEGATIVE_PREDICATE, bool clone_shared = false) const;
+
+    // child about to be visited, cloned first when shared and the traversal may write to it
+    static NodePtr& traversedChild(NodePtr &child, bool clone_shared) {
+        if ( clone_shared ) {
+            unshare(child);
+        }
+        return child;
+    }
+    void preLeftTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&, bool clone_shared) const;
+    void postLeftTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&, bool clone_shared) const;
+    void preRightTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&, bool clone_shared) const;
+    void postRightTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&, bool clone_shared) const;
+    void inOrderTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&, bool clone_shared) const;
+    void inOppositeOrderTraverseInner(NodePtr, NodesTraverseFunc, ConditionWrapper&, bool clone_shared) const;
+    template<typename Probe>
+    void inRangeTraverseInner(Node*, const Probe&, const Probe&,
+                              bool check_low, bool check_high, std::function<void(Node*)>&,
+                              bool clone_shared = false) const;
+    template<typename Probe>
+    unsigned int countInRange(const Probe &low, const Probe &high) const;
 
     class ConditionWrapper {
     public:
@@ -103,10 +410,21 @@ private:
         bool evaluated;
     };
 
+    // Balance data of treap nodes: heap key, fixed when node is created,
+    // and number of nodes in subtree.
+    struct TreapData {
+        uint32_t priority;
+        unsigned int subtree_size;
+    };
+
     class Node {
     public:
-        Node() : left(nullptr), right(nullptr) {}
-        Node(NodePtr left, NodePtr right) : left(left), right(right) {}
+        Node() : left(nullptr), right(nullptr) {
+            TREE_COUNT(allocations, 1);
+        }
+        Node(NodePtr left, NodePtr right) : left(std::move(left)), right(std::move(right)) {
+            TREE_COUNT(allocations, 1);
+        }
 
         // set right child to provided Node
         void operator>>(NodePtr new_right) {
@@ -130,53 +448,308 @@ private:
             throw std::string("Trying to get element of base node.");
         }
 
+        // node of the same type with the same element and children
+        virtual NodePtr clone() {
+            throw std::string("Trying to clone base node.");
+        }
+
+        // nullptr for nodes of policies other than treap
+        virtual TreapData* treapData() {
+            return nullptr;
+        }
+
+        // number of sampled lookups passed through this node, 0 without BINARY_TREE_HEATMAP
+        uint32_t accessCount() const {
+#ifdef BINARY_TREE_HEATMAP
+            return accesses.get();
+#else
+            return 0;
+#endif
+        }
+        void noteAccess() {
+#ifdef BINARY_TREE_HEATMAP
+            accesses.hit();
+#endif
+        }
+        // clone made by copy on write takes over what is not its structure
+        void inheritFrom(const Node &original) {
+#ifdef BINARY_TREE_HEATMAP
+            accesses.set(original.accesses.get());
+#else
+            (void) original;
+#endif
+        }
+
     private:
         NodePtr left;
         NodePtr right;
+#ifdef BINARY_TREE_HEATMAP
+        NodeAccessCounter accesses;
+#endif
     };
 
     class ElementNode : public Node {
     public:
-        ElementNode(Element el) : Node(), el(el) { }
-        ElementNode(Element el, NodePtr left, NodePtr right) : Node(left, right), el(el) {}
+        ElementNode(Element el) : Node(), el(std::move(el)) { }
+        ElementNode(Element el, NodePtr left, NodePtr right)
+                : Node(std::move(left), std::move(right)), el(std::move(el)) {}
 
         virtual Element& getValue() {
             return el;
         }
 
+        virtual NodePtr clone() {
+            return std::make_shared<ElementNode>(el, this->getLeft(), this->getRight());
+        }
+
     private:
         Element el;
     };
 
+    class TreapNode : public ElementNode {
+    public:
+        TreapNode(Element el) : ElementNode(std::move(el)), data{(uint32_t) treapPriority(this), 1} { }
+        TreapNode(Element el, NodePtr left, NodePtr right, TreapData data)
+                : ElementNode(std::move(el), std::move(left), std::move(right)), data(data) { }
+
+        virtual NodePtr clone() {
+            return std::make_shared<TreapNode>(this->getValue(), this->getLeft(), this->getRight(), data);
+        }
+
+        virtual TreapData* treapData() {
+            return &data;
+        }
+
+    private:
+        TreapData data;
+    };
+
     unsigned int number_of_elements;
     NodePtr root;
+    Compare compare;
+    TreeShapeTracking shape_tracking;
+    unsigned int access_sampling = 0;
+    TreeBalancing balancing = TreeBalancing::None;
+    // largest size since the last full rebuild, scapegoat policy only
+    unsigned int max_size = 0;
+    FingerTracking fingers;
 };
 
-template<typename Element>
-void Tree<Element>::insert(const Element &element_to_insert) {
-    NodePtr inserted_node(new ElementNode(element_to_insert));
-    if (root != nullptr) {
-        insertNode(root, inserted_node);
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::insert(const Element &element_to_insert) {
+    insertNewNode(makeNode(element_to_insert));
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::insertNewNode(NodePtr inserted_node) {
+    if ( balancing == TreeBalancing::Splay ) {
+        splayInsert(std::move(inserted_node));
+        return;
+    }
+    if ( balancing == TreeBalancing::Treap ) {
+        treapInsert(std::move(inserted_node));
+        return;
+    }
+    if ( !fingers.track_last_insert ) {
+        // finger serves as path buffer only, search goes from the root
+        fingers.last_insert.tree = nullptr;
+    }
+    fingerInsert(fingers.last_insert, std::move(inserted_node), false);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::insert(Finger &finger, const Element &element_to_insert) {
+    NodePtr inserted_node = makeNode(element_to_insert);
+    if ( balancing == TreeBalancing::Splay || balancing == TreeBalancing::Treap ) {
+        insertNewNode(std::move(inserted_node));
+        return;
+    }
+    fingerInsert(finger, std::move(inserted_node), true);
+}
+
+template<typename Element, typename Compare>
+const Element *Tree<Element, Compare>::find(Finger &finger, const Element &el) {
+    if ( balancing == TreeBalancing::Splay ) {
+        return splayFind(el) ? &root->getValue() : nullptr;
+    }
+    return static_cast<const Tree &>(*this).find(finger, el);
+}
+
+template<typename Element, typename Compare>
+const Element *Tree<Element, Compare>::find(Finger &finger, const Element &el) const {
+    std::vector<typename Finger::Level> &path = finger.path;
+    if ( fingerValid(finger) ) {
+        size_t level = fingerLevel(finger, el, false);
+        path.resize(level + 1);
+        finger.owned = std::min(finger.owned, path.size());
     } else {
-        root = inserted_node;
+        path.clear();
+        if ( root == nullptr ) {
+            return nullptr;
+        }
+        path.push_back({root.get(), -1, -1});
+        finger.tree = this;
+        finger.tree_id = fingers.id;
+        finger.version = fingers.version;
+        finger.owned = 0;
+    }
+    bool sampled = sampleTreeAccess(access_sampling);
+    while ( true ) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        Node *node = path.back().node;
+        if ( sampled ) {
+            node->noteAccess();
+        }
+        int order = compare(el, node->getValue());
+        if ( order == 0 ) {
+            return &node->getValue();
+        }
+        const NodePtr &child = order > 0 ? node->getRight() : node->getLeft();
+        if ( child == nullptr ) {
+            return nullptr;
+        }
+        int parent = (int) path.size() - 1;
+        path.push_back({child.get(), order > 0 ? parent : path.back().low, order > 0 ? path.back().high : parent});
     }
-    number_of_elements++;
 }
 
-template<typename Element>
-void Tree<Element>::insertNode(NodePtr parent_node, NodePtr node_to_insert) {
-    if ( node_to_insert != nullptr ) {
-        auto insert_node = findParentForNodeInsertion(parent_node, node_to_insert);
-        if (node_to_insert->getValue() > insert_node->getValue()) {
-            *insert_node >> node_to_insert;
+// Whether subtree at the level of the finger holds every element a search
+// for value from the root would reach. Elements equal to the upper bound
+// go to the left, so insertion may start below it, but lookup must not.
+template<typename Element, typename Compare>
+template<typename Probe>
+bool Tree<Element, Compare>::levelHolds(const Finger &finger, size_t level, const Probe &value,
+                                        bool inclusive_high) const {
+    const typename Finger::Level &bounds = finger.path[level];
+    if ( bounds.low >= 0 ) {
+        TREE_COUNT(comparisons, 1);
+        if ( compare(value, finger.path[bounds.low].node->getValue()) <= 0 ) {
+            return false;
+        }
+    }
+    if ( bounds.high >= 0 ) {
+        TREE_COUNT(comparisons, 1);
+        int order = compare(value, finger.path[bounds.high].node->getValue());
+        return inclusive_high ? order <= 0 : order < 0;
+    }
+    return true;
+}
+
+// Deepest level of the finger holding value. Subtrees along the path are
+// nested, so levels are probed with doubling steps up from the bottom,
+// then the last step is bisected: O(log d) probes.
+template<typename Element, typename Compare>
+template<typename Probe>
+size_t Tree<Element, Compare>::fingerLevel(const Finger &finger, const Probe &value, bool inclusive_high) const {
+    size_t holding = finger.path.size() - 1, failed = finger.path.size(), step = 1;
+    while ( holding > 0 && !levelHolds(finger, holding, value, inclusive_high) ) {
+        failed = holding;
+        holding = holding > step ? holding - step : 0;
+        step *= 2;
+    }
+    while ( failed - holding > 1 ) {
+        size_t middle = holding + (failed - holding) / 2;
+        if ( levelHolds(finger, middle, value, inclusive_high) ) {
+            holding = middle;
         } else {
-            *insert_node << node_to_insert;
+            failed = middle;
         }
     }
+    return holding;
 }
 
-template<typename Element>
-typename Tree<Element>::NodePtr Tree<Element>::findElement(ElementPredicate test_func) const {
+// Descends from the finger, or from the root when the finger is stale,
+// cloning shared nodes on the way, and leaves the finger at the new node.
+// With climb unset only the last position is tried, so a far element costs
+// at most two comparisons more than a search from the root.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::fingerInsert(Finger &finger, NodePtr inserted_node, bool climb) {
+    const Element &value = inserted_node->getValue();
+    std::vector<typename Finger::Level> &path = finger.path;
+    if ( fingerValid(finger) && fingerOwns(finger) ) {
+        size_t level = 0;
+        if ( climb ) {
+            level = fingerLevel(finger, value, true);
+        } else if ( levelHolds(finger, path.size() - 1, value, true) ) {
+            level = path.size() - 1;
+        }
+        path.resize(std::min(level + 1, finger.owned));
+    } else {
+        path.clear();
+        if ( root != nullptr ) {
+            unshare(root);
+            path.push_back({root.get(), -1, -1});
+        }
+    }
+    if ( path.empty() ) {
+        root = std::move(inserted_node);
+        path.push_back({root.get(), -1, -1});
+    } else {
+        while ( true ) {
+            TREE_COUNT(node_visits, 1);
+            TREE_COUNT(comparisons, 1);
+            Node *node = path.back().node;
+            bool right = compare(value, node->getValue()) > 0;
+            NodePtr &child = right ? node->getRight() : node->getLeft();
+            int parent = (int) path.size() - 1;
+            typename Finger::Level level{nullptr, right ? parent : path.back().low, right ? path.back().high : parent};
+            if ( child == nullptr ) {
+                child = std::move(inserted_node);
+                level.node = child.get();
+                path.push_back(level);
+                break;
+            }
+            unshare(child);
+            level.node = child.get();
+            path.push_back(level);
+        }
+    }
+    unsigned int depth = (unsigned int) path.size() - 1;
+    if ( shape_tracking.enabled ) {
+        shape_tracking.noteInsert(depth);
+    }
+    number_of_elements++;
+    invalidateFingers();
+    finger.tree = this;
+    finger.tree_id = fingers.id;
+    finger.version = fingers.version;
+    finger.sharing = FingerTracking::sharingEpoch().load(std::memory_order_relaxed);
+    finger.owned = path.size();
+    if ( balancing == TreeBalancing::Scapegoat ) {
+        max_size = std::max(max_size, number_of_elements);
+        if ( depth > scapegoatDepthLimit(number_of_elements) ) {
+            scapegoatRebalance(finger);
+            invalidateFingers();
+            path.clear();
+        }
+    }
+}
+
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::insertNode(NodePtr& subtree, NodePtr node_to_insert) {
+    unsigned int depth = 0;
+    if ( node_to_insert != nullptr ) {
+        NodePtr& slot = findInsertionSlot(subtree, node_to_insert->getValue(), depth);
+        slot = std::move(node_to_insert);
+    }
+    return depth;
+}
+
+// Nodes may be shared with other trees (copies, subtrees, snapshots),
+// so every mutating descent clones shared nodes before changing them.
+// Nodes reachable only from this tree are modified in place.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::unshare(NodePtr& slot) {
+    if ( slot.use_count() > 1 ) {
+        NodePtr copy = slot->clone();
+        copy->inheritFrom(*slot);
+        slot = std::move(copy);
+    }
+}
+
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::findElement(ElementPredicate test_func) const {
     NodePtr found;
     preLeftNodesTraverse([&](NodePtr& node) {
         if ( test_func(node->getValue()) ) {
@@ -188,99 +761,214 @@ typename Tree<Element>::NodePtr Tree<Element>::findElement(ElementPredicate test
     return found;
 }
 
-template<typename Element>
-typename Tree<Element>::NodePtr Tree<Element>::findElement(const Element &value) const {
-    auto iter = root;
-    while (iter != nullptr && iter->getValue() != value) {
-        iter = iterStepByValue(value, iter);
-    }
-    return iter;
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::findElement(const Element &value) const {
+    auto slot = findSlot(root, value);
+    return slot != nullptr ? *slot : nullptr;
 }
 
-template<typename Element>
-typename Tree<Element>::NodePtr Tree<Element>::findParentForNodeInsertion(
+// Walks slots instead of copying NodePtr, so lookups neither touch
+// reference counters nor compare more than once per level.
+template<typename Element, typename Compare>
+template<typename Probe>
+const typename Tree<Element, Compare>::NodePtr* Tree<Element, Compare>::findSlot(
         const NodePtr& starting_node,
-        const NodePtr& node_for_insertion
+        const Probe &value
 ) const {
-    auto tree_iterator = starting_node;
-    NodePtr prevParent = nullptr;
-    while (tree_iterator != nullptr) {
-        prevParent = tree_iterator;
-        tree_iterator = iterStepByValue(node_for_insertion->getValue(), tree_iterator);
+    const NodePtr* slot = &starting_node;
+    bool sampled = sampleTreeAccess(access_sampling);
+    while (*slot != nullptr) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        if ( sampled ) {
+            (*slot)->noteAccess();
+        }
+        int order = compare(value, (*slot)->getValue());
+        if ( order == 0 ) {
+            return slot;
+        }
+        slot = order > 0 ? &(*slot)->getRight() : &(*slot)->getLeft();
     }
-    return prevParent;
+    return nullptr;
 }
 
-template<typename Element>
-typename Tree<Element>::NodePtr Tree<Element>::iterStepByValue(const Element &node_value,
-                                                               NodePtr current_iter_pos) const {
-    if (node_value > current_iter_pos->getValue()) {
-        return current_iter_pos->getRight();
+// Returns empty child slot where element with provided value should be attached.
+// Starting node must not be null.
+template<typename Element, typename Compare>
+template<typename Probe>
+typename Tree<Element, Compare>::NodePtr& Tree<Element, Compare>::findInsertionSlot(
+        NodePtr& starting_node,
+        const Probe &value,
+        unsigned int &depth
+) {
+    NodePtr* slot = &starting_node;
+    depth = 0;
+    while (*slot != nullptr) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        unshare(*slot);
+        slot = compare(value, (*slot)->getValue()) > 0 ? &(*slot)->getRight() : &(*slot)->getLeft();
+        depth++;
     }
-    return current_iter_pos->getLeft();
+    return *slot;
 }
 
-template<typename Element>
-bool Tree<Element>::isMember(const Element &el) const {
-    return findElement(el) != nullptr;
+// Returns slot holding element equal to provided value,
+// or empty slot where such element should be attached.
+template<typename Element, typename Compare>
+template<typename Probe>
+typename Tree<Element, Compare>::NodePtr& Tree<Element, Compare>::findUniqueSlot(
+        NodePtr& starting_node,
+        const Probe &value,
+        std::vector<Node*> *path
+) {
+    NodePtr* slot = &starting_node;
+    while (*slot != nullptr) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        unshare(*slot);
+        int order = compare(value, (*slot)->getValue());
+        if ( order == 0 ) {
+            break;
+        }
+        if ( path != nullptr ) {
+            path->push_back(slot->get());
+        }
+        slot = order > 0 ? &(*slot)->getRight() : &(*slot)->getLeft();
+    }
+    return *slot;
+}
+
+template<typename Element, typename Compare>
+bool Tree<Element, Compare>::isMember(const Element &el) const {
+    return findSlot(root, el) != nullptr;
+}
+
+template<typename Element, typename Compare>
+bool Tree<Element, Compare>::isMember(const Element &el) {
+    if ( balancing == TreeBalancing::Splay ) {
+        return splayFind(el);
+    }
+    return findSlot(root, el) != nullptr;
 }
 
-template<typename Element>
-unsigned int Tree<Element>::removeAll(ElementPredicate func) {
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::removeAll(ElementPredicate func) {
+    invalidateFingers();
     unsigned int removed = 0;
-    NodePtr imaginary_root(new Node(nullptr, root));
+    NodePtr imaginary_root = std::make_shared<Node>(nullptr, std::move(root));
     traverseWithParent(imaginary_root, [&](NodePtr& p, NodePtr& c) {
         if ( func(c->getValue()) ) {
-            removeNode(c, p);
+            unlinkNode(c, &c == &p->getLeft());
             removed++;
         }
     });
     root = imaginary_root->getRight();
+    if ( balancing == TreeBalancing::Treap ) {
+        recountSizes(root);
+    }
+    number_of_elements -= removed;
+    if ( number_of_elements == 0 ) {
+        shape_tracking.height = shape_tracking.max_depth = 0;
+    }
+    scapegoatShrink();
     return removed;
 }
 
-template<typename Element>
-void Tree<Element>::traverseWithParent(NodePtr& iter,
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::traverseWithParent(NodePtr& iter,
                                        std::function<void(NodePtr&, NodePtr&)> func) {
     if ( iter ) {
+        TREE_COUNT(node_visits, 1);
         if ( iter->getLeft() ) {
+            unshare(iter->getLeft());
             traverseWithParent(iter->getLeft(), func);
             func(iter, iter->getLeft());
         }
         if ( iter->getRight() ) {
+            unshare(iter->getRight());
             traverseWithParent(iter->getRight(), func);
             func(iter, iter->getRight());
         }
     }
 }
 
-template<typename Element>
-unsigned int Tree<Element>::removeAll(const Element &el_to_remove) {
-    return removeAll([&](const Element &test_el) -> bool {
-        return el_to_remove == test_el;
-    });
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::removeAll(const Element &el_to_remove) {
+    return removeEqual(el_to_remove, number_of_elements);
+}
+
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::remove(const Element &el, unsigned int count) {
+    return removeEqual(el, count);
+}
+
+// Equal elements all lie in the subtree of the highest of them (they are
+// inserted to the left, rebalancing keeps them together), so removal by
+// value continues from the slot of the removed node instead of the root.
+template<typename Element, typename Compare>
+template<typename Probe>
+unsigned int Tree<Element, Compare>::removeEqual(const Probe &value, unsigned int count) {
+    invalidateFingers();
+    unsigned int removed = 0;
+    NodePtr* slot = &root;
+    // treap nodes above removed ones keep their subtree sizes
+    std::vector<Node*> ancestors;
+    std::vector<Node*> *path = balancing == TreeBalancing::Treap ? &ancestors : nullptr;
+    while ( removed < count && *(slot = &findUniqueSlot(*slot, value, path)) != nullptr ) {
+        unlinkNode(*slot);
+        removed++;
+        for (Node *ancestor : ancestors) {
+            ancestor->treapData()->subtree_size--;
+        }
+    }
+    number_of_elements -= removed;
+    if ( number_of_elements == 0 ) {
+        shape_tracking.height = shape_tracking.max_depth = 0;
+    }
+    scapegoatShrink();
+    return removed;
 }
 
-template<typename Element>
-unsigned int Tree<Element>::remove(const Element &el, unsigned int count) {
-    try {
-        unsigned int removed = 0;
-        return removeAll([&](const Element &test_el) -> bool {
-            if ( removed == count )
-                throw removed;
-            if ( test_el == el ) {
-                removed++;
-                return true;
+// Replaces node held by slot with one of its subtrees and reattaches the other one below it.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::unlinkNode(NodePtr& slot, bool promote_left) {
+    TREE_COUNT(node_visits, 1);
+    NodePtr node_to_remove = std::move(slot);
+    bool owned = node_to_remove.use_count() == 1;
+    NodePtr left = owned ? std::move(node_to_remove->getLeft()) : node_to_remove->getLeft();
+    NodePtr right = owned ? std::move(node_to_remove->getRight()) : node_to_remove->getRight();
+    if ( balancing == TreeBalancing::Treap ) {
+        if ( shape_tracking.enabled && left != nullptr && right != nullptr ) {
+            // joined spines interleave: nodes of one subtree go down at most
+            // by the spine of the other one, less the removed parent
+            shape_tracking.noteSubtreeMove(std::max(spineLength(left, false), spineLength(right, true)) - 1);
+        }
+        slot = joinNodes(std::move(left), std::move(right));
+        return;
+    }
+    if ( balancing == TreeBalancing::Scapegoat ) {
+        scapegoatUnlink(slot, std::move(left), std::move(right));
+        return;
+    }
+    NodePtr& promoted = promote_left ? left : right;
+    NodePtr& attached = promote_left ? right : left;
+    if ( promoted != nullptr ) {
+        slot = std::move(promoted);
+        if ( attached != nullptr ) {
+            // attached subtree was one level below slot
+            unsigned int depth = insertNode(slot, std::move(attached));
+            if ( shape_tracking.enabled ) {
+                shape_tracking.noteSubtreeMove(depth - 1);
             }
-            return false;
-        });
-    } catch (unsigned int i) {
-        return i;
+        }
+    } else {
+        slot = std::move(attached);
     }
 }
 
-template<typename Element>
-unsigned int Tree<Element>::countElements(ElementPredicate test_func) const {
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::countElements(ElementPredicate test_func) const {
     unsigned int i = 0;
     inOrderNodesTraverse([&](const NodePtr &node) {
         if ( test_func(node->getValue()) ) {
@@ -290,16 +978,30 @@ unsigned int Tree<Element>::countElements(ElementPredicate test_func) const {
     return i;
 }
 
-template<typename Element>
-unsigned int Tree<Element>::countElements(const Element &el) const {
-    return countElements([&](const Element& test_el) {
-        return test_el == el;
-    });
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::countElements(const Element &el) const {
+    return countElements(el, el);
 }
 
-template<typename Element>
-Tree<Element> Tree<Element>::makeElementsSubtree(ElementPredicate filterFunc) const {
-    Tree<Element> new_tree;
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::countElements(const Element &low, const Element &high) const {
+    return countInRange(low, high);
+}
+
+template<typename Element, typename Compare>
+template<typename Probe>
+unsigned int Tree<Element, Compare>::countInRange(const Probe &low, const Probe &high) const {
+    unsigned int i = 0;
+    std::function<void(Node*)> counter = [&](Node*) {
+        i++;
+    };
+    inRangeTraverseInner(root.get(), low, high, true, true, counter);
+    return i;
+}
+
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::makeElementsSubtree(ElementPredicate filterFunc) const {
+    Tree<Element, Compare> new_tree(balancing, compare);
     preLeftNodesTraverse([&](const NodePtr &node) {
         if ( filterFunc(node->getValue()) ) {
             new_tree.insert(node->getValue());
@@ -308,238 +1010,1300 @@ Tree<Element> Tree<Element>::makeElementsSubtree(ElementPredicate filterFunc) co
     return std::move(new_tree);
 }
 
-template<typename Element>
-Tree<Element> Tree<Element>::getSubtreeFromElement(const Element &el) const {
-    return Tree<Element>(findElement(el));
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::getSubtreeFromElement(const Element &el) const {
+    FingerTracking::noteSharing();
+    Tree<Element, Compare> subtree(findElement(el), compare);
+    subtree.balancing = balancing;
+    return subtree;
 }
 
-template<typename Element>
-Tree<Element> Tree<Element>::getSubtreeFromElement(ElementPredicate func) const {
-    return Tree<Element>(findElement(func));
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::getSubtreeFromElement(ElementPredicate func) const {
+    FingerTracking::noteSharing();
+    Tree<Element, Compare> subtree(findElement(func), compare);
+    subtree.balancing = balancing;
+    return subtree;
+}
+
+/// Splaying
+
+// Replaces node held by slot with its left or right child, keeping order.
+// Both nodes must be unshared.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::rotateUp(NodePtr& slot, bool left_child) {
+    NodePtr child = std::move(left_child ? slot->getLeft() : slot->getRight());
+    if ( left_child ) {
+        slot->getLeft() = std::move(child->getRight());
+        child->getRight() = std::move(slot);
+    } else {
+        slot->getRight() = std::move(child->getLeft());
+        child->getLeft() = std::move(slot);
+    }
+    slot = std::move(child);
+}
+
+// Moves node of the last slot of path to the first one; path[i + 1] is a
+// child slot of *path[i] and all nodes on path are unshared. The node must
+// differ from all its ancestors on path: a node rotated above an equal one
+// would leave it in the right subtree, where removal does not look for it.
+// For the same reason zig-zig over equal parent and grandparent is done as
+// two single rotations.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::splay(std::vector<NodePtr*> &path) {
+    while ( path.size() > 1 ) {
+        NodePtr *x = path[path.size() - 1], *p = path[path.size() - 2];
+        bool x_left = x == &(*p)->getLeft();
+        if ( path.size() == 2 ) {
+            rotateUp(*p, x_left);
+            break;
+        }
+        NodePtr *g = path[path.size() - 3];
+        bool p_left = p == &(*g)->getLeft();
+        if ( x_left == p_left && compare((*p)->getValue(), (*g)->getValue()) != 0 ) {
+            rotateUp(*g, p_left);
+            rotateUp(*g, x_left);
+        } else {
+            rotateUp(*p, x_left);
+            rotateUp(*g, p_left);
+        }
+        path.pop_back();
+        path.pop_back();
+    }
+}
+
+template<typename Element, typename Compare>
+bool Tree<Element, Compare>::splayFind(const Element &value) {
+    invalidateFingers();
+    std::vector<NodePtr*> path;
+    NodePtr* slot = &root;
+    while (*slot != nullptr) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        unshare(*slot);
+        path.push_back(slot);
+        int order = compare(value, (*slot)->getValue());
+        if ( order == 0 ) {
+            splay(path);
+            return true;
+        }
+        slot = order > 0 ? &(*slot)->getRight() : &(*slot)->getLeft();
+    }
+    return false;
+}
+
+// Inserted node is splayed unless it has an equal ancestor, then the
+// topmost equal element goes to the root instead.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::splayInsert(NodePtr inserted_node) {
+    invalidateFingers();
+    std::vector<NodePtr*> path;
+    size_t equal_at = 0;
+    bool has_equal = false;
+    NodePtr* slot = &root;
+    while (*slot != nullptr) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        unshare(*slot);
+        path.push_back(slot);
+        int order = compare(inserted_node->getValue(), (*slot)->getValue());
+        if ( order == 0 && !has_equal ) {
+            has_equal = true;
+            equal_at = path.size();
+        }
+        slot = order > 0 ? &(*slot)->getRight() : &(*slot)->getLeft();
+    }
+    if ( shape_tracking.enabled ) {
+        shape_tracking.noteInsert((unsigned int) path.size());
+    }
+    *slot = std::move(inserted_node);
+    path.push_back(slot);
+    number_of_elements++;
+    if ( has_equal ) {
+        path.resize(equal_at);
+    }
+    splay(path);
+}
+
+/// Treap, split and join
+
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::parallelLevels() {
+    unsigned int levels = 0;
+    for (unsigned int threads = std::thread::hardware_concurrency(); threads > 1; threads /= 2) {
+        levels++;
+    }
+    return levels;
+}
+
+// Counts nodes of two subtrees in turns until the smaller one is done,
+// size of the other one follows from total.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::countParts(const NodePtr &first, const NodePtr &second, unsigned int total,
+                                        unsigned int &first_count) {
+    std::vector<Node*> stacks[2];
+    unsigned int counts[2] = {0, 0};
+    const NodePtr *roots[] = {&first, &second};
+    for (int i = 0; i < 2; i++) {
+        if ( *roots[i] != nullptr ) {
+            stacks[i].push_back(roots[i]->get());
+        }
+    }
+    while ( true ) {
+        for (int i = 0; i < 2; i++) {
+            if ( stacks[i].empty() ) {
+                first_count = i == 0 ? counts[0] : total - counts[1];
+                return;
+            }
+            Node *node = stacks[i].back();
+            stacks[i].pop_back();
+            counts[i]++;
+            for (Node *child : {node->getLeft().get(), node->getRight().get()}) {
+                if ( child != nullptr ) {
+                    stacks[i].push_back(child);
+                }
+            }
+        }
+    }
+}
+
+// Goes down while nodes have higher priority, then splits the rest of the
+// path around the new node, so it is placed where rotations would bring it.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::treapInsert(NodePtr inserted_node) {
+    invalidateFingers();
+    uint32_t inserted_priority = priority(inserted_node);
+    NodePtr* slot = &root;
+    unsigned int depth = 0;
+    while (*slot != nullptr && priority(*slot) >= inserted_priority) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        unshare(*slot);
+        (*slot)->treapData()->subtree_size++;
+        slot = compare(inserted_node->getValue(), (*slot)->getValue()) > 0 ? &(*slot)->getRight() : &(*slot)->getLeft();
+        depth++;
+    }
+    splitNodes(std::move(*slot), inserted_node->getValue(), inserted_node->getLeft(), inserted_node->getRight());
+    recountSize(inserted_node.get());
+    *slot = std::move(inserted_node);
+    if ( shape_tracking.enabled ) {
+        shape_tracking.noteInsert(depth);
+    }
+    number_of_elements++;
+}
+
+// Elements not greater than key go to less_equal, so equal elements keep
+// lying on one search path. Nodes on the split path are unshared and get
+// their subtree sizes recounted bottom up.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::splitNodes(NodePtr subtree, const Element &key,
+                                        NodePtr &less_equal, NodePtr &greater) const {
+    NodePtr *less_slot = &less_equal, *greater_slot = &greater;
+    std::vector<Node*> path;
+    while ( subtree != nullptr ) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, 1);
+        unshare(subtree);
+        path.push_back(subtree.get());
+        if ( compare(subtree->getValue(), key) <= 0 ) {
+            NodePtr next = std::move(subtree->getRight());
+            *less_slot = std::move(subtree);
+            less_slot = &(*less_slot)->getRight();
+            subtree = std::move(next);
+        } else {
+            NodePtr next = std::move(subtree->getLeft());
+            *greater_slot = std::move(subtree);
+            greater_slot = &(*greater_slot)->getLeft();
+            subtree = std::move(next);
+        }
+    }
+    *less_slot = nullptr;
+    *greater_slot = nullptr;
+    for (auto node = path.rbegin(); node != path.rend(); ++node) {
+        recountSize(*node);
+    }
+}
+
+// Every element of less must be smaller than every element of greater.
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::joinNodes(NodePtr less, NodePtr greater) {
+    NodePtr joined;
+    NodePtr* slot = &joined;
+    std::vector<Node*> path;
+    while ( less != nullptr && greater != nullptr ) {
+        TREE_COUNT(node_visits, 1);
+        if ( priority(less) >= priority(greater) ) {
+            unshare(less);
+            path.push_back(less.get());
+            NodePtr next = std::move(less->getRight());
+            *slot = std::move(less);
+            slot = &(*slot)->getRight();
+            less = std::move(next);
+        } else {
+            unshare(greater);
+            path.push_back(greater.get());
+            NodePtr next = std::move(greater->getLeft());
+            *slot = std::move(greater);
+            slot = &(*slot)->getLeft();
+            greater = std::move(next);
+        }
+    }
+    *slot = less != nullptr ? std::move(less) : std::move(greater);
+    for (auto node = path.rbegin(); node != path.rend(); ++node) {
+        recountSize(*node);
+    }
+    return joined;
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::recountSizes(const NodePtr &subtree) {
+    std::vector<std::pair<Node*, bool>> stack;
+    if ( subtree != nullptr ) {
+        stack.push_back(std::make_pair(subtree.get(), false));
+    }
+    while ( !stack.empty() ) {
+        Node *node = stack.back().first;
+        if ( stack.back().second ) {
+            stack.pop_back();
+            recountSize(node);
+            continue;
+        }
+        stack.back().second = true;
+        for (Node *child : {node->getLeft().get(), node->getRight().get()}) {
+            if ( child != nullptr ) {
+                stack.push_back(std::make_pair(child, false));
+            }
+        }
+    }
+}
+
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::spineLength(const NodePtr &subtree, bool left) {
+    unsigned int length = 0;
+    for (Node *node = subtree.get(); node != nullptr; node = (left ? node->getLeft() : node->getRight()).get()) {
+        length++;
+    }
+    return length;
+}
+
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::uniteNodes(
+        NodePtr a, NodePtr b, unsigned int parallel_levels) const {
+    if ( a == nullptr ) {
+        return b;
+    }
+    if ( b == nullptr ) {
+        return a;
+    }
+    if ( priority(a) < priority(b) ) {
+        std::swap(a, b);
+    }
+    unshare(a);
+    NodePtr less_equal, greater;
+    splitNodes(std::move(b), a->getValue(), less_equal, greater);
+    NodePtr left = std::move(a->getLeft()), right = std::move(a->getRight());
+    if ( parallel_levels > 0 ) {
+        auto left_part = std::async(std::launch::async, [&]() {
+            return uniteNodes(std::move(left), std::move(less_equal), parallel_levels - 1);
+        });
+        a->getRight() = uniteNodes(std::move(right), std::move(greater), parallel_levels - 1);
+        a->getLeft() = left_part.get();
+    } else {
+        a->getLeft() = uniteNodes(std::move(left), std::move(less_equal), 0);
+        a->getRight() = uniteNodes(std::move(right), std::move(greater), 0);
+    }
+    recountSize(a.get());
+    return a;
+}
+
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::intersectNodes(
+        NodePtr a, NodePtr b, unsigned int parallel_levels) const {
+    if ( a == nullptr || b == nullptr ) {
+        return nullptr;
+    }
+    unshare(a);
+    NodePtr less_equal, greater;
+    splitNodes(std::move(b), a->getValue(), less_equal, greater);
+    bool found = false;
+    if ( less_equal != nullptr ) {
+        Node *max = less_equal.get();
+        while ( max->getRight() != nullptr ) {
+            max = max->getRight().get();
+        }
+        found = compare(max->getValue(), a->getValue()) == 0;
+    }
+    NodePtr left = std::move(a->getLeft()), right = std::move(a->getRight());
+    // rotations of treaps and scapegoat rebuilds leave elements equal to the
+    // root of a also in its right subtree, greater holds none of them
+    NodePtr right_equal;
+    if ( found ) {
+        NodePtr right_greater;
+        splitNodes(std::move(right), a->getValue(), right_equal, right_greater);
+        right = std::move(right_greater);
+    }
+    if ( parallel_levels > 0 ) {
+        auto left_part = std::async(std::launch::async, [&]() {
+            return intersectNodes(std::move(left), std::move(less_equal), parallel_levels - 1);
+        });
+        right = intersectNodes(std::move(right), std::move(greater), parallel_levels - 1);
+        left = left_part.get();
+    } else {
+        left = intersectNodes(std::move(left), std::move(less_equal), 0);
+        right = intersectNodes(std::move(right), std::move(greater), 0);
+    }
+    right = joinNodes(std::move(right_equal), std::move(right));
+    if ( !found ) {
+        return joinNodes(std::move(left), std::move(right));
+    }
+    a->getLeft() = std::move(left);
+    a->getRight() = std::move(right);
+    recountSize(a.get());
+    return a;
+}
+
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::split(const Element &key) {
+    invalidateFingers();
+    Tree<Element, Compare> greater(balancing, compare);
+    NodePtr less_equal;
+    splitNodes(std::move(root), key, less_equal, greater.root);
+    root = std::move(less_equal);
+    unsigned int kept = subtreeSize(root);
+    if ( balancing != TreeBalancing::Treap ) {
+        countParts(root, greater.root, number_of_elements, kept);
+    }
+    greater.number_of_elements = number_of_elements - kept;
+    number_of_elements = kept;
+    if ( number_of_elements == 0 ) {
+        shape_tracking.height = shape_tracking.max_depth = 0;
+    }
+    greater.max_size = max_size;
+    scapegoatShrink();
+    greater.scapegoatShrink();
+    return greater;
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::join(Tree greater) {
+    if ( greater.root == nullptr ) {
+        return;
+    }
+    if ( balancing == TreeBalancing::Treap && greater.balancing != TreeBalancing::Treap ) {
+        greater = treapCopy(greater);
+    }
+    invalidateFingers();
+    unsigned int less_spine = 0, greater_spine = 0;
+    if ( root != nullptr ) {
+        Node *max = root.get(), *min = greater.root.get();
+        for (less_spine = 1; max->getRight() != nullptr; less_spine++) {
+            max = max->getRight().get();
+        }
+        for (greater_spine = 1; min->getLeft() != nullptr; greater_spine++) {
+            min = min->getLeft().get();
+        }
+        if ( compare(max->getValue(), min->getValue()) >= 0 ) {
+            throw std::string("Joined tree must hold only greater elements.");
+        }
+    }
+    if ( shape_tracking.enabled ) {
+        // nodes of one tree go down at most by the joined spine of the other one
+        unsigned int greater_depth = greater.shape_tracking.enabled ? greater.shape_tracking.max_depth
+                                                                    : greater.stats().max_depth;
+        unsigned int depth = root == nullptr ? greater_depth
+                                             : std::max(shape_tracking.max_depth + greater_spine,
+                                                        greater_depth + less_spine);
+        shape_tracking.max_depth = depth;
+        shape_tracking.height = depth + 1;
+    }
+    root = joinNodes(std::move(root), std::move(greater.root));
+    number_of_elements += greater.number_of_elements;
+    max_size = std::max(max_size, number_of_elements);
+}
+
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::unite(const Tree &a, const Tree &b) {
+    if ( a.balancing == TreeBalancing::Treap && b.balancing != TreeBalancing::Treap ) {
+        // subtrees of b may be taken over whole, so they need treap nodes
+        return unite(a, treapCopy(b));
+    }
+    FingerTracking::noteSharing();
+    Tree<Element, Compare> result(a.balancing, a.compare);
+    result.root = a.uniteNodes(a.root, b.root, parallelLevels());
+    result.number_of_elements = a.number_of_elements + b.number_of_elements;
+    result.max_size = result.number_of_elements;
+    return result;
+}
+
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::intersect(const Tree &a, const Tree &b) {
+    FingerTracking::noteSharing();
+    Tree<Element, Compare> result(a.intersectNodes(a.root, b.root, parallelLevels()), a.compare);
+    result.balancing = a.balancing;
+    result.max_size = result.number_of_elements;
+    return result;
+}
+
+// Expected O(n log n), insertions keep equal elements on one search path.
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::treapCopy(const Tree &tree) {
+    Tree<Element, Compare> copy(TreeBalancing::Treap, tree.compare);
+    tree.inOrderTraverse([&](const Element &el) {
+        copy.insert(el);
+    });
+    return copy;
+}
+
+/// Scapegoat rebuilding
+
+// floor(log_{3/2}(size)), deepest allowed depth of a node.
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::scapegoatDepthLimit(unsigned int size) {
+    unsigned int limit = 0;
+    for (double reach = 1.5; reach <= size; reach *= 1.5) {
+        limit++;
+    }
+    return limit;
+}
+
+template<typename Element, typename Compare>
+unsigned int Tree<Element, Compare>::countNodes(const NodePtr &subtree) {
+    unsigned int count = 0;
+    std::vector<Node*> stack;
+    if ( subtree != nullptr ) {
+        stack.push_back(subtree.get());
+    }
+    while ( !stack.empty() ) {
+        Node *node = stack.back();
+        stack.pop_back();
+        count++;
+        for (Node *child : {node->getLeft().get(), node->getRight().get()}) {
+            if ( child != nullptr ) {
+                stack.push_back(child);
+            }
+        }
+    }
+    return count;
+}
+
+// New node at the end of the finger is deeper than the limit: sizes are
+// counted up its path until a node whose child holds more than 2/3 of its
+// elements, and subtree of that node is rebuilt perfectly balanced.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::scapegoatRebalance(Finger &finger) {
+    std::vector<typename Finger::Level> &path = finger.path;
+    unsigned int child_size = 1;
+    for (size_t level = path.size() - 1; level > 0; level--) {
+        Node *parent = path[level - 1].node, *child = path[level].node;
+        bool left_child = parent->getLeft().get() == child;
+        unsigned int size = child_size + 1 + countNodes(left_child ? parent->getRight() : parent->getLeft());
+        if ( 3 * child_size > 2 * size || level == 1 ) {
+            Node *grandparent = level > 1 ? path[level - 2].node : nullptr;
+            NodePtr &slot = grandparent == nullptr ? root :
+                            grandparent->getLeft().get() == parent ? grandparent->getLeft() : grandparent->getRight();
+            rebuildBalanced(slot, size);
+            return;
+        }
+        child_size = size;
+    }
+}
+
+// Replaces removed node with its successor, unlike promotion of a whole
+// subtree this never makes paths longer.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::scapegoatUnlink(NodePtr& slot, NodePtr left, NodePtr right) {
+    if ( left == nullptr || right == nullptr ) {
+        slot = left != nullptr ? std::move(left) : std::move(right);
+        return;
+    }
+    NodePtr* successor_slot = &right;
+    unshare(*successor_slot);
+    while ( (*successor_slot)->getLeft() != nullptr ) {
+        TREE_COUNT(node_visits, 1);
+        successor_slot = &(*successor_slot)->getLeft();
+        unshare(*successor_slot);
+    }
+    NodePtr successor = std::move(*successor_slot);
+    *successor_slot = std::move(successor->getRight());
+    successor->getLeft() = std::move(left);
+    successor->getRight() = std::move(right);
+    slot = std::move(successor);
+}
+
+// Rebuilds the whole tree once it lost a third of its largest size.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::scapegoatShrink() {
+    if ( balancing != TreeBalancing::Scapegoat ) {
+        return;
+    }
+    if ( 3 * number_of_elements < 2 * max_size ) {
+        invalidateFingers();
+        rebuildBalanced(root, number_of_elements);
+        max_size = number_of_elements;
+    }
+}
+
+// Day-Stout-Warren rebuild in place, O(size) time and O(1) extra memory:
+// right rotations turn the subtree into a vine of right children, then
+// rounds of left rotations along the vine fold it into a complete tree.
+// Every node is unshared on the way, clones take the place of shared ones.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::rebuildBalanced(NodePtr& subtree, unsigned int size) {
+    NodePtr* slot = &subtree;
+    while ( *slot != nullptr ) {
+        TREE_COUNT(node_visits, 1);
+        unshare(*slot);
+        if ( (*slot)->getLeft() != nullptr ) {
+            unshare((*slot)->getLeft());
+            rotateUp(*slot, true);
+        } else {
+            slot = &(*slot)->getRight();
+        }
+    }
+    // nodes below the last full level first, then halves of the rest
+    unsigned int full = 0;
+    while ( 2 * full + 1 <= size ) {
+        full = 2 * full + 1;
+    }
+    foldVine(subtree, size - full);
+    for (unsigned int spine = full / 2; spine > 0; spine /= 2) {
+        foldVine(subtree, spine);
+    }
+}
+
+// Rotates every other node of the right spine above its predecessor,
+// count times, halving that part of the spine.
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::foldVine(NodePtr& vine, unsigned int count) {
+    NodePtr* slot = &vine;
+    for (unsigned int i = 0; i < count; i++) {
+        TREE_COUNT(node_visits, 1);
+        rotateUp(*slot, false);
+        slot = &(*slot)->getRight();
+    }
+}
+
+/// Statistics
+
+template<typename Element, typename Compare>
+TreeStats Tree<Element, Compare>::stats() const {
+    TreeStats result;
+    result.size = number_of_elements;
+
+    // Post order with explicit stack: node is visited on the way down to
+    // record its depth and again on the way up, when heights of both
+    // subtrees are on top of heights stack (right one above left one).
+    struct Frame {
+        Node* node;
+        unsigned int depth;
+        bool expanded;
+    };
+    std::vector<Frame> path;
+    std::vector<unsigned int> heights;
+    uint64_t depth_sum = 0;
+    unsigned int nodes = 0;
+    if ( root != nullptr ) {
+        path.push_back(Frame{root.get(), 0, false});
+    }
+    while ( !path.empty() ) {
+        Frame frame = path.back();
+        Node* left = frame.node->getLeft().get();
+        Node* right = frame.node->getRight().get();
+        if ( !frame.expanded ) {
+            path.back().expanded = true;
+            if ( result.depth_histogram.size() <= frame.depth ) {
+                result.depth_histogram.resize(frame.depth + 1, 0);
+            }
+            result.depth_histogram[frame.depth]++;
+            depth_sum += frame.depth;
+            nodes++;
+            if ( left == nullptr && right == nullptr ) {
+                result.leaf_count++;
+            }
+            if ( right != nullptr ) {
+                path.push_back(Frame{right, frame.depth + 1, false});
+            }
+            if ( left != nullptr ) {
+                path.push_back(Frame{left, frame.depth + 1, false});
+            }
+            continue;
+        }
+        path.pop_back();
+        unsigned int right_height = 0, left_height = 0;
+        if ( right != nullptr ) {
+            right_height = heights.back();
+            heights.pop_back();
+        }
+        if ( left != nullptr ) {
+            left_height = heights.back();
+            heights.pop_back();
+        }
+        heights.push_back(1 + (left_height > right_height ? left_height : right_height));
+        result.balance_factors[(int) right_height - (int) left_height]++;
+    }
+
+    result.height = (unsigned int) result.depth_histogram.size();
+    result.max_depth = result.height == 0 ? 0 : result.height - 1;
+    result.average_depth = nodes == 0 ? 0.0 : (double) depth_sum / nodes;
+    // make_shared places node next to its control block (vtable and two
+    // counters); heap adds a header word and rounds up to two words
+    size_t node_size = balancing == TreeBalancing::Treap ? sizeof(TreapNode) : sizeof(ElementNode);
+    size_t block = node_size + sizeof(void*) + 2 * sizeof(int) + sizeof(void*);
+    block = (block + 2 * sizeof(void*) - 1) / (2 * sizeof(void*)) * (2 * sizeof(void*));
+    result.node_bytes = node_size * nodes;
+    result.allocator_overhead = (block - node_size) * nodes;
+    return result;
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::trackShape(bool enabled) {
+    if ( enabled ) {
+        TreeStats exact = stats();
+        shape_tracking.height = exact.height;
+        shape_tracking.max_depth = exact.max_depth;
+    }
+    shape_tracking.enabled = enabled;
+}
+
+// Walks both versions breadth first, one level of each in turn, and stops
+// at nodes already reached from the other version: such node roots a shared
+// subtree. When a side has expanded a node before the other side reached it
+// (shared subtree moved deeper), the expanded part is claimed back as shared.
+// Nodes left expanded on one side only are paired by element afterwards;
+// pairs at equal depths are copies made by copy on write.
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodesDiff Tree<Element, Compare>::diffNodes(
+        const NodePtr &before,
+        const NodePtr &after,
+        const Compare &compare
+) {
+    typedef std::pair<Node*, unsigned int> Entry;
+    struct Side {
+        std::vector<Entry> level;
+        std::unordered_map<Node*, unsigned int> seen;
+        std::unordered_set<Node*> expanded;
+        std::unordered_set<Node*> claimed;
+    };
+
+    NodesDiff diff;
+    if ( before == after ) {
+        return diff;
+    }
+    Side sides[2];
+    const NodePtr *roots[] = {&before, &after};
+    for (int i = 0; i < 2; i++) {
+        if ( *roots[i] != nullptr ) {
+            sides[i].level.push_back(Entry(roots[i]->get(), 0));
+            sides[i].seen[roots[i]->get()] = 0;
+        }
+    }
+
+    auto claim = [](Side &side, Node *shared) {
+        std::vector<Node*> stack(1, shared);
+        while ( !stack.empty() ) {
+            Node *node = stack.back();
+            stack.pop_back();
+            side.claimed.insert(node);
+            if ( side.expanded.count(node) != 0 ) {
+                for (Node *child : {node->getLeft().get(), node->getRight().get()}) {
+                    if ( child != nullptr ) {
+                        stack.push_back(child);
+                    }
+                }
+            }
+        }
+    };
+    auto step = [&](int current) {
+        Side &side = sides[current], &other = sides[1 - current];
+        std::vector<Entry> next;
+        for (const Entry &entry : side.level) {
+            Node *node = entry.first;
+            if ( side.claimed.count(node) != 0 ) {
+                continue;
+            }
+            diff.examined++;
+            auto found = other.seen.find(node);
+            if ( found != other.seen.end() ) {
+                claim(other, node);
+                if ( found->second != entry.second ) {
+                    unsigned int depths[2];
+                    depths[current] = entry.second;
+                    depths[1 - current] = found->second;
+                    diff.moved.push_back(NodeMove{node, node, depths[0], depths[1], true});
+                }
+                continue;
+            }
+            side.expanded.insert(node);
+            for (Node *child : {node->getLeft().get(), node->getRight().get()}) {
+                if ( child != nullptr ) {
+                    next.push_back(Entry(child, entry.second + 1));
+                    side.seen[child] = entry.second + 1;
+                }
+            }
+        }
+        side.level.swap(next);
+    };
+    while ( !sides[0].level.empty() || !sides[1].level.empty() ) {
+        step(0);
+        step(1);
+    }
+
+    std::vector<Entry> changed[2];
+    for (int i = 0; i < 2; i++) {
+        for (Node *node : sides[i].expanded) {
+            if ( sides[i].claimed.count(node) == 0 ) {
+                changed[i].push_back(Entry(node, sides[i].seen[node]));
+            }
+        }
+        std::sort(changed[i].begin(), changed[i].end(), [&](const Entry &a, const Entry &b) {
+            int order = compare(a.first->getValue(), b.first->getValue());
+            return order != 0 ? order < 0 : a.second < b.second;
+        });
+    }
+    size_t i = 0, j = 0;
+    while ( i < changed[0].size() || j < changed[1].size() ) {
+        int order = i == changed[0].size() ? 1 : j == changed[1].size() ? -1 :
+                    compare(changed[0][i].first->getValue(), changed[1][j].first->getValue());
+        if ( order < 0 ) {
+            diff.removed.push_back(changed[0][i++].first);
+        } else if ( order > 0 ) {
+            diff.added.push_back(changed[1][j++].first);
+        } else {
+            if ( changed[0][i].second != changed[1][j].second ) {
+                diff.moved.push_back(NodeMove{changed[0][i].first, changed[1][j].first,
+                                              changed[0][i].second, changed[1][j].second, false});
+            }
+            i++;
+            j++;
+        }
+    }
+    return diff;
+}
+
+template<typename Element, typename Compare>
+TreeDiff<Element> Tree<Element, Compare>::diff(const Tree &before, const Tree &after) {
+    NodesDiff nodes = diffNodes(before.root, after.root, after.compare);
+    TreeDiff<Element> result;
+    for (Node *node : nodes.added) {
+        result.added.push_back(node->getValue());
+    }
+    for (Node *node : nodes.removed) {
+        result.removed.push_back(node->getValue());
+    }
+    for (const NodeMove &move : nodes.moved) {
+        result.moved.push_back(typename TreeDiff<Element>::Move{move.after->getValue(), move.old_depth,
+                                                               move.new_depth, move.subtree});
+    }
+    result.examined_nodes = nodes.examined;
+    return result;
+}
+
+/// Serialization
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::serialize(std::ostream &out, bool with_shape) const {
+    TreeWriter writer(out);
+    writer.writeBytes(TreeFormat::MAGIC, sizeof(TreeFormat::MAGIC));
+    writer.writeValue<uint16_t>(TreeFormat::VERSION);
+    writer.writeValue<uint16_t>(with_shape ? TreeFormat::WITH_SHAPE : 0);
+    writer.writeValue<uint64_t>(number_of_elements);
+
+    std::vector<Node*> path;
+    if ( with_shape && root != nullptr ) {
+        unsigned char bits = 0;
+        unsigned int used_bits = 0;
+        path.push_back(root.get());
+        while ( !path.empty() ) {
+            Node* node = path.back();
+            path.pop_back();
+            bits |= (node->getLeft() != nullptr) << used_bits;
+            bits |= (node->getRight() != nullptr) << (used_bits + 1);
+            used_bits += 2;
+            if ( used_bits == 8 ) {
+                writer.writeBytes(&bits, 1);
+                bits = 0;
+                used_bits = 0;
+            }
+            if ( node->getRight() != nullptr ) {
+                path.push_back(node->getRight().get());
+            }
+            if ( node->getLeft() != nullptr ) {
+                path.push_back(node->getLeft().get());
+            }
+        }
+        if ( used_bits != 0 ) {
+            writer.writeBytes(&bits, 1);
+        }
+    }
+
+    Node* iter = root.get();
+    while ( iter != nullptr || !path.empty() ) {
+        while ( iter != nullptr ) {
+            path.push_back(iter);
+            iter = iter->getLeft().get();
+        }
+        iter = path.back();
+        path.pop_back();
+        ElementCodec<Element>::write(writer, iter->getValue());
+        iter = iter->getRight().get();
+    }
+    writer.writeChecksum();
+    writer.flush();
+}
+
+template<typename Element, typename Compare>
+Tree<Element, Compare> Tree<Element, Compare>::deserialize(std::istream &in, Compare compare) {
+    TreeReader reader(in);
+    char magic[sizeof(TreeFormat::MAGIC)];
+    reader.readBytes(magic, sizeof(magic));
+    if ( std::memcmp(magic, TreeFormat::MAGIC, sizeof(magic)) != 0 ) {
+        throw std::string("Not a tree data.");
+    }
+    if ( reader.readValue<uint16_t>() != TreeFormat::VERSION ) {
+        throw std::string("Unsupported tree format version.");
+    }
+    uint16_t flags = reader.readValue<uint16_t>();
+    uint64_t count = reader.readValue<uint64_t>();
+    if ( count > std::numeric_limits<unsigned int>::max() ) {
+        throw std::string("Too many elements in tree data.");
+    }
+
+    Tree<Element, Compare> tree(compare);
+    if ( flags & TreeFormat::WITH_SHAPE ) {
+        std::vector<unsigned char> shape;
+        reader.readGrowing(shape, (2 * count + 7) / 8);
+        tree.root = tree.loadShaped(reader, shape, count);
+    } else {
+        Node* previous = nullptr;
+        tree.root = tree.loadBalanced(reader, count, previous);
+    }
+    tree.number_of_elements = (unsigned int) count;
+    reader.verifyChecksum();
+    return tree;
+}
+
+// Consumes count elements in order; middle element becomes subtree root.
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::loadBalanced(
+        TreeReader &reader,
+        uint64_t count,
+        Node *&previous
+) const {
+    if ( count == 0 ) {
+        return nullptr;
+    }
+    uint64_t left_count = (count - 1) / 2;
+    NodePtr left = loadBalanced(reader, left_count, previous);
+    NodePtr node = loadNode(reader, std::move(left), previous);
+    node->getRight() = loadBalanced(reader, count - 1 - left_count, previous);
+    return node;
+}
+
+// Rebuilds nodes in pre order from shape bits while elements arrive in order,
+// with explicit stack, so degenerate shapes do not exhaust call stack.
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::loadShaped(
+        TreeReader &reader,
+        const std::vector<unsigned char> &shape,
+        uint64_t count
+) const {
+    enum Stage { BeforeLeft, BeforeRight };
+    struct Frame {
+        bool has_left;
+        bool has_right;
+        Stage stage;
+        NodePtr node;
+    };
+
+    uint64_t next_bits = 0;
+    auto nextFrame = [&]() -> Frame {
+        if ( next_bits == count ) {
+            throw std::string("Tree shape does not match elements count.");
+        }
+        unsigned char bits = (unsigned char) (shape[(size_t) (next_bits / 4)] >> (2 * (next_bits % 4)));
+        next_bits++;
+        return Frame{(bits & 1) != 0, (bits & 2) != 0, BeforeLeft, nullptr};
+    };
+
+    if ( count == 0 ) {
+        return nullptr;
+    }
+    Node* previous = nullptr;
+    NodePtr completed;
+    std::vector<Frame> frames(1, nextFrame());
+    while ( !frames.empty() ) {
+        Frame &frame = frames.back();
+        if ( frame.stage == BeforeLeft ) {
+            frame.stage = BeforeRight;
+            if ( frame.has_left ) {
+                frames.push_back(nextFrame());
+                continue;
+            }
+            completed = nullptr;
+        }
+        if ( frame.node == nullptr ) {
+            frame.node = loadNode(reader, std::move(completed), previous);
+            if ( frame.has_right ) {
+                frames.push_back(nextFrame());
+                continue;
+            }
+            completed = nullptr;
+        }
+        frame.node->getRight() = std::move(completed);
+        completed = std::move(frame.node);
+        frames.pop_back();
+    }
+    if ( next_bits != count ) {
+        throw std::string("Tree shape does not match elements count.");
+    }
+    return completed;
+}
+
+template<typename Element, typename Compare>
+typename Tree<Element, Compare>::NodePtr Tree<Element, Compare>::loadNode(
+        TreeReader &reader,
+        NodePtr left,
+        Node *&previous
+) const {
+    NodePtr node = std::make_shared<ElementNode>(ElementCodec<Element>::read(reader), std::move(left), nullptr);
+    TREE_COUNT(comparisons, previous != nullptr);
+    if ( previous != nullptr && compare(previous->getValue(), node->getValue()) > 0 ) {
+        throw std::string("Tree elements are not in order.");
+    }
+    previous = node.get();
+    return node;
 }
 
 /// Traversals
 
-template<typename Element>
-void Tree<Element>::preLeftTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preLeftTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) {
+    invalidateFingers();
+    unshare(root);
+    preLeftNodesTraverse([&](NodePtr &node) {
+        func(node->getValue());
+    }, stopCondition, true);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preLeftTraverse(ConstElementsTraverseFunc func, ElementPredicate stopCondition) const {
     preLeftNodesTraverse([&](NodePtr &node) {
         func(node->getValue());
     }, stopCondition);
 }
 
-template<typename Element>
-void Tree<Element>::postLeftTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postLeftTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) {
+    invalidateFingers();
+    unshare(root);
+    postLeftNodesTraverse([&](NodePtr &node) {
+        func(node->getValue());
+    }, stopCondition, true);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postLeftTraverse(ConstElementsTraverseFunc func, ElementPredicate stopCondition) const {
     postLeftNodesTraverse([&](NodePtr &node) {
         func(node->getValue());
     }, stopCondition);
 }
 
-template<typename Element>
-void Tree<Element>::preRightTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preRightTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) {
+    invalidateFingers();
+    unshare(root);
+    preRightNodesTraverse([&](NodePtr &node) {
+        func(node->getValue());
+    }, stopCondition, true);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preRightTraverse(ConstElementsTraverseFunc func, ElementPredicate stopCondition) const {
     preRightNodesTraverse([&](NodePtr &node) {
         func(node->getValue());
     }, stopCondition);
 }
 
-template<typename Element>
-void Tree<Element>::postRightTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postRightTraverse(ElementsTraverseFunc func, ElementPredicate stopCondition) {
+    invalidateFingers();
+    unshare(root);
+    postRightNodesTraverse([&](NodePtr &node) {
+        func(node->getValue());
+    }, stopCondition, true);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postRightTraverse(ConstElementsTraverseFunc func, ElementPredicate stopCondition) const {
     postRightNodesTraverse([&](NodePtr &node) {
         func(node->getValue());
     }, stopCondition);
 }
 
-template<typename Element>
-void Tree<Element>::preLeftNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preLeftNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition,
+                                                  bool clone_shared) const {
     ConditionWrapper condition(stopCondition);
-    preLeftTraverseInner(root, func, condition);
+    preLeftTraverseInner(root, func, condition, clone_shared);
 }
 
-template<typename Element>
-void Tree<Element>::postLeftNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postLeftNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition,
+                                                   bool clone_shared) const {
     ConditionWrapper condition(stopCondition);
-    postLeftTraverseInner(root, func, condition);
+    postLeftTraverseInner(root, func, condition, clone_shared);
 }
 
-template<typename Element>
-void Tree<Element>::preRightNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preRightNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition,
+                                                   bool clone_shared) const {
     ConditionWrapper condition(stopCondition);
-    preRightTraverseInner(root, func, condition);
+    preRightTraverseInner(root, func, condition, clone_shared);
 }
 
-template<typename Element>
-void Tree<Element>::postRightNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postRightNodesTraverse(NodesTraverseFunc func, ElementPredicate stopCondition,
+                                                    bool clone_shared) const {
     ConditionWrapper condition(stopCondition);
-    postRightTraverseInner(root, func, condition);
+    postRightTraverseInner(root, func, condition, clone_shared);
 }
 
-template<typename Element>
-void Tree<Element>::preLeftTraverseInner(NodePtr currentNode,
-                                         NodesTraverseFunc func,
-                                         ConditionWrapper& stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preLeftTraverseInner(NodePtr currentNode,
+                                                  NodesTraverseFunc func,
+                                                  ConditionWrapper& stopCondition,
+                                                  bool clone_shared) const {
     if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
         func(currentNode);
         if ( !stopCondition(currentNode->getValue()) ) {
-            preLeftTraverseInner(currentNode->getLeft(), func, stopCondition);
-            preLeftTraverseInner(currentNode->getRight(), func, stopCondition);
+            preLeftTraverseInner(traversedChild(currentNode->getLeft(), clone_shared), func, stopCondition,
+                                 clone_shared);
+            preLeftTraverseInner(traversedChild(currentNode->getRight(), clone_shared), func, stopCondition,
+                                 clone_shared);
         }
     }
 }
 
-template<typename Element>
-void Tree<Element>::postLeftTraverseInner(NodePtr currentNode,
-                                          NodesTraverseFunc func,
-                                          ConditionWrapper& stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postLeftTraverseInner(NodePtr currentNode,
+                                                   NodesTraverseFunc func,
+                                                   ConditionWrapper& stopCondition,
+                                                   bool clone_shared) const {
     if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
         if ( !stopCondition.isAlreadyStopped() ) {
-            postLeftTraverseInner(currentNode->getLeft(), func, stopCondition);
-            postLeftTraverseInner(currentNode->getRight(), func, stopCondition);
+            postLeftTraverseInner(traversedChild(currentNode->getLeft(), clone_shared), func, stopCondition,
+                                  clone_shared);
+            postLeftTraverseInner(traversedChild(currentNode->getRight(), clone_shared), func, stopCondition,
+                                  clone_shared);
             stopCondition(currentNode->getValue());
         }
         func(currentNode);
     }
 }
 
-template<typename Element>
-void Tree<Element>::preRightTraverseInner(NodePtr currentNode,
-                                          NodesTraverseFunc func,
-                                          ConditionWrapper& stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::preRightTraverseInner(NodePtr currentNode,
+                                                   NodesTraverseFunc func,
+                                                   ConditionWrapper& stopCondition,
+                                                   bool clone_shared) const {
     if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
         func(currentNode);
         if ( !stopCondition(currentNode->getValue()) ) {
-            preRightTraverseInner(currentNode->getRight(), func, stopCondition);
-            preRightTraverseInner(currentNode->getLeft(), func, stopCondition);
+            preRightTraverseInner(traversedChild(currentNode->getRight(), clone_shared), func, stopCondition,
+                                  clone_shared);
+            preRightTraverseInner(traversedChild(currentNode->getLeft(), clone_shared), func, stopCondition,
+                                  clone_shared);
         }
     }
 }
 
-template<typename Element>
-void Tree<Element>::postRightTraverseInner(NodePtr currentNode,
-                                           NodesTraverseFunc func,
-                                           ConditionWrapper& stopCondition) const {
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::postRightTraverseInner(NodePtr currentNode,
+                                                    NodesTraverseFunc func,
+                                                    ConditionWrapper& stopCondition,
+                                                    bool clone_shared) const {
     if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
         if ( !stopCondition.isAlreadyStopped() ) {
-            postRightTraverseInner(currentNode->getRight(), func, stopCondition);
-            postRightTraverseInner(currentNode->getLeft(), func, stopCondition);
+            postRightTraverseInner(traversedChild(currentNode->getRight(), clone_shared), func, stopCondition,
+                                   clone_shared);
+            postRightTraverseInner(traversedChild(currentNode->getLeft(), clone_shared), func, stopCondition,
+                                   clone_shared);
             stopCondition(currentNode->getValue());
         }
         func(currentNode);
     }
 }
 
-template<typename Element>
-void Tree<Element>::inOrderTraverse(
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOrderTraverse(
         ElementsTraverseFunc func,
         ElementPredicate stopCondition
+) {
+    invalidateFingers();
+    unshare(root);
+    inOrderNodesTraverse([&](NodePtr &node) {
+        func(node->getValue());
+    }, stopCondition, true);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOrderTraverse(
+        ConstElementsTraverseFunc func,
+        ElementPredicate stopCondition
 ) const {
     inOrderNodesTraverse([&](NodePtr &node) {
         func(node->getValue());
     }, stopCondition);
 }
 
-template<typename Element>
-void Tree<Element>::inOppositeOrderTraverse(
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOppositeOrderTraverse(
         ElementsTraverseFunc func,
         ElementPredicate stopCondition
+) {
+    invalidateFingers();
+    unshare(root);
+    inOppositeOrderNodesTraverse([&](NodePtr &node) {
+        func(node->getValue());
+    }, stopCondition, true);
+}
+
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOppositeOrderTraverse(
+        ConstElementsTraverseFunc func,
+        ElementPredicate stopCondition
 ) const {
     inOppositeOrderNodesTraverse([&](NodePtr &node) {
         func(node->getValue());
     }, stopCondition);
 }
 
-template<typename Element>
-void Tree<Element>::inOrderNodesTraverse(
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOrderNodesTraverse(
         NodesTraverseFunc func,
-        ElementPredicate stopCondition
+        ElementPredicate stopCondition,
+        bool clone_shared
 ) const {
     ConditionWrapper condition(stopCondition);
-    inOrderTraverseInner(root, func, condition);
+    inOrderTraverseInner(root, func, condition, clone_shared);
 }
 
-template<typename Element>
-void Tree<Element>::inOppositeOrderNodesTraverse(
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOppositeOrderNodesTraverse(
         NodesTraverseFunc func,
-        ElementPredicate stopCondition
+        ElementPredicate stopCondition,
+        bool clone_shared
 ) const {
     ConditionWrapper condition(stopCondition);
-    inOppositeOrderTraverseInner(root, func, condition);
+    inOppositeOrderTraverseInner(root, func, condition, clone_shared);
 }
 
-template<typename Element>
-void Tree<Element>::inOrderTraverseInner(
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOrderTraverseInner(
         NodePtr currentNode,
         NodesTraverseFunc func,
-        ConditionWrapper& stopCondition
+        ConditionWrapper& stopCondition,
+        bool clone_shared
 ) const {
     if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
         if ( !stopCondition.isAlreadyStopped() ) {
-            inOrderTraverseInner(currentNode->getLeft(), func, stopCondition);
+            inOrderTraverseInner(traversedChild(currentNode->getLeft(), clone_shared), func, stopCondition,
+                                 clone_shared);
         }
         if ( !stopCondition(currentNode->getValue()) ) {
             func(currentNode);
-            inOrderTraverseInner(currentNode->getRight(), func, stopCondition);
+            inOrderTraverseInner(traversedChild(currentNode->getRight(), clone_shared), func, stopCondition,
+                                 clone_shared);
         }
     }
 }
 
-template<typename Element>
-void Tree<Element>::inOppositeOrderTraverseInner(
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inOppositeOrderTraverseInner(
         NodePtr currentNode,
         NodesTraverseFunc func,
-        ConditionWrapper& stopCondition
+        ConditionWrapper& stopCondition,
+        bool clone_shared
 ) const {
     if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
         if ( !stopCondition(currentNode->getValue()) ) {
-            inOppositeOrderTraverseInner(currentNode->getRight(), func, stopCondition);
+            inOppositeOrderTraverseInner(traversedChild(currentNode->getRight(), clone_shared), func, stopCondition,
+                                         clone_shared);
         }
         if ( !stopCondition.isAlreadyStopped() ) {
             func(currentNode);
-            inOppositeOrderTraverseInner(currentNode->getLeft(), func, stopCondition);
+            inOppositeOrderTraverseInner(traversedChild(currentNode->getLeft(), clone_shared), func, stopCondition,
+                                         clone_shared);
         }
     }
 }
 
-template<typename Element>
-void Tree<Element>::removeNode(NodePtr node_to_remove, NodePtr parent_node) {
-    if ( parent_node == nullptr ) {
-        removeRoot();
-    }
-    if ( node_to_remove == parent_node->getRight()) {
-        removeRightNode(node_to_remove, parent_node);
-    } else {
-        removeLeftNode(node_to_remove, parent_node);
-    }
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inRangeTraverse(
+        const Element &low,
+        const Element &high,
+        ElementsTraverseFunc func
+) {
+    invalidateFingers();
+    unshare(root);
+    std::function<void(Node*)> visit = [&](Node* node) {
+        func(node->getValue());
+    };
+    inRangeTraverseInner(root.get(), low, high, true, true, visit, true);
 }
 
-template<typename Element>
-void Tree<Element>::removeRightNode(NodePtr node_to_remove, NodePtr parent_node) {
-    if ( node_to_remove->getRight() != nullptr ) {
-        *parent_node >> node_to_remove->getRight();
-        insertNode(parent_node->getRight(), node_to_remove->getLeft());
-    } else {
-        *parent_node >> node_to_remove->getLeft();
-    }
+template<typename Element, typename Compare>
+void Tree<Element, Compare>::inRangeTraverse(
+        const Element &low,
+        const Element &high,
+        ConstElementsTraverseFunc func
+) const {
+    std::function<void(Node*)> visit = [&](Node* node) {
+        func(node->getValue());
+    };
+    inRangeTraverseInner(root.get(), low, high, true, true, visit);
 }
 
-template<typename Element>
-void Tree<Element>::removeLeftNode(NodePtr node_to_remove, NodePtr parent_node) {
-    if ( node_to_remove->getLeft() != nullptr ) {
-        *parent_node << node_to_remove->getLeft();
-        insertNode(parent_node->getLeft(), node_to_remove->getRight());
-    } else {
-        *parent_node << node_to_remove->getRight();
+// Subtrees are pruned by one comparison against each bound that is still
+// relevant: once a node is known to be inside of the interval on some side
+// its left (or right) subtree no longer needs that bound checked.
+template<typename Element, typename Compare>
+template<typename Probe>
+void Tree<Element, Compare>::inRangeTraverseInner(
+        Node* currentNode,
+        const Probe &low,
+        const Probe &high,
+        bool check_low,
+        bool check_high,
+        std::function<void(Node*)>& func,
+        bool clone_shared
+) const {
+    if (currentNode != nullptr) {
+        TREE_COUNT(node_visits, 1);
+        TREE_COUNT(comparisons, check_low + check_high);
+        int low_order = check_low ? compare(currentNode->getValue(), low) : 1;
+        int high_order = check_high ? compare(currentNode->getValue(), high) : -1;
+        if ( low_order >= 0 ) {
+            inRangeTraverseInner(traversedChild(currentNode->getLeft(), clone_shared).get(), low, high,
+                                 check_low, high_order > 0, func, clone_shared);
+        }
+        if ( low_order >= 0 && high_order <= 0 ) {
+            func(currentNode);
+        }
+        if ( high_order <= 0 ) {
+            inRangeTraverseInner(traversedChild(currentNode->getRight(), clone_shared).get(), low, high,
+                                 low_order < 0, check_high, func, clone_shared);
+        }
     }
 }
 
-
-template<typename Element>
-void Tree<Element>::removeRoot() {
-    if ( root->getRight() == nullptr ) {
-        root = root->getLeft();
-    } else {
-        insertNode(root, root->getLeft());
-        root = root->getRight();
-    }
-}
+#include "PersistentTree.h"
 
 #endif //BINARY_TREE_TREE_H
 
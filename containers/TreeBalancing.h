@@ -0,0 +1,41 @@
+#ifndef BINARY_TREE_TREEBALANCING_H
+#define BINARY_TREE_TREEBALANCING_H
+
+#include <cstdint>
+
+// Shape policy of Tree, chosen at construction and kept by copies.
+enum class TreeBalancing {
+    // plain binary search tree, shape follows insertion order
+    None,
+    // successful isMember and insert splay the found or inserted node to
+    // the root (amortized O(log n), hot elements stay near the root); only
+    // lookups of a non-const tree splay, const ones leave the shape alone
+    Splay,
+    // randomized balancing, expected depth O(log n); nodes are heap ordered
+    // by a random priority given at creation, which copies made by copy on
+    // write keep, and hold sizes of their subtrees, so split and join are
+    // expected O(log n); only nodes of treaps carry these 8 bytes, nodes
+    // of other trees joined or united into a treap are copied first
+    Treap,
+    // nodes are plain element nodes without balance data, the tree keeps
+    // only its largest size: an insertion deeper than log_{3/2}(size)
+    // rebuilds the subtree of the lowest ancestor holding more than 2/3 of
+    // its elements in one child, and the whole tree is rebuilt after it
+    // shrinks below 2/3 of its largest size; rebuilds rotate the nodes in
+    // place in linear time, so updates are amortized O(log n) and depth stays
+    // O(log n) in the worst case; join and set operations link trees
+    // without rebalancing
+    Scapegoat,
+};
+
+// Priority of a new treap node from its address, see TreeBalancing::Treap.
+// A value hash would need no storage, but equal elements would get one
+// priority and form a chain lengthening every path through it.
+inline uint64_t treapPriority(const void *node) {
+    uint64_t value = (uint64_t) (uintptr_t) node;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+#endif //BINARY_TREE_TREEBALANCING_H
@@ -0,0 +1,50 @@
+#ifndef BINARY_TREE_TREECOUNTERS_H
+#define BINARY_TREE_TREECOUNTERS_H
+
+#include <cstdint>
+
+// Per thread cost counters of Tree operations.
+//
+// Compiled in only when BINARY_TREE_COUNTERS is defined (cmake option of
+// the same name); otherwise TREE_COUNT expands to nothing and
+// treeCounters() always returns zeros. Every translation unit of a program
+// must be built with the same setting.
+struct TreeCounters {
+    // element comparisons done by searches, insertions, removals and range scans
+    uint64_t comparisons = 0;
+    // nodes entered by searches, insertions, removals and traversals
+    uint64_t node_visits = 0;
+    // nodes allocated, including copies made by copy on write
+    uint64_t allocations = 0;
+};
+
+#ifdef BINARY_TREE_COUNTERS
+
+inline TreeCounters &threadTreeCounters() {
+    static thread_local TreeCounters counters;
+    return counters;
+}
+
+#define TREE_COUNT(counter, amount) (threadTreeCounters().counter += (amount))
+
+inline TreeCounters treeCounters() {
+    return threadTreeCounters();
+}
+
+inline void resetTreeCounters() {
+    threadTreeCounters() = TreeCounters();
+}
+
+#else
+
+#define TREE_COUNT(counter, amount) ((void) 0)
+
+inline TreeCounters treeCounters() {
+    return TreeCounters();
+}
+
+inline void resetTreeCounters() { }
+
+#endif
+
+#endif //BINARY_TREE_TREECOUNTERS_H
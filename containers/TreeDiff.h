@@ -0,0 +1,33 @@
+#ifndef BINARY_TREE_TREEDIFF_H
+#define BINARY_TREE_TREEDIFF_H
+
+#include <cstddef>
+#include <vector>
+
+// Difference between two versions of a tree computed by Tree::diff().
+// Depth of root is 0.
+template<typename Element>
+struct TreeDiff {
+    struct Move {
+        Element element;
+        unsigned int old_depth;
+        unsigned int new_depth;
+        // whole subtree rooted at element is shared and was re-attached at new depth
+        bool subtree;
+    };
+
+    // elements of the later version missing in the earlier one, in order
+    std::vector<Element> added;
+    // elements of the earlier version missing in the later one, in order
+    std::vector<Element> removed;
+    // elements present in both versions at different depths
+    std::vector<Move> moved;
+    // nodes compared, proportional to the changed region when versions share nodes
+    size_t examined_nodes = 0;
+
+    bool empty() const {
+        return added.empty() && removed.empty() && moved.empty();
+    }
+};
+
+#endif //BINARY_TREE_TREEDIFF_H
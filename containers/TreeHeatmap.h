@@ -0,0 +1,51 @@
+#ifndef BINARY_TREE_TREEHEATMAP_H
+#define BINARY_TREE_TREEHEATMAP_H
+
+#include <atomic>
+#include <cstdint>
+
+// Per node access counters of Tree lookups, drawn by TreeGraphBuilder as
+// heatmap.
+//
+// Counters live in nodes only when BINARY_TREE_HEATMAP is defined (cmake
+// option of the same name); at run time Tree::sampleAccesses(period) makes
+// every period-th lookup of a thread add one to every node on its search
+// path, period 0 (default) turns counting off. Without the macro nodes
+// have no counters and sampling does nothing. Every translation unit of a
+// program must be built with the same setting.
+
+#ifdef BINARY_TREE_HEATMAP
+
+// Relaxed atomic, so concurrent readers of one tree may count safely.
+class NodeAccessCounter {
+public:
+    NodeAccessCounter() : value(0) { }
+
+    void hit() {
+        value.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint32_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+    void set(uint32_t accesses) {
+        value.store(accesses, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> value;
+};
+
+inline bool sampleTreeAccess(unsigned int period) {
+    static thread_local unsigned int lookups = 0;
+    return period != 0 && ++lookups % period == 0;
+}
+
+#else
+
+inline bool sampleTreeAccess(unsigned int) {
+    return false;
+}
+
+#endif
+
+#endif //BINARY_TREE_TREEHEATMAP_H
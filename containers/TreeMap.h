@@ -0,0 +1,227 @@
+#ifndef BINARY_TREE_TREEMAP_H
+#define BINARY_TREE_TREEMAP_H
+
+#include <functional>
+#include <utility>
+
+#include "Tree.h"
+
+// Ordered key -> value containers on top of Tree nodes.
+// Only keys take part in comparisons; values are stored next to the key
+// in the same node and are never copied or compared while descending.
+//
+// Maps take the balancing policy of their tree, unbalanced by default.
+// operator[], tryEmplace and insertOrAssign search from the root without
+// fingers, so each costs O(depth). Keys arriving in sorted order
+// (timestamps, counters) turn an unbalanced tree into a list and make every
+// one of them O(size); pass TreeBalancing::Treap or Scapegoat for such keys.
+// Splay maps are balanced by inserts only, lookups of maps do not splay.
+
+template<typename Key, typename Value>
+struct TreeMapEntry {
+    template<typename... Args>
+    TreeMapEntry(const Key &key, Args&&... args) : key(key), value(std::forward<Args>(args)...) { }
+
+    Key key;
+    Value value;
+};
+
+template<typename Key, typename Value, typename KeyCompare>
+struct TreeMapEntryCompare {
+    typedef TreeMapEntry<Key, Value> Entry;
+
+    TreeMapEntryCompare(KeyCompare compare = KeyCompare()) : compare(compare) { }
+
+    int operator()(const Entry &a, const Entry &b) const {
+        return compare(a.key, b.key);
+    }
+
+    int operator()(const Key &a, const Entry &b) const {
+        return compare(a, b.key);
+    }
+
+    int operator()(const Entry &a, const Key &b) const {
+        return compare(a.key, b);
+    }
+
+    KeyCompare compare;
+};
+
+template<typename Key, typename Value, typename KeyCompare>
+class TreeMapBase {
+public:
+    typedef std::function<void(const Key &, const Value &)> EntriesTraverseFunc;
+
+    // clones nodes shared with copies on the way, so writes through the
+    // result stay in this map
+    Value* find(const Key &key);
+    const Value* find(const Key &key) const;
+    bool isMember(const Key &key) const {
+        return tree.findSlot(tree.root, key) != nullptr;
+    }
+    // number of entries with keys from closed interval [low, high]
+    unsigned int countElements(const Key &low, const Key &high) const {
+        return tree.countInRange(low, high);
+    }
+    unsigned int size() const {
+        return tree.size();
+    }
+    TreeBalancing balancingPolicy() const {
+        return tree.balancingPolicy();
+    }
+    TreeStats stats() const {
+        return tree.stats();
+    }
+    void clear() {
+        tree.clear();
+    }
+
+    void inOrderTraverse(EntriesTraverseFunc) const;
+    void inOppositeOrderTraverse(EntriesTraverseFunc) const;
+    void inRangeTraverse(const Key &low, const Key &high, EntriesTraverseFunc) const;
+
+protected:
+    typedef TreeMapEntry<Key, Value> Entry;
+    typedef TreeMapEntryCompare<Key, Value, KeyCompare> EntryCompare;
+    typedef Tree<Entry, EntryCompare> EntryTree;
+    typedef typename EntryTree::NodePtr NodePtr;
+
+    TreeMapBase(TreeBalancing balancing, KeyCompare compare) : tree(balancing, EntryCompare(compare)) { }
+
+    EntryTree tree;
+};
+
+template<typename Key, typename Value, typename KeyCompare = ThreeWayCompare<Key>>
+class TreeMap : public TreeMapBase<Key, Value, KeyCompare> {
+public:
+    TreeMap(KeyCompare compare = KeyCompare()) : Base(TreeBalancing::None, compare) { }
+    explicit TreeMap(TreeBalancing balancing, KeyCompare compare = KeyCompare()) : Base(balancing, compare) { }
+
+    // inserts default constructed value when key is absent
+    Value& operator[](const Key &key);
+    // constructs value from args only when key is absent, returns whether it was inserted
+    template<typename... Args>
+    bool tryEmplace(const Key &key, Args&&... args);
+    // returns true when new entry was inserted, false when existing value was replaced
+    bool insertOrAssign(const Key &key, Value value);
+    bool remove(const Key &key) {
+        return this->tree.removeEqual(key, 1) == 1;
+    }
+
+private:
+    typedef TreeMapBase<Key, Value, KeyCompare> Base;
+    typedef typename Base::Entry Entry;
+    typedef typename Base::NodePtr NodePtr;
+
+    template<typename... Args>
+    std::pair<Entry*, bool> emplaceUnique(const Key &key, Args&&... args);
+};
+
+template<typename Key, typename Value, typename KeyCompare = ThreeWayCompare<Key>>
+class TreeMultiMap : public TreeMapBase<Key, Value, KeyCompare> {
+public:
+    typedef typename TreeMapBase<Key, Value, KeyCompare>::EntriesTraverseFunc EntriesTraverseFunc;
+
+    TreeMultiMap(KeyCompare compare = KeyCompare()) : Base(TreeBalancing::None, compare) { }
+    explicit TreeMultiMap(TreeBalancing balancing, KeyCompare compare = KeyCompare()) : Base(balancing, compare) { }
+
+    void insert(const Key &key, Value value) {
+        this->tree.insertNewNode(this->tree.makeNode(Entry(key, std::move(value))));
+    }
+    unsigned int countElements(const Key &key) const {
+        return this->tree.countInRange(key, key);
+    }
+    unsigned int countElements(const Key &low, const Key &high) const {
+        return Base::countElements(low, high);
+    }
+    unsigned int removeAll(const Key &key) {
+        return this->tree.removeEqual(key, this->tree.size());
+    }
+    unsigned int remove(const Key &key, unsigned int count = 1) {
+        return this->tree.removeEqual(key, count);
+    }
+    // traverses all values stored under provided key
+    void equalRangeTraverse(const Key &key, EntriesTraverseFunc func) const {
+        this->inRangeTraverse(key, key, func);
+    }
+
+private:
+    typedef TreeMapBase<Key, Value, KeyCompare> Base;
+    typedef typename Base::Entry Entry;
+    typedef typename Base::NodePtr NodePtr;
+};
+
+template<typename Key, typename Value, typename KeyCompare>
+Value* TreeMapBase<Key, Value, KeyCompare>::find(const Key &key) {
+    tree.invalidateFingers();
+    NodePtr &slot = tree.findUniqueSlot(tree.root, key);
+    return slot != nullptr ? &slot->getValue().value : nullptr;
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+const Value* TreeMapBase<Key, Value, KeyCompare>::find(const Key &key) const {
+    auto slot = tree.findSlot(tree.root, key);
+    return slot != nullptr ? &(*slot)->getValue().value : nullptr;
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+void TreeMapBase<Key, Value, KeyCompare>::inOrderTraverse(EntriesTraverseFunc func) const {
+    tree.inOrderTraverse([&](const Entry &entry) {
+        func(entry.key, entry.value);
+    });
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+void TreeMapBase<Key, Value, KeyCompare>::inOppositeOrderTraverse(EntriesTraverseFunc func) const {
+    tree.inOppositeOrderTraverse([&](const Entry &entry) {
+        func(entry.key, entry.value);
+    });
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+void TreeMapBase<Key, Value, KeyCompare>::inRangeTraverse(const Key &low,
+                                                          const Key &high,
+                                                          EntriesTraverseFunc func) const {
+    std::function<void(typename EntryTree::Node*)> visit = [&](typename EntryTree::Node* node) {
+        func(node->getValue().key, node->getValue().value);
+    };
+    tree.inRangeTraverseInner(tree.root.get(), low, high, true, true, visit);
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+template<typename... Args>
+std::pair<typename TreeMap<Key, Value, KeyCompare>::Entry*, bool>
+TreeMap<Key, Value, KeyCompare>::emplaceUnique(const Key &key, Args&&... args) {
+    this->tree.invalidateFingers();
+    NodePtr& slot = this->tree.findUniqueSlot(this->tree.root, key);
+    if ( slot != nullptr ) {
+        return std::make_pair(&slot->getValue(), false);
+    }
+    // balancing may move the new node, but never clones it
+    NodePtr node = this->tree.makeNode(Entry(key, std::forward<Args>(args)...));
+    Entry *entry = &node->getValue();
+    this->tree.insertNewNode(std::move(node));
+    return std::make_pair(entry, true);
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+Value& TreeMap<Key, Value, KeyCompare>::operator[](const Key &key) {
+    return emplaceUnique(key).first->value;
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+template<typename... Args>
+bool TreeMap<Key, Value, KeyCompare>::tryEmplace(const Key &key, Args&&... args) {
+    return emplaceUnique(key, std::forward<Args>(args)...).second;
+}
+
+template<typename Key, typename Value, typename KeyCompare>
+bool TreeMap<Key, Value, KeyCompare>::insertOrAssign(const Key &key, Value value) {
+    auto result = emplaceUnique(key, std::move(value));
+    if ( !result.second ) {
+        result.first->value = std::move(value);
+    }
+    return result.second;
+}
+
+#endif //BINARY_TREE_TREEMAP_H
@@ -0,0 +1,223 @@
+#ifndef BINARY_TREE_TREESERIALIZATION_H
+#define BINARY_TREE_TREESERIALIZATION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Binary tree file format, all integers are little endian:
+//
+//   magic       4 bytes  "BTRE"
+//   version     uint16   TreeFormat::VERSION
+//   flags       uint16   TreeFormat::WITH_SHAPE
+//   count       uint64   number of elements
+//   shape       2 bits per node in pre order (has left, has right),
+//               only when WITH_SHAPE flag is set, padded to whole bytes
+//   elements    count elements in order, encoded by ElementCodec
+//   checksum    uint64   FNV-1a of all preceding bytes
+//
+// Format errors are reported by throwing std::string, as everywhere in Tree.
+
+namespace TreeFormat {
+    static const char MAGIC[4] = {'B', 'T', 'R', 'E'};
+    static const uint16_t VERSION = 1;
+    static const uint16_t WITH_SHAPE = 1;
+}
+
+class TreeWriter {
+public:
+    TreeWriter(std::ostream &out) : out(out), checksum(FNV_OFFSET) {
+        buffer.reserve(BUFFER_SIZE);
+    }
+
+    void writeBytes(const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            checksum = (checksum ^ bytes[i]) * FNV_PRIME;
+        }
+        if ( buffer.size() + size > BUFFER_SIZE ) {
+            flush();
+        }
+        if ( size > BUFFER_SIZE ) {
+            out.write(reinterpret_cast<const char *>(bytes), size);
+        } else {
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+    }
+
+    // Writes value of arithmetic type in little endian byte order.
+    template<typename T>
+    void writeValue(T value) {
+        static_assert(std::is_arithmetic<T>::value, "only arithmetic values have fixed layout");
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        toLittleEndian(bytes, sizeof(T));
+        writeBytes(bytes, sizeof(T));
+    }
+
+    // Appends checksum of everything written so far.
+    void writeChecksum() {
+        writeValue<uint64_t>(checksum);
+    }
+
+    // Must be called after last write.
+    void flush() {
+        if ( !buffer.empty() ) {
+            out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+            buffer.clear();
+        }
+        if ( !out ) {
+            throw std::string("Failed to write tree.");
+        }
+    }
+
+    static void toLittleEndian(unsigned char *bytes, size_t size) {
+        const uint16_t probe = 1;
+        if ( *reinterpret_cast<const unsigned char *>(&probe) != 1 ) {
+            for (size_t i = 0; i < size / 2; i++) {
+                std::swap(bytes[i], bytes[size - 1 - i]);
+            }
+        }
+    }
+
+private:
+    static const size_t BUFFER_SIZE = 1 << 16;
+    static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+    static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    friend class TreeReader;
+
+    std::ostream &out;
+    std::vector<unsigned char> buffer;
+    uint64_t checksum;
+};
+
+// Reads through the buffer of the stream instead of a read ahead buffer of
+// its own, so the stream is left right after the consumed data, whether it
+// is seekable or not (pipes, sockets), and several trees or log records may
+// be read from one stream one after another.
+class TreeReader {
+public:
+    TreeReader(std::istream &in) : in(in.rdbuf()), checksum(TreeWriter::FNV_OFFSET) {
+        if ( this->in == nullptr ) {
+            throw std::string("Tree stream has no buffer.");
+        }
+    }
+
+    void readBytes(void *data, size_t size) {
+        unsigned char *bytes = static_cast<unsigned char *>(data);
+        if ( (size_t) in->sgetn(reinterpret_cast<char *>(bytes), (std::streamsize) size) != size ) {
+            throw std::string("Unexpected end of tree data.");
+        }
+        for (size_t i = 0; i < size; i++) {
+            checksum = (checksum ^ bytes[i]) * TreeWriter::FNV_PRIME;
+        }
+    }
+
+    template<typename T>
+    T readValue() {
+        static_assert(std::is_arithmetic<T>::value, "only arithmetic values have fixed layout");
+        unsigned char bytes[sizeof(T)];
+        readBytes(bytes, sizeof(T));
+        TreeWriter::toLittleEndian(bytes, sizeof(T));
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    // Reads size bytes into the end of container of bytes, growing it only
+    // as data arrives, so a corrupted size ends in "Unexpected end of tree
+    // data." rather than in a huge allocation.
+    template<typename Container>
+    void readGrowing(Container &container, uint64_t size) {
+        if ( size > container.max_size() - container.size() ) {
+            throw std::string("Tree data size is out of range.");
+        }
+        uint64_t left = size;
+        while ( left != 0 ) {
+            size_t chunk = (size_t) std::min<uint64_t>(left, (uint64_t) CHUNK_SIZE);
+            size_t offset = container.size();
+            container.resize(offset + chunk);
+            readBytes(&container[offset], chunk);
+            left -= chunk;
+        }
+    }
+
+    // Reads stored checksum and compares it with checksum of bytes read
+    // since construction or previous verified checksum.
+    void verifyChecksum() {
+        uint64_t expected = checksum;
+        if ( readValue<uint64_t>() != expected ) {
+            throw std::string("Tree checksum mismatch.");
+        }
+        checksum = TreeWriter::FNV_OFFSET;
+    }
+
+    // True when stream has no more data, consumes nothing.
+    bool atEnd() {
+        return in->sgetc() == std::char_traits<char>::eof();
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 16;
+
+    std::streambuf *in;
+    uint64_t checksum;
+};
+
+// Element encoding. Specialize for own element types:
+//   static void write(TreeWriter &, const T &);
+//   static T read(TreeReader &);
+template<typename T, typename Enable = void>
+struct ElementCodec;
+
+template<typename T>
+struct ElementCodec<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    static void write(TreeWriter &writer, const T &value) {
+        writer.writeValue(value);
+    }
+
+    static T read(TreeReader &reader) {
+        return reader.readValue<T>();
+    }
+};
+
+template<typename Char, typename Traits, typename Allocator>
+struct ElementCodec<std::basic_string<Char, Traits, Allocator>> {
+    typedef std::basic_string<Char, Traits, Allocator> String;
+
+    static void write(TreeWriter &writer, const String &value) {
+        writer.writeValue<uint64_t>(value.size());
+        if ( sizeof(Char) == 1 ) {
+            writer.writeBytes(value.data(), value.size());
+        } else {
+            for (auto c : value) {
+                writer.writeValue(c);
+            }
+        }
+    }
+
+    static String read(TreeReader &reader) {
+        uint64_t size = reader.readValue<uint64_t>();
+        String value;
+        if ( sizeof(Char) == 1 ) {
+            reader.readGrowing(value, size);
+        } else {
+            if ( size > value.max_size() ) {
+                throw std::string("Tree data size is out of range.");
+            }
+            for (uint64_t i = 0; i < size; i++) {
+                value.push_back(reader.readValue<Char>());
+            }
+        }
+        return value;
+    }
+};
+
+#endif //BINARY_TREE_TREESERIALIZATION_H
@@ -0,0 +1,56 @@
+#ifndef BINARY_TREE_TREESTATS_H
+#define BINARY_TREE_TREESTATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Shape of a tree computed by Tree::stats(). Depth of root is 0.
+struct TreeStats {
+    unsigned int size = 0;
+    // number of levels, 0 for empty tree
+    unsigned int height = 0;
+    unsigned int max_depth = 0;
+    double average_depth = 0;
+    // number of nodes at every depth
+    std::vector<unsigned int> depth_histogram;
+    unsigned int leaf_count = 0;
+    // height of right subtree minus height of left one -> number of such nodes
+    std::map<int, unsigned int> balance_factors;
+    // memory taken by nodes themselves, memory owned by elements is not included
+    size_t node_bytes = 0;
+    // estimated reference counting and heap bookkeeping per node, in total
+    size_t allocator_overhead = 0;
+};
+
+// Cheap shape watch maintained while Tree::trackShape is on. height and
+// max_depth only grow: insert notes depth of the new node, removal that
+// hangs a subtree deeper moves them down by as many levels, as the subtree
+// reached at most max_depth before. Removals that shorten paths leave them
+// as they are; trackShape(true) lowers them back to exact values.
+struct TreeShapeTracking {
+    bool enabled = false;
+    unsigned int height = 0;
+    unsigned int max_depth = 0;
+    uint64_t inserts = 0;
+    uint64_t insert_depth_sum = 0;
+
+    void noteInsert(unsigned int depth) {
+        if ( depth + 1 > height ) {
+            height = depth + 1;
+            max_depth = depth;
+        }
+        inserts++;
+        insert_depth_sum += depth;
+    }
+    void noteSubtreeMove(unsigned int levels_down) {
+        height += levels_down;
+        max_depth += levels_down;
+    }
+    double averageInsertDepth() const {
+        return inserts == 0 ? 0.0 : (double) insert_depth_sum / inserts;
+    }
+};
+
+#endif //BINARY_TREE_TREESTATS_H
@@ -0,0 +1,364 @@
+// Tree and HashIndexedTree against standard containers on identical workloads.
+//
+// Usage: container_comparison_benchmark [elements]
+// Runs bulk load, random lookups (half of them miss), range scans, churn
+// (remove one element, insert another), full traversal, then prints a
+// table with time of every workload, resident memory per element after the
+// load and peak resident memory. Every container runs in its own forked
+// process, so peak memory of one does not hide the others. Keys come from
+// a fixed seed and the containers must agree on checksums of every
+// workload, otherwise the program fails.
+
+#include "Tree.h"
+#include "HashIndexedTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const unsigned int SEED = 42;
+static const size_t RANGES = 1000;
+
+struct Results {
+    double load_ms = 0;
+    double lookup_ms = 0;
+    double range_ms = -1;
+    double churn_ms = 0;
+    double traverse_ms = 0;
+    double bytes_per_element = 0;
+    double peak_rss_mb = 0;
+    uint64_t lookup_checksum = 0;
+    uint64_t range_checksum = 0;
+    uint64_t traverse_checksum = 0;
+};
+
+// Same keys and operations for every container.
+struct Workload {
+    explicit Workload(size_t elements) {
+        mt19937 generator(SEED);
+        uniform_int_distribution<int> key(0, INT32_MAX);
+        for (size_t i = 0; i < elements; i++) {
+            keys.push_back(key(generator));
+        }
+        probes = keys;
+        for (size_t i = 0; i < elements; i += 2) {
+            probes[i] = key(generator);
+        }
+        shuffle(probes.begin(), probes.end(), generator);
+        for (size_t i = 0; i < RANGES; i++) {
+            int low = key(generator);
+            ranges.push_back(make_pair(low, low + (int) min<int64_t>(INT32_MAX - low, INT32_MAX / 1000)));
+        }
+        // sorted vector pays a move of half of the array per operation
+        size_t churn_count = max<size_t>(elements / 100, 1);
+        for (size_t i = 0; i < churn_count; i++) {
+            churn_removed.push_back(keys[generator() % elements]);
+            churn_inserted.push_back(key(generator));
+        }
+    }
+
+    vector<int> keys;
+    vector<int> probes;
+    vector<pair<int, int>> ranges;
+    vector<int> churn_removed;
+    vector<int> churn_inserted;
+};
+
+struct TreeAdapter {
+    static const char *name() { return "Tree"; }
+    static const bool ordered = true;
+
+    void load(const vector<int> &keys) {
+        for (int key : keys) {
+            tree.insert(key);
+        }
+    }
+    bool contains(int key) const { return tree.isMember(key); }
+    uint64_t rangeSum(int low, int high) const {
+        uint64_t sum = 0;
+        tree.inRangeTraverse(low, high, [&](const int &key) { sum += key; });
+        return sum;
+    }
+    void eraseOne(int key) { tree.remove(key); }
+    void insert(int key) { tree.insert(key); }
+    uint64_t traverseSum() const {
+        uint64_t sum = 0;
+        tree.inOrderTraverse([&](const int &key) { sum += key; });
+        return sum;
+    }
+
+    Tree<int> tree;
+};
+
+struct HashIndexedTreeAdapter {
+    static const char *name() { return "HashIndexedTree"; }
+    static const bool ordered = true;
+
+    void load(const vector<int> &keys) {
+        for (int key : keys) {
+            tree.insert(key);
+        }
+    }
+    bool contains(int key) const { return tree.isMember(key); }
+    uint64_t rangeSum(int low, int high) const {
+        uint64_t sum = 0;
+        tree.inRangeTraverse(low, high, [&](const int &key) { sum += key; });
+        return sum;
+    }
+    void eraseOne(int key) { tree.remove(key); }
+    void insert(int key) { tree.insert(key); }
+    uint64_t traverseSum() const {
+        uint64_t sum = 0;
+        tree.inOrderTraverse([&](const int &key) { sum += key; });
+        return sum;
+    }
+
+    HashIndexedTree<int> tree;
+};
+
+struct MultisetAdapter {
+    static const char *name() { return "std::multiset"; }
+    static const bool ordered = true;
+
+    void load(const vector<int> &keys) { set.insert(keys.begin(), keys.end()); }
+    bool contains(int key) const { return set.find(key) != set.end(); }
+    uint64_t rangeSum(int low, int high) const {
+        uint64_t sum = 0;
+        for (auto it = set.lower_bound(low), end = set.upper_bound(high); it != end; ++it) {
+            sum += *it;
+        }
+        return sum;
+    }
+    void eraseOne(int key) {
+        auto it = set.find(key);
+        if ( it != set.end() ) {
+            set.erase(it);
+        }
+    }
+    void insert(int key) { set.insert(key); }
+    uint64_t traverseSum() const {
+        uint64_t sum = 0;
+        for (int key : set) {
+            sum += key;
+        }
+        return sum;
+    }
+
+    multiset<int> set;
+};
+
+struct UnorderedMultisetAdapter {
+    static const char *name() { return "std::unordered_multiset"; }
+    static const bool ordered = false;
+
+    void load(const vector<int> &keys) { set.insert(keys.begin(), keys.end()); }
+    bool contains(int key) const { return set.find(key) != set.end(); }
+    uint64_t rangeSum(int, int) const { return 0; }
+    void eraseOne(int key) {
+        auto it = set.find(key);
+        if ( it != set.end() ) {
+            set.erase(it);
+        }
+    }
+    void insert(int key) { set.insert(key); }
+    uint64_t traverseSum() const {
+        uint64_t sum = 0;
+        for (int key : set) {
+            sum += key;
+        }
+        return sum;
+    }
+
+    unordered_multiset<int> set;
+};
+
+struct SortedVectorAdapter {
+    static const char *name() { return "sorted std::vector"; }
+    static const bool ordered = true;
+
+    void load(const vector<int> &keys) {
+        elements = keys;
+        sort(elements.begin(), elements.end());
+    }
+    bool contains(int key) const { return binary_search(elements.begin(), elements.end(), key); }
+    uint64_t rangeSum(int low, int high) const {
+        uint64_t sum = 0;
+        for (auto it = lower_bound(elements.begin(), elements.end(), low), end = elements.end();
+             it != end && *it <= high; ++it) {
+            sum += *it;
+        }
+        return sum;
+    }
+    void eraseOne(int key) {
+        auto it = lower_bound(elements.begin(), elements.end(), key);
+        if ( it != elements.end() && *it == key ) {
+            elements.erase(it);
+        }
+    }
+    void insert(int key) { elements.insert(upper_bound(elements.begin(), elements.end(), key), key); }
+    uint64_t traverseSum() const {
+        uint64_t sum = 0;
+        for (int key : elements) {
+            sum += key;
+        }
+        return sum;
+    }
+
+    vector<int> elements;
+};
+
+static double millisecondsSince(chrono::steady_clock::time_point begin) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+}
+
+static size_t residentBytes() {
+    long pages = 0, resident = 0;
+    if ( FILE *statm = fopen("/proc/self/statm", "r") ) {
+        if ( fscanf(statm, "%ld %ld", &pages, &resident) != 2 ) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static size_t peakResidentBytes() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t) usage.ru_maxrss * 1024;
+}
+
+template<typename Container>
+Results measure(size_t elements) {
+    Results results;
+    Workload workload(elements);
+    size_t baseline = residentBytes();
+    Container container;
+
+    auto begin = chrono::steady_clock::now();
+    container.load(workload.keys);
+    results.load_ms = millisecondsSince(begin);
+    results.bytes_per_element = (double) (residentBytes() - baseline) / elements;
+
+    begin = chrono::steady_clock::now();
+    for (int probe : workload.probes) {
+        results.lookup_checksum += container.contains(probe);
+    }
+    results.lookup_ms = millisecondsSince(begin);
+
+    if ( Container::ordered ) {
+        begin = chrono::steady_clock::now();
+        for (auto &range : workload.ranges) {
+            results.range_checksum += container.rangeSum(range.first, range.second);
+        }
+        results.range_ms = millisecondsSince(begin);
+    }
+
+    begin = chrono::steady_clock::now();
+    for (size_t i = 0; i < workload.churn_removed.size(); i++) {
+        container.eraseOne(workload.churn_removed[i]);
+        container.insert(workload.churn_inserted[i]);
+    }
+    results.churn_ms = millisecondsSince(begin);
+
+    begin = chrono::steady_clock::now();
+    results.traverse_checksum = container.traverseSum();
+    results.traverse_ms = millisecondsSince(begin);
+
+    results.peak_rss_mb = (double) (peakResidentBytes() - baseline) / (1024 * 1024);
+    return results;
+}
+
+// Runs measure in a child process and returns its results through a pipe.
+template<typename Container>
+bool measureIsolated(size_t elements, Results &results) {
+    int channel[2];
+    if ( pipe(channel) != 0 ) {
+        return false;
+    }
+    pid_t child = fork();
+    if ( child < 0 ) {
+        return false;
+    }
+    if ( child == 0 ) {
+        close(channel[0]);
+        Results measured = measure<Container>(elements);
+        bool written = write(channel[1], &measured, sizeof(measured)) == (ssize_t) sizeof(measured);
+        _exit(written ? 0 : 1);
+    }
+    close(channel[1]);
+    bool received = read(channel[0], &results, sizeof(results)) == (ssize_t) sizeof(results);
+    close(channel[0]);
+    int status;
+    waitpid(child, &status, 0);
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void printHeader() {
+    printf("%-24s %10s %10s %10s %10s %10s %10s %12s\n", "container", "load ms", "lookup ms", "range ms",
+           "churn ms", "scan ms", "B/element", "peak RSS MB");
+}
+
+// Prints results of the container and checks them against the reference
+// one, or makes them the reference.
+template<typename Container>
+bool compare(size_t elements, Results &reference, bool is_reference) {
+    Results results;
+    if ( !measureIsolated<Container>(elements, results) ) {
+        fprintf(stderr, "%s: measurement failed\n", Container::name());
+        return false;
+    }
+    char range[16] = "-";
+    if ( results.range_ms >= 0 ) {
+        snprintf(range, sizeof(range), "%.2f", results.range_ms);
+    }
+    printf("%-24s %10.2f %10.2f %10s %10.2f %10.2f %10.1f %12.1f\n", Container::name(), results.load_ms,
+           results.lookup_ms, range, results.churn_ms, results.traverse_ms, results.bytes_per_element,
+           results.peak_rss_mb);
+    fflush(stdout);
+
+    if ( is_reference ) {
+        reference = results;
+        return true;
+    }
+    bool agree = results.lookup_checksum == reference.lookup_checksum &&
+                 results.traverse_checksum == reference.traverse_checksum &&
+                 (!Container::ordered || results.range_checksum == reference.range_checksum);
+    if ( !agree ) {
+        fprintf(stderr, "%s disagrees with %s on results of workloads\n", Container::name(), TreeAdapter::name());
+    }
+    return agree;
+}
+
+int main(int argc, char **argv) {
+    size_t elements = argc > 1 ? (size_t) atof(argv[1]) : 1000000;
+    if ( elements == 0 ) {
+        fprintf(stderr, "number of elements should be positive\n");
+        return 1;
+    }
+
+    printf("%zu elements, %zu lookups, %zu ranges, %zu churn operations\n", elements, elements, RANGES,
+           max<size_t>(elements / 100, 1));
+    printHeader();
+    Results reference;
+    if ( !compare<TreeAdapter>(elements, reference, true) ) {
+        return 1;
+    }
+    bool agree = compare<HashIndexedTreeAdapter>(elements, reference, false);
+    agree = compare<MultisetAdapter>(elements, reference, false) && agree;
+    agree = compare<UnorderedMultisetAdapter>(elements, reference, false) && agree;
+    agree = compare<SortedVectorAdapter>(elements, reference, false) && agree;
+    return agree ? 0 : 1;
+}
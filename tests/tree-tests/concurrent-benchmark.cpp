@@ -0,0 +1,135 @@
+// Multi threaded stress and throughput benchmark for concurrent trees.
+//
+// Usage: concurrent_tree_benchmark [seconds-per-run] [max-threads]
+// Every run prints operations per second at 1, 2, 4, ... max-threads threads
+// for a write heavy mix (50% insert, 50% remove) and a read mostly mix
+// (90% isMember, 5% insert, 5% remove). Each thread draws keys from its
+// own fixed seed, so runs are reproducible.
+
+#include "Tree.h"
+#include "ConcurrentTree.h"
+#include "OptimisticConcurrentTree.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const int KEY_RANGE = 1000000;
+
+// Baseline: one global mutex around plain Tree.
+class LockedTree {
+public:
+    void insert(int el) {
+        lock_guard<mutex> lock(tree_lock);
+        tree.insert(el);
+    }
+    unsigned int remove(int el) {
+        lock_guard<mutex> lock(tree_lock);
+        return tree.remove(el);
+    }
+    bool isMember(int el) {
+        lock_guard<mutex> lock(tree_lock);
+        return tree.isMember(el);
+    }
+    unsigned int size() {
+        lock_guard<mutex> lock(tree_lock);
+        return tree.size();
+    }
+private:
+    mutex tree_lock;
+    Tree<int> tree;
+};
+
+struct Mix {
+    const char *name;
+    int read_percent;
+    int insert_percent;
+};
+
+template<typename TreeType>
+double runWorkload(const Mix &mix, unsigned int threads_count, double seconds) {
+    TreeType tree;
+    {
+        mt19937 generator(42);
+        uniform_int_distribution<int> keys(0, KEY_RANGE - 1);
+        for (int i = 0; i < KEY_RANGE / 2; i++) {
+            tree.insert(keys(generator));
+        }
+    }
+
+    atomic<bool> start(false), stop(false);
+    atomic<unsigned long> operations(0);
+    vector<thread> threads;
+    for (unsigned int t = 0; t < threads_count; t++) {
+        threads.push_back(thread([&, t]() {
+            mt19937 generator(1000 + t);
+            uniform_int_distribution<int> keys(0, KEY_RANGE - 1);
+            uniform_int_distribution<int> percent(0, 99);
+            unsigned long done = 0;
+            while ( !start.load() ) {
+                this_thread::yield();
+            }
+            while ( !stop.load(memory_order_relaxed) ) {
+                int key = keys(generator);
+                int dice = percent(generator);
+                if ( dice < mix.read_percent ) {
+                    tree.isMember(key);
+                } else if ( dice < mix.read_percent + mix.insert_percent ) {
+                    tree.insert(key);
+                } else {
+                    tree.remove(key);
+                }
+                done++;
+            }
+            operations.fetch_add(done);
+        }));
+    }
+
+    auto begin = chrono::steady_clock::now();
+    start.store(true);
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop.store(true);
+    for (auto &worker : threads) {
+        worker.join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    return operations.load() / elapsed;
+}
+
+template<typename TreeType>
+void runSeries(const char *tree_name, const Mix &mix, unsigned int max_threads, double seconds) {
+    for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+        double ops = runWorkload<TreeType>(mix, threads, seconds);
+        printf("%-26s %-12s %8u %16.0f\n", tree_name, mix.name, threads, ops);
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    unsigned int max_threads = argc > 2 ? (unsigned int) atoi(argv[2]) : thread::hardware_concurrency();
+    if ( max_threads == 0 ) {
+        max_threads = 1;
+    }
+
+    const Mix mixes[] = {
+            {"write-heavy", 0, 50},
+            {"read-mostly", 90, 5},
+    };
+
+    printf("%-26s %-12s %8s %16s\n", "tree", "mix", "threads", "ops/sec");
+    for (auto &mix : mixes) {
+        runSeries<OptimisticConcurrentTree<int>>("OptimisticConcurrentTree", mix, max_threads, seconds);
+        runSeries<ConcurrentTree<int>>("ConcurrentTree", mix, max_threads, seconds);
+        runSeries<LockedTree>("Tree + mutex", mix, max_threads, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "gtest/gtest.h"
+#include "ConcurrentTree.h"
+#include "OptimisticConcurrentTree.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class ConcurrentTreeTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        for (int i = 0; i < 100; i++) {
+            tree.insert(i);
+        }
+    }
+
+    virtual void TearDown() {
+
+    }
+
+    ConcurrentTree<int> tree;
+};
+
+TEST_F(ConcurrentTreeTest, BehavesLikeTree) {
+    EXPECT_EQ(100, tree.size());
+    EXPECT_TRUE(tree.isMember(42));
+    EXPECT_FALSE(tree.isMember(100));
+    EXPECT_EQ(10, tree.countElements(10, 19));
+
+    tree.insert(42);
+    EXPECT_EQ(2, tree.countElements(42));
+    EXPECT_EQ(2, tree.removeAll(42));
+    EXPECT_EQ(0, tree.remove(42));
+    EXPECT_EQ(49, tree.removeAll([](const int &x) { return x % 2 == 0; }));
+    EXPECT_EQ(50, tree.size());
+
+    int previous = -1;
+    tree.inOrderTraverse([&](const int &x) {
+        EXPECT_LT(previous, x);
+        previous = x;
+    });
+    tree.clear();
+    EXPECT_EQ(0, tree.size());
+}
+
+TEST_F(ConcurrentTreeTest, OldVersionIsNotModified) {
+    tree.read([&](const Tree<int> &version) {
+        tree.insert(1000);
+        tree.removeAll(0);
+        EXPECT_FALSE(version.isMember(1000));
+        EXPECT_TRUE(version.isMember(0));
+        EXPECT_EQ(100, version.size());
+        return 0;
+    });
+    EXPECT_TRUE(tree.isMember(1000));
+    EXPECT_FALSE(tree.isMember(0));
+}
+
+TEST_F(ConcurrentTreeTest, ReadersSeeConsistentVersions) {
+    std::atomic<bool> done(false);
+    std::atomic<unsigned int> inconsistent(0);
+    std::vector<std::thread> readers;
+
+    for (int r = 0; r < 4; r++) {
+        readers.push_back(std::thread([&]() {
+            while ( !done.load() ) {
+                tree.read([&](const Tree<int> &version) {
+                    // writer always changes both elements of a pair in one version
+                    for (int i = 1; i < 50; i++) {
+                        if ( version.countElements(1000 + i) != version.countElements(-1000 - i) ) {
+                            inconsistent++;
+                        }
+                    }
+                    return 0;
+                });
+            }
+        }));
+    }
+
+    for (int round = 0; round < 200; round++) {
+        int i = 1 + round % 49;
+        tree.write([&](Tree<int> &version) {
+            version.insert(1000 + i);
+            version.insert(-1000 - i);
+            return 2u;
+        });
+        if ( round % 3 == 0 ) {
+            tree.write([&](Tree<int> &version) {
+                return version.remove(1000 + i) + version.remove(-1000 - i);
+            });
+        }
+    }
+    done.store(true);
+    for (auto &reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(0, inconsistent.load());
+    EXPECT_EQ(100 + 2 * (200 - 67), tree.size());
+}
+
+TEST(OptimisticConcurrentTreeTest, BehavesLikeTree) {
+    OptimisticConcurrentTree<int> tree;
+    EXPECT_EQ(0, tree.size());
+    EXPECT_FALSE(tree.isMember(1));
+    EXPECT_EQ(0, tree.remove(1));
+
+    for (int i = 0; i < 20; i++) {
+        tree.insert(i % 10);
+    }
+    EXPECT_EQ(20, tree.size());
+    EXPECT_EQ(2, tree.countElements(3));
+    EXPECT_EQ(1, tree.remove(3));
+    EXPECT_EQ(1, tree.countElements(3));
+    EXPECT_EQ(2, tree.removeAll(4));
+    EXPECT_FALSE(tree.isMember(4));
+    EXPECT_EQ(17, tree.size());
+
+    std::vector<int> visited;
+    tree.inOrderTraverse([&](const int &x) {
+        visited.push_back(x);
+    });
+    ASSERT_EQ(17, visited.size());
+    for (size_t i = 1; i < visited.size(); i++) {
+        EXPECT_LE(visited[i - 1], visited[i]);
+    }
+}
+
+TEST(OptimisticConcurrentTreeTest, ConcurrentInsertAndRemove) {
+    OptimisticConcurrentTree<int> tree;
+    const int threads_count = 8;
+    const int per_thread = 2000;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < threads_count; t++) {
+        threads.push_back(std::thread([&, t]() {
+            // every thread inserts shared keys twice and its own keys once,
+            // then removes one copy of each shared key
+            for (int i = 0; i < per_thread; i++) {
+                tree.insert(i);
+                tree.insert(i);
+                tree.insert(per_thread * (t + 1) + i);
+                EXPECT_TRUE(tree.isMember(i));
+            }
+            for (int i = 0; i < per_thread; i++) {
+                EXPECT_EQ(1, tree.remove(i));
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(threads_count * per_thread * 2, tree.size());
+    for (int i = 0; i < per_thread; i++) {
+        ASSERT_EQ(threads_count, tree.countElements(i));
+    }
+    for (int t = 0; t < threads_count; t++) {
+        EXPECT_EQ(1, tree.countElements(per_thread * (t + 1) + per_thread / 2));
+    }
+
+    std::atomic<unsigned int> removed(0);
+    threads.clear();
+    for (int t = 0; t < threads_count; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < per_thread; i++) {
+                removed += tree.removeAll(i);
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(threads_count * per_thread, removed.load());
+    EXPECT_EQ(threads_count * per_thread, tree.size());
+}
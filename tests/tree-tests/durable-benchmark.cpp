@@ -0,0 +1,83 @@
+// Write throughput of DurableTree with different group commit sizes.
+//
+// Usage: durable_tree_benchmark [operations] [directory]
+// For every batch size prints inserts per second including fdatasync of the
+// log, time of a checkpoint and time to recover the tree on reopen. Keys come
+// from a fixed seed, so runs are reproducible. The directory is emptied
+// before every run and should live on the file system being measured.
+
+#include "DurableTree.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+
+static void clearDirectory(const string &directory) {
+    if ( DIR *dir = opendir(directory.c_str()) ) {
+        while ( dirent *entry = readdir(dir) ) {
+            remove((directory + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+}
+
+static double secondsSince(chrono::steady_clock::time_point begin) {
+    return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+int main(int argc, char **argv) {
+    int operations = argc > 1 ? atoi(argv[1]) : 20000;
+    string directory = argc > 2 ? argv[2] : "durable-benchmark-data";
+    const unsigned int batch_sizes[] = {1, 8, 64, 512, 4096};
+
+    printf("%12s %16s %16s %14s\n", "batch", "inserts/sec", "checkpoint ms", "recovery ms");
+    for (unsigned int batch_size : batch_sizes) {
+        clearDirectory(directory);
+        DurableTreeOptions options;
+        options.operations_per_sync = batch_size;
+        options.checkpoint_log_bytes = UINT64_MAX;
+
+        mt19937 generator(42);
+        uniform_int_distribution<int> keys(0, 1000000);
+        double insert_seconds, checkpoint_seconds;
+        {
+            DurableTree<int> tree(directory, options);
+            auto begin = chrono::steady_clock::now();
+            for (int i = 0; i < operations; i++) {
+                tree.insert(keys(generator));
+            }
+            tree.sync();
+            insert_seconds = secondsSince(begin);
+
+            begin = chrono::steady_clock::now();
+            tree.checkpoint();
+            tree.waitForCheckpoint();
+            checkpoint_seconds = secondsSince(begin);
+            // half of the state comes from checkpoint, half from log replay
+            for (int i = 0; i < operations; i++) {
+                tree.insert(keys(generator));
+            }
+        }
+        auto begin = chrono::steady_clock::now();
+        DurableTree<int> recovered(directory, options);
+        double recovery_seconds = secondsSince(begin);
+        if ( recovered.size() != (unsigned int) operations * 2 ) {
+            fprintf(stderr, "recovered %u elements instead of %d\n", recovered.size(), operations * 2);
+            return 1;
+        }
+
+        printf("%12u %16.0f %16.2f %14.2f\n", batch_size, operations / insert_seconds,
+               checkpoint_seconds * 1000, recovery_seconds * 1000);
+        fflush(stdout);
+    }
+    clearDirectory(directory);
+    rmdir(directory.c_str());
+    return 0;
+}
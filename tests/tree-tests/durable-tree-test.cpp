@@ -0,0 +1,178 @@
+#include "gtest/gtest.h"
+#include "DurableTree.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <csignal>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+class DurableTreeTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        removeDirectory();
+    }
+
+    virtual void TearDown() {
+        removeDirectory();
+    }
+
+    void removeDirectory() {
+        if ( DIR *dir = opendir(directory.c_str()) ) {
+            while ( dirent *entry = readdir(dir) ) {
+                std::remove((directory + "/" + entry->d_name).c_str());
+            }
+            closedir(dir);
+        }
+        rmdir(directory.c_str());
+    }
+
+    unsigned int filesCount(const std::string &prefix) {
+        unsigned int count = 0;
+        DIR *dir = opendir(directory.c_str());
+        while ( dirent *entry = readdir(dir) ) {
+            count += std::string(entry->d_name).compare(0, prefix.size(), prefix) == 0;
+        }
+        closedir(dir);
+        return count;
+    }
+
+    std::string directory = "durable-tree-test";
+};
+
+TEST_F(DurableTreeTest, ReopenRestoresOperations) {
+    {
+        DurableTree<int> tree(directory);
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(i % 100);
+        }
+        EXPECT_EQ(10, tree.removeAll(7));
+        EXPECT_EQ(3, tree.remove(8, 3));
+        EXPECT_EQ(0, tree.remove(1000));
+    }
+    DurableTree<int> reopened(directory);
+    EXPECT_EQ(987, reopened.size());
+    EXPECT_FALSE(reopened.isMember(7));
+    EXPECT_EQ(7, reopened.countElements(8));
+    EXPECT_EQ(10, reopened.tree().countElements(50, 50));
+}
+
+TEST_F(DurableTreeTest, CheckpointsReplaceLogs) {
+    DurableTreeOptions options;
+    options.operations_per_sync = 16;
+    options.checkpoint_log_bytes = 4096;
+    {
+        DurableTree<std::string> tree(directory, options);
+        for (int i = 0; i < 2000; i++) {
+            tree.insert("key" + std::to_string(i % 500));
+        }
+        tree.removeAll("key1");
+        tree.checkpoint();
+        tree.insert("after checkpoint");
+        tree.waitForCheckpoint();
+    }
+    EXPECT_EQ(1, filesCount("checkpoint."));
+    EXPECT_GE(2, filesCount("log."));
+
+    DurableTree<std::string> reopened(directory, options);
+    EXPECT_EQ(1997, reopened.size());
+    EXPECT_FALSE(reopened.isMember("key1"));
+    EXPECT_EQ(4, reopened.countElements("key499"));
+    EXPECT_TRUE(reopened.isMember("after checkpoint"));
+}
+
+TEST_F(DurableTreeTest, CheckpointOfLongPendingBatch) {
+    DurableTreeOptions options;
+    options.operations_per_sync = 1000;
+    options.checkpoint_log_bytes = 64;
+    {
+        DurableTree<int> tree(directory, options);
+        for (int i = 0; i < 20; i++) {
+            tree.insert(i);
+        }
+        // writing the pending batch makes the log long enough for an automatic checkpoint
+        tree.checkpoint();
+        for (int i = 20; i < 40; i++) {
+            tree.insert(i);
+            tree.sync();
+        }
+        tree.waitForCheckpoint();
+    }
+    DurableTree<int> reopened(directory, options);
+    EXPECT_EQ(40, reopened.size());
+    EXPECT_TRUE(reopened.isMember(39));
+}
+
+TEST_F(DurableTreeTest, CrashKeepsSyncedBatches) {
+    DurableTreeOptions options;
+    options.operations_per_sync = 100;
+    pid_t child = fork();
+    if ( child == 0 ) {
+        DurableTree<int> tree(directory, options);
+        for (int i = 0; i < 1050; i++) {
+            tree.insert(i);
+        }
+        // crash without syncing last 50 operations
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+
+    {
+        // torn tail of a batch that was being written
+        std::ofstream log((directory + "/log.0").c_str(), std::ios::binary | std::ios::app);
+        log.write("\x05\x00\x00\x00\x01", 5);
+    }
+    DurableTree<int> recovered(directory, options);
+    EXPECT_EQ(1000, recovered.size());
+    EXPECT_TRUE(recovered.isMember(999));
+    EXPECT_FALSE(recovered.isMember(1000));
+
+    recovered.insert(5000);
+    recovered.sync();
+    DurableTree<int> reopened(directory, options);
+    EXPECT_EQ(1001, reopened.size());
+}
+
+TEST_F(DurableTreeTest, FailedWriteStopsChanges) {
+    DurableTreeOptions options;
+    options.operations_per_sync = 100;
+    // batch of 100 ints: count, 100 records of 9 bytes and checksum
+    const off_t batch_bytes = 4 + 100 * 9 + 8;
+    pid_t child = fork();
+    if ( child == 0 ) {
+        // log may grow by two batches and a part of the third one
+        signal(SIGXFSZ, SIG_IGN);
+        rlimit limit{(rlim_t) (2 * batch_bytes + 100), (rlim_t) (2 * batch_bytes + 100)};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        DurableTree<int> tree(directory, options);
+        int failures = 0;
+        for (int i = 0; i < 400; i++) {
+            try {
+                tree.insert(i);
+            } catch (const std::string &) {
+                failures++;
+            }
+        }
+        // the insert completing the third batch failed, later ones were refused
+        _exit(failures == 400 - 299 && tree.size() == 300 ? 0 : 1);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+
+    struct stat log;
+    ASSERT_EQ(0, stat((directory + "/log.0").c_str(), &log));
+    EXPECT_EQ(2 * batch_bytes, log.st_size);
+    DurableTree<int> recovered(directory, options);
+    EXPECT_EQ(200, recovered.size());
+}
@@ -0,0 +1,78 @@
+#include "gtest/gtest.h"
+#include "FilteredTree.h"
+
+#include <random>
+#include <set>
+
+TEST(FilteredTreeTest, MissesStopAtFilter) {
+    FilteredTreeOptions options;
+    options.expected_elements = 5000;
+    FilteredTree<int> tree(options);
+    for (int i = 0; i < 10000; i += 2) {
+        tree.insert(i);
+    }
+    for (int i = 0; i < 10000; i++) {
+        ASSERT_EQ(i % 2 == 0, tree.isMember(i));
+    }
+    TreeFilterStats stats = tree.filterStats();
+    EXPECT_EQ(10000, stats.lookups);
+    // 1% expected false positives among 5000 misses
+    EXPECT_LT(4850, stats.filtered);
+    EXPECT_EQ(5000 - stats.filtered, stats.false_positives);
+    EXPECT_EQ(0, stats.rebuilds);
+    EXPECT_EQ(25000, stats.filter_bytes);
+
+    tree.resetFilterStats();
+    EXPECT_EQ(0, tree.countElements(-1) + tree.filterStats().false_positives);
+    EXPECT_EQ(1, tree.filterStats().lookups);
+}
+
+TEST(FilteredTreeTest, RemovalsAndGrowthKeepMultisetContents) {
+    FilteredTreeOptions options;
+    options.expected_elements = 16;
+    options.counters_per_element = 8;
+    FilteredTree<int> tree(options);
+    std::multiset<int> expected;
+    std::mt19937 generator(5);
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 3000; i++) {
+            int el = (int) (generator() % 1500);
+            tree.insert(el);
+            expected.insert(el);
+        }
+        for (int i = 0; i < 500; i++) {
+            int el = (int) (generator() % 1500);
+            EXPECT_EQ(expected.erase(el), tree.removeAll(el));
+            el = (int) (generator() % 1500);
+            unsigned int removed = tree.remove(el, 2);
+            for (unsigned int r = 0; r < removed; r++) {
+                expected.erase(expected.find(el));
+            }
+        }
+        int divisor = 7 + round;
+        unsigned int removed = tree.removeAll([&](const int &el) { return el % divisor == 0; });
+        unsigned int erased = 0;
+        for (auto it = expected.begin(); it != expected.end();) {
+            if ( *it % divisor == 0 ) {
+                it = expected.erase(it);
+                erased++;
+            } else {
+                ++it;
+            }
+        }
+        EXPECT_EQ(erased, removed);
+        for (int el = -5; el < 1505; el++) {
+            ASSERT_EQ(expected.count(el), tree.countElements(el));
+        }
+    }
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_LT(0, tree.filterStats().rebuilds);
+
+    tree.clear();
+    EXPECT_EQ(0, tree.size());
+    tree.resetFilterStats();
+    for (int el = 0; el < 1500; el++) {
+        EXPECT_FALSE(tree.isMember(el));
+    }
+    EXPECT_EQ(1500, tree.filterStats().filtered);
+}
@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+#include "HashIndexedTree.h"
+
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+
+// few distinct hash values, so removals have to shift long probe runs
+struct ClusteringHash {
+    size_t operator()(int el) const {
+        return (size_t) (el % 4 + 4);
+    }
+};
+
+TEST(HashIndexedTreeTest, CountsSurviveClusteredRemovals) {
+    ElementCounts<int, ThreeWayCompare<int>, ClusteringHash> counts;
+    std::map<int, unsigned int> expected;
+    std::mt19937 generator(3);
+    for (int i = 0; i < 20000; i++) {
+        int el = (int) (generator() % 300);
+        if ( generator() % 3 == 0 && expected.count(el) != 0 ) {
+            counts.remove(el);
+            if ( --expected[el] == 0 ) {
+                expected.erase(el);
+            }
+        } else {
+            counts.add(el);
+            expected[el]++;
+        }
+        if ( i % 1000 == 0 ) {
+            for (int probe = -1; probe <= 300; probe++) {
+                ASSERT_EQ(expected.count(probe) != 0 ? expected[probe] : 0, counts.count(probe));
+            }
+        }
+    }
+    EXPECT_EQ(expected.size(), counts.distinct());
+    counts.clear();
+    EXPECT_EQ(0, counts.count(5));
+}
+
+TEST(HashIndexedTreeTest, KeepsIndexInSyncWithTree) {
+    HashIndexedTree<std::string> tree(TreeBalancing::Treap);
+    std::multiset<std::string> expected;
+    std::mt19937 generator(8);
+    for (int i = 0; i < 6000; i++) {
+        std::string el = "key-" + std::to_string(generator() % 800);
+        if ( i % 5 == 0 ) {
+            EXPECT_EQ(expected.erase(el), tree.removeAll(el));
+        } else if ( i % 5 == 1 ) {
+            unsigned int removed = tree.remove(el);
+            EXPECT_EQ(expected.count(el) != 0 ? 1 : 0, removed);
+            if ( removed != 0 ) {
+                expected.erase(expected.find(el));
+            }
+        } else {
+            tree.insert(el);
+            expected.insert(el);
+        }
+    }
+    unsigned int removed = tree.removeAll([](const std::string &el) { return el.back() == '7'; });
+    unsigned int erased = 0;
+    for (auto it = expected.begin(); it != expected.end();) {
+        if ( it->back() == '7' ) {
+            it = expected.erase(it);
+            erased++;
+        } else {
+            ++it;
+        }
+    }
+    EXPECT_EQ(erased, removed);
+    for (int key = 0; key < 810; key++) {
+        std::string el = "key-" + std::to_string(key);
+        ASSERT_EQ(expected.count(el), tree.countElements(el));
+        ASSERT_EQ(expected.count(el) != 0, tree.isMember(el));
+    }
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_EQ(expected.size(), tree.elements().countElements(std::string("key-"), std::string("key-:")));
+    EXPECT_LT(0, tree.indexBytes());
+
+    tree.clear();
+    EXPECT_FALSE(tree.isMember("key-1"));
+    EXPECT_EQ(0, tree.size());
+}
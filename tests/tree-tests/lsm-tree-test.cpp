@@ -0,0 +1,101 @@
+#include "gtest/gtest.h"
+#include "LsmTree.h"
+#include "BloomFilter.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+TEST(BloomFilterTest, NoFalseNegatives) {
+    BloomFilter<int> filter(10000);
+    for (int i = 0; i < 10000; i++) {
+        filter.add(i * 3);
+    }
+    unsigned int false_positives = 0;
+    for (int i = 0; i < 10000; i++) {
+        EXPECT_TRUE(filter.mayContain(i * 3));
+        false_positives += filter.mayContain(i * 3 + 1);
+    }
+    EXPECT_GT(300, false_positives);
+}
+
+class LsmTreeTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        options.memtable_elements = 64;
+        options.max_runs = 3;
+    }
+
+    LsmTreeOptions options;
+};
+
+TEST_F(LsmTreeTest, BehavesAsTree) {
+    Tree<int> expected;
+    LsmTree<int> lsm(options);
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<int> values(0, 3000);
+    for (int i = 0; i < 30000; i++) {
+        int value = values(generator);
+        expected.insert(value);
+        lsm.insert(value);
+        if ( i % 2 == 0 ) {
+            int removed = values(generator);
+            EXPECT_EQ(expected.remove(removed, 3), lsm.remove(removed, 3));
+        }
+    }
+
+    EXPECT_EQ(expected.size(), lsm.size());
+    for (int value = -1; value <= 3001; value += 5) {
+        EXPECT_EQ(expected.countElements(value), lsm.countElements(value)) << value;
+    }
+    EXPECT_EQ(expected.countElements(500, 1499), lsm.countElements(500, 1499));
+
+    std::vector<int> expected_order, lsm_order;
+    expected.inOrderTraverse([&](int &x) { expected_order.push_back(x); });
+    lsm.inOrderTraverse([&](const int &x) { lsm_order.push_back(x); });
+    EXPECT_EQ(expected_order, lsm_order);
+
+    expected_order.clear();
+    lsm_order.clear();
+    expected.inRangeTraverse(100, 200, [&](int &x) { expected_order.push_back(x); });
+    lsm.inRangeTraverse(100, 200, [&](const int &x) { lsm_order.push_back(x); });
+    EXPECT_EQ(expected_order, lsm_order);
+}
+
+TEST_F(LsmTreeTest, CompactionMergesRuns) {
+    LsmTree<std::string> lsm(options);
+    for (int i = 0; i < 1000; i++) {
+        lsm.insert(std::to_string(i % 300));
+    }
+    for (int i = 0; i < 300; i += 2) {
+        lsm.removeAll(std::to_string(i));
+    }
+    lsm.flush();
+    lsm.waitForCompaction();
+
+    // 300 distinct elements fit in first two tiers, each left with less than max_runs runs
+    EXPECT_GE(2 * (options.max_runs - 1), lsm.runsCount());
+    EXPECT_EQ(500, lsm.size());
+    EXPECT_FALSE(lsm.isMember("10"));
+    EXPECT_EQ(4, lsm.countElements("11"));
+    EXPECT_EQ(3, lsm.countElements("299"));
+}
+
+TEST_F(LsmTreeTest, CompactionMergesRunsOfSimilarSize) {
+    LsmTree<int> lsm(options);
+    const int inserted = 64 * 3 * 3 * 3 * 3 * 3;
+    for (int i = 0; i < inserted; i++) {
+        lsm.insert(i);
+    }
+    lsm.flush();
+    lsm.waitForCompaction();
+
+    // every element is rewritten once per tier it passes, 5 tiers here;
+    // merging all runs every time would rewrite it about 80 times
+    EXPECT_GE(5ULL * inserted, lsm.compactedElements());
+    EXPECT_LE(1ULL * inserted, lsm.compactedElements());
+    EXPECT_GE(6 * (options.max_runs - 1), lsm.runsCount());
+    EXPECT_EQ((unsigned int) inserted, lsm.size());
+    EXPECT_EQ(1000, lsm.countElements(1000, 1999));
+}
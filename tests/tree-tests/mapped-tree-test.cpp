@@ -0,0 +1,137 @@
+#include "gtest/gtest.h"
+#include "MappedTree.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <vector>
+
+class MappedTreeTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        for (int i = 0; i < 1000; i++) {
+            tree.insert((i * 7919) % 500);
+        }
+        MappedTree<int>::build(tree, path);
+    }
+
+    virtual void TearDown() {
+        std::remove(path.c_str());
+    }
+
+    Tree<int> tree;
+    std::string path = "mapped-tree-test.btm";
+};
+
+TEST_F(MappedTreeTest, QueriesMatchSourceTree) {
+    MappedTree<int> mapped(path);
+
+    EXPECT_EQ(tree.size(), mapped.size());
+    for (int i = -1; i <= 500; i++) {
+        EXPECT_EQ(tree.isMember(i), mapped.isMember(i)) << i;
+        EXPECT_EQ(tree.countElements(i), mapped.countElements(i)) << i;
+    }
+    EXPECT_EQ(tree.countElements(100, 199), mapped.countElements(100, 199));
+    EXPECT_EQ(0, mapped.countElements(10, 5));
+
+    std::vector<int> expected, actual;
+    tree.inRangeTraverse(17, 42, [&](int &x) { expected.push_back(x); });
+    mapped.inRangeTraverse(17, 42, [&](const int &x) { actual.push_back(x); });
+    EXPECT_EQ(expected, actual);
+}
+
+TEST_F(MappedTreeTest, Traversals) {
+    MappedTree<int> mapped(path);
+
+    std::vector<int> in_order, opposite;
+    tree.inOrderTraverse([&](int &x) { in_order.push_back(x); });
+    mapped.inOppositeOrderTraverse([&](const int &x) { opposite.push_back(x); });
+    EXPECT_EQ(in_order, std::vector<int>(opposite.rbegin(), opposite.rend()));
+
+    unsigned int visited = 0;
+    mapped.inOrderTraverse([&](const int &) { visited++; }, [](const int &x) { return x >= 250; });
+    EXPECT_EQ(500, visited);
+
+    // balanced implicit shape: pre order starts from middle element, post order ends with it
+    int middle = in_order[in_order.size() / 2];
+    std::vector<int> pre, post, pre_right;
+    mapped.preLeftTraverse([&](const int &x) { pre.push_back(x); });
+    mapped.postLeftTraverse([&](const int &x) { post.push_back(x); });
+    mapped.preRightTraverse([&](const int &x) { pre_right.push_back(x); });
+    EXPECT_EQ(in_order.size(), pre.size());
+    EXPECT_EQ(in_order.size(), post.size());
+    EXPECT_EQ(middle, pre.front());
+    EXPECT_EQ(middle, post.back());
+    EXPECT_EQ(in_order.front(), post.front());
+    EXPECT_EQ(in_order.back(), pre_right[(int) std::log2(in_order.size())]);
+}
+
+TEST_F(MappedTreeTest, StopPredicateWorksAsInTree) {
+    // 2^k - 1 elements: loaded balanced tree has the same shape as the mapped one
+    Tree<int> source;
+    for (int i = 0; i < 127; i++) {
+        source.insert((i * 37) % 127);
+    }
+    std::stringstream stream;
+    source.serialize(stream);
+    const Tree<int> balanced = Tree<int>::deserialize(stream);
+    MappedTree<int>::build(balanced, path);
+    MappedTree<int> mapped(path);
+
+    typedef std::function<void(const int &)> Visit;
+    typedef std::function<bool(const int &)> Stop;
+    std::vector<std::function<void(Visit, Stop)>> in_tree = {
+            [&](Visit f, Stop s) { balanced.preLeftTraverse(f, s); },
+            [&](Visit f, Stop s) { balanced.postLeftTraverse(f, s); },
+            [&](Visit f, Stop s) { balanced.preRightTraverse(f, s); },
+            [&](Visit f, Stop s) { balanced.postRightTraverse(f, s); },
+            [&](Visit f, Stop s) { balanced.inOrderTraverse(f, s); }};
+    std::vector<std::function<void(Visit, Stop)>> in_mapping = {
+            [&](Visit f, Stop s) { mapped.preLeftTraverse(f, s); },
+            [&](Visit f, Stop s) { mapped.postLeftTraverse(f, s); },
+            [&](Visit f, Stop s) { mapped.preRightTraverse(f, s); },
+            [&](Visit f, Stop s) { mapped.postRightTraverse(f, s); },
+            [&](Visit f, Stop s) { mapped.inOrderTraverse(f, s); }};
+    for (size_t order = 0; order < in_tree.size(); order++) {
+        for (int stop_at : {-1, 0, 5, 63, 100, 126}) {
+            Stop stop = [=](const int &x) { return x == stop_at; };
+            std::vector<int> expected, actual;
+            in_tree[order]([&](const int &x) { expected.push_back(x); }, stop);
+            in_mapping[order]([&](const int &x) { actual.push_back(x); }, stop);
+            EXPECT_EQ(expected, actual) << "order " << order << ", stop at " << stop_at;
+        }
+    }
+}
+
+TEST_F(MappedTreeTest, RejectsForeignFiles) {
+    EXPECT_THROW(MappedTree<double> mapped(path), std::string);
+    EXPECT_THROW(MappedTree<int> mapped("no-such-mapped-tree.btm"), std::string);
+
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.write("XXXX", 4);
+    }
+    EXPECT_THROW(MappedTree<int> mapped(path), std::string);
+
+    MappedTree<int>::build(Tree<int>(), path);
+    MappedTree<int> empty(path);
+    EXPECT_EQ(0, empty.size());
+    EXPECT_FALSE(empty.isMember(0));
+    empty.postLeftTraverse([](const int &) { FAIL(); });
+}
+
+TEST_F(MappedTreeTest, RebuildKeepsOpenMappingsReadable) {
+    MappedTree<int> old_mapped(path);
+
+    MappedTree<int>::build(Tree<int>(), path);
+    MappedTree<int> new_mapped(path);
+
+    EXPECT_EQ(0, new_mapped.size());
+    EXPECT_EQ(tree.size(), old_mapped.size());
+    unsigned int visited = 0;
+    old_mapped.inOrderTraverse([&](const int &) { visited++; });
+    EXPECT_EQ(tree.size(), visited);
+}
@@ -0,0 +1,95 @@
+#include "gtest/gtest.h"
+#include "PagedTree.h"
+#include "Tree.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+class PagedTreeTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        std::remove(path.c_str());
+        // small pages and cache force deep tree, splits and evictions
+        options.page_size = 256;
+        options.cache_pages = 16;
+    }
+
+    virtual void TearDown() {
+        std::remove(path.c_str());
+    }
+
+    std::string path = "paged-tree-test.btp";
+    PagedTreeOptions options;
+};
+
+TEST_F(PagedTreeTest, BehavesAsTree) {
+    Tree<long> expected;
+    PagedTree<long> paged(path, options);
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<long> values(0, 5000);
+    for (int i = 0; i < 20000; i++) {
+        long value = values(generator);
+        expected.insert(value);
+        paged.insert(value);
+        if ( i % 3 == 0 ) {
+            long removed = values(generator);
+            EXPECT_EQ(expected.remove(removed, 2), paged.remove(removed, 2));
+        }
+    }
+
+    EXPECT_EQ(expected.size(), paged.size());
+    for (long value = -1; value <= 5001; value += 7) {
+        EXPECT_EQ(expected.countElements(value), paged.countElements(value)) << value;
+    }
+    EXPECT_EQ(expected.countElements(1000, 2999), paged.countElements(1000, 2999));
+    EXPECT_EQ(0, paged.countElements(10, 5));
+
+    std::vector<long> expected_order, paged_order;
+    expected.inOrderTraverse([&](long &x) { expected_order.push_back(x); });
+    paged.inOrderTraverse([&](const long &x) { paged_order.push_back(x); });
+    EXPECT_EQ(expected_order, paged_order);
+
+    expected_order.clear();
+    paged_order.clear();
+    expected.inRangeTraverse(1234, 1300, [&](long &x) { expected_order.push_back(x); });
+    paged.inRangeTraverse(1234, 1300, [&](const long &x) { paged_order.push_back(x); });
+    EXPECT_EQ(expected_order, paged_order);
+
+    EXPECT_GT(paged.stats().misses, 0);
+    EXPECT_GT(paged.stats().evictions, 0);
+}
+
+TEST_F(PagedTreeTest, ReopenKeepsData) {
+    {
+        PagedTree<int> paged(path, options);
+        for (int i = 0; i < 10000; i++) {
+            paged.insert(i / 2);
+        }
+        EXPECT_EQ(2, paged.removeAll(10));
+    }
+    options.page_size = 4096;
+    PagedTree<int> reopened(path, options);
+    EXPECT_EQ(9998, reopened.size());
+    EXPECT_FALSE(reopened.isMember(10));
+    EXPECT_EQ(2, reopened.countElements(4999));
+    EXPECT_EQ(200, reopened.countElements(100, 199));
+
+    EXPECT_THROW(PagedTree<double> wrong_element(path, options), std::string);
+}
+
+TEST_F(PagedTreeTest, CacheStatistics) {
+    options.cache_pages = 1024;
+    PagedTree<int> paged(path, options);
+    for (int i = 0; i < 5000; i++) {
+        paged.insert(i);
+    }
+    paged.resetStats();
+    for (int i = 0; i < 5000; i++) {
+        EXPECT_TRUE(paged.isMember(i));
+    }
+    // whole tree fits into cache, every page is already there
+    EXPECT_EQ(0, paged.stats().misses);
+    EXPECT_DOUBLE_EQ(1.0, paged.stats().hitRate());
+}
@@ -7,6 +7,7 @@
 
 #include <random>
 #include <chrono>
+#include <sstream>
 
 
 using namespace std;
@@ -81,3 +82,13 @@ TEST_F(BinaryTreePerformanceTest, getSubtreeEl) {
         ASSERT_LE(1, hugeTree.getSubtreeFromElement(number).size());
     }
 }
+
+TEST_F(BinaryTreePerformanceTest, serializationRoundTrip) {
+    stringstream stream;
+    hugeTree.serialize(stream);
+    auto loaded = Tree<double>::deserialize(stream);
+    ASSERT_EQ(hugeTree.size(), loaded.size());
+    for (auto &number : some_numbers) {
+        ASSERT_TRUE(loaded.isMember(number));
+    }
+}
@@ -0,0 +1,68 @@
+#include "gtest/gtest.h"
+#include "PersistentTree.h"
+
+#include <vector>
+
+class PersistentTreeTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        for (int i = 0; i < 1000; i++) {
+            base = base.insert((i * 7919) % 1000);
+        }
+    }
+
+    virtual void TearDown() {
+
+    }
+
+    PersistentTree<int> base;
+};
+
+TEST_F(PersistentTreeTest, UpdatesReturnNewVersions) {
+    auto with_duplicate = base.insert(5);
+    auto without_five = with_duplicate.removeAll(5);
+    auto without_odd = base.removeAll([](const int &x) { return x % 2 == 1; });
+
+    EXPECT_EQ(1000, base.size());
+    EXPECT_EQ(1, base.countElements(5));
+    EXPECT_EQ(1001, with_duplicate.size());
+    EXPECT_EQ(2, with_duplicate.countElements(5));
+    EXPECT_EQ(999, without_five.size());
+    EXPECT_FALSE(without_five.isMember(5));
+    EXPECT_EQ(500, without_odd.size());
+    EXPECT_EQ(0, without_odd.countElements([](const int &x) { return x % 2 == 1; }));
+    EXPECT_EQ(0, base.clear().size());
+    EXPECT_EQ(1000, base.countElements(0, 999));
+}
+
+TEST_F(PersistentTreeTest, HistoryOfVersions) {
+    std::vector<PersistentTree<int>> history(1, base);
+    for (int i = 0; i < 1000; i++) {
+        history.push_back(history.back().remove(i).insert(1000 + i));
+    }
+    for (int version = 0; version < (int) history.size(); version += 100) {
+        EXPECT_EQ(1000, history[version].size());
+        EXPECT_EQ(1000 - version, history[version].countElements(0, 999)) << version;
+        EXPECT_EQ(version, history[version].countElements(1000, 1999)) << version;
+    }
+}
+
+TEST_F(PersistentTreeTest, MutableTreeConversion) {
+    Tree<int> tree = base.toTree();
+    tree.removeAll(10);
+    tree.insert(-1);
+    EXPECT_TRUE(base.isMember(10));
+    EXPECT_FALSE(base.isMember(-1));
+
+    PersistentTree<int> frozen(tree);
+    tree.insert(-2);
+    EXPECT_TRUE(frozen.isMember(-1));
+    EXPECT_FALSE(frozen.isMember(-2));
+
+    int previous = -10;
+    frozen.inOrderTraverse([&](const int &x) {
+        EXPECT_LT(previous, x);
+        previous = x;
+    });
+}
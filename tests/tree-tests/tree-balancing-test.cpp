@@ -0,0 +1,386 @@
+#include "gtest/gtest.h"
+#include "Tree.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <set>
+#include <vector>
+
+template<typename Element>
+static std::vector<Element> inOrder(const Tree<Element> &tree) {
+    std::vector<Element> elements;
+    tree.inOrderTraverse([&](const Element &el) { elements.push_back(el); });
+    return elements;
+}
+
+template<typename Element>
+static Element rootElement(const Tree<Element> &tree) {
+    std::vector<Element> elements;
+    tree.preLeftTraverse([&](const Element &el) { elements.push_back(el); }, [](const Element &) { return true; });
+    return elements.front();
+}
+
+TEST(SplayTreeTest, KeepsContentsOfMultiset) {
+    Tree<int> tree(TreeBalancing::Splay);
+    std::multiset<int> expected;
+    std::mt19937 generator(7);
+    for (int i = 0; i < 3000; i++) {
+        int el = generator() % 300;
+        switch (generator() % 4) {
+            case 0:
+                EXPECT_EQ(expected.count(el) != 0, tree.isMember(el));
+                break;
+            case 1:
+                EXPECT_EQ(expected.erase(el), tree.removeAll(el));
+                break;
+            default:
+                tree.insert(el);
+                expected.insert(el);
+        }
+    }
+    EXPECT_EQ(TreeBalancing::Splay, tree.balancingPolicy());
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), inOrder(tree));
+    for (int el = 0; el < 300; el++) {
+        EXPECT_EQ(expected.count(el), tree.countElements(el));
+    }
+}
+
+TEST(SplayTreeTest, AccessedElementsMoveToRoot) {
+    Tree<int> tree(TreeBalancing::Splay);
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i);
+    }
+    EXPECT_EQ(999, rootElement(tree));
+    // sorted inserts leave a path, a lookup of its bottom halves its depth
+    EXPECT_EQ(1000, tree.stats().height);
+    EXPECT_TRUE(tree.isMember(0));
+    EXPECT_EQ(0, rootElement(tree));
+    EXPECT_GT(600, tree.stats().height);
+
+    EXPECT_FALSE(tree.isMember(5000));
+    EXPECT_EQ(0, rootElement(tree));
+
+    // equal elements stay on one path, so every copy is removed
+    tree.insert(500);
+    tree.insert(500);
+    EXPECT_TRUE(tree.isMember(500));
+    EXPECT_EQ(3, tree.removeAll(500));
+    EXPECT_FALSE(tree.isMember(500));
+}
+
+TEST(SplayTreeTest, SplayingDoesNotChangeCopies) {
+    Tree<int> tree(TreeBalancing::Splay);
+    for (int i : {5, 3, 8, 1, 4}) {
+        tree.insert(i);
+    }
+    Tree<int> copy = tree;
+    std::vector<int> shape;
+    copy.preLeftTraverse([&](int &el) { shape.push_back(el); });
+
+    EXPECT_TRUE(tree.isMember(5));
+    EXPECT_EQ(5, rootElement(tree));
+    std::vector<int> copy_shape;
+    copy.preLeftTraverse([&](int &el) { copy_shape.push_back(el); });
+    EXPECT_EQ(shape, copy_shape);
+    EXPECT_EQ(inOrder(copy), inOrder(tree));
+}
+
+TEST(SplayTreeTest, ConstLookupsKeepShape) {
+    Tree<int> tree(TreeBalancing::Splay);
+    for (int i = 0; i < 100; i++) {
+        tree.insert(i);
+    }
+    const Tree<int> &view = tree;
+    Tree<int>::Finger finger;
+    EXPECT_TRUE(view.isMember(0));
+    EXPECT_NE(nullptr, view.find(finger, 1));
+    EXPECT_EQ(nullptr, view.find(finger, 500));
+    EXPECT_EQ(99, rootElement(tree));
+    EXPECT_EQ(100, tree.stats().height);
+
+    EXPECT_TRUE(tree.isMember(0));
+    EXPECT_EQ(0, rootElement(tree));
+}
+
+static std::vector<int> randomElements(unsigned int seed, int count, int range) {
+    std::mt19937 generator(seed);
+    std::vector<int> elements;
+    for (int i = 0; i < count; i++) {
+        elements.push_back(generator() % range);
+    }
+    return elements;
+}
+
+TEST(TreapTest, StaysBalancedOnSortedInput) {
+    Tree<int> tree(TreeBalancing::Treap);
+    std::multiset<int> expected;
+    for (int i = 0; i < 20000; i++) {
+        tree.insert(i / 2);
+        expected.insert(i / 2);
+    }
+    EXPECT_GT(60, tree.stats().height);
+    for (int i = 0; i < 20000; i += 3) {
+        EXPECT_EQ(expected.erase(i), tree.removeAll(i));
+    }
+    EXPECT_GT(60, tree.stats().height);
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), inOrder(tree));
+    EXPECT_EQ(2, tree.countElements(1));
+    EXPECT_EQ(0, tree.countElements(3));
+}
+
+TEST(TreapTest, SplitAndJoin) {
+    Tree<int> tree(TreeBalancing::Treap);
+    std::vector<int> elements = randomElements(3, 5000, 1000);
+    for (int el : elements) {
+        tree.insert(el);
+    }
+    Tree<int> copy = tree;
+
+    Tree<int> greater = tree.split(499);
+    std::multiset<int> all(elements.begin(), elements.end());
+    std::vector<int> low(all.begin(), all.upper_bound(499)), high(all.upper_bound(499), all.end());
+    EXPECT_EQ(low, inOrder(tree));
+    EXPECT_EQ(high, inOrder(greater));
+    EXPECT_EQ(low.size(), tree.size());
+    EXPECT_EQ(high.size(), greater.size());
+    EXPECT_EQ(TreeBalancing::Treap, greater.balancingPolicy());
+    EXPECT_EQ(5000, copy.size());
+    EXPECT_EQ(std::vector<int>(all.begin(), all.end()), inOrder(copy));
+
+    EXPECT_THROW(greater.join(copy), std::string);
+    tree.join(greater);
+    EXPECT_EQ(5000, tree.size());
+    EXPECT_EQ(std::vector<int>(all.begin(), all.end()), inOrder(tree));
+    EXPECT_GT(40, tree.stats().height);
+
+    Tree<int> everything = tree.split(1000);
+    EXPECT_EQ(0, everything.size());
+    Tree<int> nothing;
+    EXPECT_EQ(5000, nothing.split(-1).size() + tree.split(-1).size());
+    EXPECT_EQ(0, tree.size());
+}
+
+TEST(TreapTest, CopiesKeepPrioritiesAndSizes) {
+    Tree<int> tree(TreeBalancing::Treap);
+    std::vector<Tree<int>> versions;
+    std::multiset<int> expected;
+    for (int i = 0; i < 20000; i++) {
+        // every insert clones the path shared with the previous version
+        versions.push_back(tree);
+        tree.insert(i);
+        expected.insert(i);
+        if ( i % 5 == 0 ) {
+            expected.erase(expected.find(i / 2));
+            tree.remove(i / 2);
+        }
+    }
+    EXPECT_GT(60, tree.stats().height);
+    tree.removeAll([](const int &x) { return x % 3 == 0; });
+    for (auto it = expected.begin(); it != expected.end();) {
+        it = *it % 3 == 0 ? expected.erase(it) : std::next(it);
+    }
+
+    for (int key : {-1, 7000, 12345, 19999}) {
+        Tree<int> part = tree;
+        Tree<int> greater = part.split(key);
+        EXPECT_EQ(std::distance(expected.begin(), expected.upper_bound(key)), part.size()) << key;
+        EXPECT_EQ(std::distance(expected.upper_bound(key), expected.end()), greater.size()) << key;
+    }
+    EXPECT_EQ(800, versions[1000].size());
+}
+
+TEST(TreapTest, ShapeTrackingCoversJoinAndRemoval) {
+    Tree<int> tree(TreeBalancing::Treap);
+    for (int el : randomElements(4, 3000, 100000)) {
+        tree.insert(el);
+    }
+    tree.trackShape(true);
+    Tree<int> greater = tree.split(50000);
+    greater.trackShape(true);
+    tree.join(greater);
+    EXPECT_LE(tree.stats().max_depth, tree.shapeTracking().max_depth);
+    EXPECT_GT(80, tree.shapeTracking().max_depth);
+
+    for (int el : randomElements(4, 1500, 100000)) {
+        tree.remove(el);
+        ASSERT_LE(tree.stats().max_depth, tree.shapeTracking().max_depth);
+    }
+    Tree<int> untracked = Tree<int>(TreeBalancing::Treap).split(0);
+    untracked.insert(200000);
+    tree.join(untracked);
+    EXPECT_LE(tree.stats().max_depth, tree.shapeTracking().max_depth);
+}
+
+TEST(TreapTest, UnionAndIntersection) {
+    std::vector<int> first = randomElements(5, 3000, 2000), second = randomElements(6, 2000, 4000);
+    Tree<int> a(TreeBalancing::Treap), b(TreeBalancing::Treap);
+    for (int el : first) {
+        a.insert(el);
+    }
+    for (int el : second) {
+        b.insert(el);
+    }
+
+    Tree<int> united = Tree<int>::unite(a, b);
+    std::multiset<int> sum(first.begin(), first.end());
+    sum.insert(second.begin(), second.end());
+    EXPECT_EQ(std::vector<int>(sum.begin(), sum.end()), inOrder(united));
+    EXPECT_EQ(5000, united.size());
+    EXPECT_GT(50, united.stats().height);
+
+    Tree<int> common = Tree<int>::intersect(a, b);
+    std::set<int> in_second(second.begin(), second.end());
+    std::multiset<int> expected;
+    for (int el : first) {
+        if ( in_second.count(el) != 0 ) {
+            expected.insert(el);
+        }
+    }
+    EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), inOrder(common));
+    EXPECT_EQ(expected.size(), common.size());
+
+    // arguments are left intact
+    EXPECT_EQ(3000, a.size());
+    std::multiset<int> first_set(first.begin(), first.end());
+    EXPECT_EQ(std::vector<int>(first_set.begin(), first_set.end()), inOrder(a));
+    EXPECT_EQ(2000, inOrder(b).size());
+}
+
+TEST(TreapTest, OnlyTreapNodesCarryPriorities) {
+    std::vector<int> elements = randomElements(7, 2000, 10000);
+    Tree<int> plain, treap(TreeBalancing::Treap);
+    for (int el : elements) {
+        plain.insert(el);
+        treap.insert(el);
+    }
+    EXPECT_LT(plain.stats().node_bytes, treap.stats().node_bytes);
+
+    // a plain tree is copied into treap nodes before it is united with a treap
+    Tree<int> united = Tree<int>::unite(treap, plain);
+    EXPECT_EQ(4000, united.size());
+    EXPECT_GT(50, united.stats().height);
+    Tree<int> greater = united.split(5000);
+    std::multiset<int> expected(elements.begin(), elements.end());
+    EXPECT_EQ(2 * std::distance(expected.begin(), expected.upper_bound(5000)), united.size());
+    EXPECT_EQ(2 * std::distance(expected.upper_bound(5000), expected.end()), greater.size());
+}
+
+// floor(log_{3/2}(size)) + 1 levels
+static unsigned int scapegoatHeightLimit(unsigned int size) {
+    unsigned int levels = 1;
+    for (double reach = 1.5; reach <= size; reach *= 1.5) {
+        levels++;
+    }
+    return levels;
+}
+
+TEST(ScapegoatTest, StaysBalancedOnSortedInput) {
+    Tree<int> tree(TreeBalancing::Scapegoat);
+    for (int i = 0; i < 5000; i++) {
+        tree.insert(i);
+        if ( i % 97 == 0 ) {
+            ASSERT_GE(scapegoatHeightLimit(tree.size()), tree.stats().height);
+        }
+    }
+    EXPECT_GE(scapegoatHeightLimit(tree.size()), tree.stats().height);
+    for (int i = 4999; i >= 0; i--) {
+        tree.insert(i);
+    }
+    EXPECT_GE(scapegoatHeightLimit(tree.size()), tree.stats().height);
+    EXPECT_EQ(10000, tree.size());
+    EXPECT_EQ(2, tree.countElements(4321));
+}
+
+TEST(ScapegoatTest, KeepsContentsOfMultiset) {
+    Tree<int> tree(TreeBalancing::Scapegoat);
+    std::multiset<int> expected;
+    std::vector<int> elements = randomElements(7, 6000, 500);
+    for (int el : elements) {
+        tree.insert(el);
+        expected.insert(el);
+    }
+    Tree<int> copy = tree;
+    for (int i = 0; i < 500; i += 2) {
+        EXPECT_EQ(expected.erase(i), tree.removeAll(i));
+    }
+    for (int i = 1; i < 500; i += 6) {
+        auto found = expected.find(i);
+        EXPECT_EQ(found != expected.end() ? 1 : 0, tree.remove(i));
+        if ( found != expected.end() ) {
+            expected.erase(found);
+        }
+    }
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), inOrder(tree));
+    EXPECT_GE(scapegoatHeightLimit(tree.size()), tree.stats().height);
+    std::sort(elements.begin(), elements.end());
+    EXPECT_EQ(elements, inOrder(copy));
+}
+
+TEST(ScapegoatTest, ShrinkRebuildsCompleteTree) {
+    Tree<int> tree(TreeBalancing::Scapegoat);
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i);
+    }
+    Tree<int> copy = tree;
+    std::vector<int> copy_shape;
+    copy.preLeftTraverse([&](const int &el) { copy_shape.push_back(el); });
+
+    // the tree is rebuilt once it drops below 2/3 of 1000 elements
+    for (int i = 0; i < 334; i++) {
+        tree.remove(i);
+    }
+    TreeStats rebuilt = tree.stats();
+    EXPECT_EQ(666, rebuilt.size);
+    EXPECT_EQ(10, rebuilt.height);
+    EXPECT_EQ(512 - 1, std::accumulate(rebuilt.depth_histogram.begin(), rebuilt.depth_histogram.end() - 1, 0u));
+
+    std::vector<int> shape;
+    copy.preLeftTraverse([&](const int &el) { shape.push_back(el); });
+    EXPECT_EQ(copy_shape, shape);
+    EXPECT_EQ(1000, inOrder(copy).size());
+}
+
+TEST(ScapegoatTest, NodesKeepNoBalanceData) {
+    Tree<int> plain, scapegoat(TreeBalancing::Scapegoat);
+    for (int el : randomElements(8, 2000, 10000)) {
+        plain.insert(el);
+        scapegoat.insert(el);
+    }
+    EXPECT_EQ(plain.stats().node_bytes, scapegoat.stats().node_bytes);
+}
+
+TEST(ScapegoatTest, IntersectionKeepsEqualElements) {
+    Tree<int> sevens(TreeBalancing::Scapegoat), seven(TreeBalancing::Scapegoat);
+    for (int i = 0; i < 8; i++) {
+        sevens.insert(7);
+    }
+    seven.insert(7);
+    EXPECT_EQ(8, Tree<int>::intersect(sevens, seven).size());
+    EXPECT_EQ(1, Tree<int>::intersect(seven, sevens).size());
+
+    // rebuilds and treap rotations put equal elements into right subtrees
+    for (TreeBalancing balancing : {TreeBalancing::None, TreeBalancing::Treap, TreeBalancing::Scapegoat}) {
+        std::vector<int> first = randomElements(9, 3000, 300), second = randomElements(10, 100, 600);
+        Tree<int> a(balancing), b(balancing);
+        for (int el : first) {
+            a.insert(el);
+        }
+        for (int el : second) {
+            b.insert(el);
+        }
+        std::set<int> in_second(second.begin(), second.end());
+        std::multiset<int> expected;
+        for (int el : first) {
+            if ( in_second.count(el) != 0 ) {
+                expected.insert(el);
+            }
+        }
+        Tree<int> common = Tree<int>::intersect(a, b);
+        EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), inOrder(common));
+        EXPECT_EQ(expected.size(), common.size());
+    }
+}
@@ -0,0 +1,446 @@
+// Micro and macro benchmarks of Tree operations.
+//
+// Usage: tree_benchmarks [--tree_max_size=N] [google benchmark flags]
+// Every benchmark is named operation/key/distribution/size, for example
+// lookup/string/zipf/1000000, so --benchmark_filter selects any slice.
+// Sizes go from 1e3 by powers of ten up to --tree_max_size (1e6 by default,
+// up to 1e8). Sorted and reverse inputs turn the unbalanced tree into a
+// list, so they are limited to 1e4 elements. Keys come from fixed seeds and
+// are identical across runs; record results for regression tracking with
+// --benchmark_out=results.json --benchmark_out_format=json.
+// Insert, lookup and remove are also measured for every balancing policy on
+// uniform and Zipf inputs; their names end with the policy, for example
+// lookup/int/zipf/1000000/splay. HashIndexedTree is measured the same way
+// under the name hashed, with memory of its index per element reported in
+// the index_bytes_per_element counter. LsmTree ingest is measured on
+// uniform and sorted inputs of every size under the name lsm-insert, for
+// example lsm-insert/int/sorted/1000000; it includes draining compactions.
+
+#include "Tree.h"
+#include "HashIndexedTree.h"
+#include "LsmTree.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const uint64_t SEED = 42;
+static const size_t DEGENERATE_LIMIT = 10000;
+static const size_t BATCH = 1000;
+
+enum Distribution { Uniform, Sorted, Reverse, Zipf, Duplicates };
+
+static const char *distributionName(Distribution distribution) {
+    static const char *names[] = {"uniform", "sorted", "reverse", "zipf", "duplicates"};
+    return names[distribution];
+}
+
+static const TreeBalancing POLICIES[] = {TreeBalancing::Splay, TreeBalancing::Treap, TreeBalancing::Scapegoat};
+
+static const char *policyName(TreeBalancing balancing) {
+    switch (balancing) {
+        case TreeBalancing::Splay: return "splay";
+        case TreeBalancing::Treap: return "treap";
+        case TreeBalancing::Scapegoat: return "scapegoat";
+        default: return "none";
+    }
+}
+
+template<typename Key>
+Key makeKey(uint64_t value);
+
+template<>
+int makeKey<int>(uint64_t value) {
+    return (int) (value & 0x7fffffff);
+}
+
+template<>
+double makeKey<double>(uint64_t value) {
+    return (double) value / 3.0;
+}
+
+template<>
+string makeKey<string>(uint64_t value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "key-%016llx", (unsigned long long) value);
+    return buffer;
+}
+
+// Spreads ranks over key space, keeps distinct ranks distinct below 2^31.
+static uint64_t scatter(uint64_t rank) {
+    return (rank * 2654435761ULL) & 0x7fffffff;
+}
+
+static vector<uint64_t> makeValues(Distribution distribution, size_t count) {
+    mt19937_64 generator(SEED + distribution);
+    vector<uint64_t> values(count);
+    for (size_t i = 0; i < count; i++) {
+        switch (distribution) {
+            case Uniform:
+                values[i] = generator() & 0x7fffffff;
+                break;
+            case Sorted:
+                values[i] = i * 16;
+                break;
+            case Reverse:
+                values[i] = (count - i) * 16;
+                break;
+            case Zipf: {
+                // inverse of continuous Zipf (s = 1) distribution over count ranks
+                double u = uniform_real_distribution<double>(0.0, 1.0)(generator);
+                values[i] = scatter((uint64_t) (exp(u * log((double) count + 1.0)) - 1.0));
+                break;
+            }
+            case Duplicates:
+                values[i] = scatter(generator() % (count / 100 + 1));
+                break;
+        }
+    }
+    return values;
+}
+
+// Keys and tree of the latest requested workload; benchmarks of one
+// workload run one after another, so they share it instead of rebuilding.
+template<typename Key>
+struct Workload {
+    static Workload &get(Distribution distribution, size_t size, TreeBalancing balancing = TreeBalancing::None) {
+        static unique_ptr<Workload> current;
+        if ( !current || current->distribution != distribution || current->keys.size() != size ||
+             current->tree.balancingPolicy() != balancing ) {
+            current.reset();
+            current.reset(new Workload(distribution, size, balancing));
+        }
+        return *current;
+    }
+
+    Workload(Distribution distribution, size_t size, TreeBalancing balancing)
+            : distribution(distribution), tree(balancing) {
+        for (uint64_t value : makeValues(distribution, size)) {
+            keys.push_back(makeKey<Key>(value));
+        }
+        for (auto &key : keys) {
+            tree.insert(key);
+        }
+        probes = keys;
+        shuffle(probes.begin(), probes.end(), mt19937_64(SEED));
+    }
+
+    const Key &probe(size_t i) const {
+        return probes[i % probes.size()];
+    }
+
+    Distribution distribution;
+    vector<Key> keys;
+    vector<Key> probes;
+    Tree<Key> tree;
+};
+
+template<typename Key>
+void insertBenchmark(benchmark::State &state, Distribution distribution, size_t size,
+                     TreeBalancing balancing) {
+    vector<Key> keys = Workload<Key>::get(distribution, size, balancing).keys;
+    for (auto _ : state) {
+        Tree<Key> tree(balancing);
+        for (auto &key : keys) {
+            tree.insert(key);
+        }
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+template<typename Key>
+void lookupBenchmark(benchmark::State &state, Distribution distribution, size_t size,
+                     TreeBalancing balancing) {
+    auto &workload = Workload<Key>::get(distribution, size, balancing);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(workload.tree.isMember(workload.probe(i++)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Key>
+void countBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(workload.tree.countElements(workload.probe(i++)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Removes a batch of present keys, then puts them back outside of timing.
+template<typename Key>
+void removeBenchmark(benchmark::State &state, Distribution distribution, size_t size, bool all,
+                     TreeBalancing balancing) {
+    auto &workload = Workload<Key>::get(distribution, size, balancing);
+    size_t batch = min(BATCH, size), next = 0, removed = 0;
+    vector<Key> taken;
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            const Key &key = workload.probe(next + i);
+            unsigned int count = all ? workload.tree.removeAll(key) : workload.tree.remove(key);
+            taken.insert(taken.end(), count, key);
+            removed++;
+        }
+        state.PauseTiming();
+        for (auto &key : taken) {
+            workload.tree.insert(key);
+        }
+        taken.clear();
+        next += batch;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(removed);
+}
+
+template<typename Key>
+void traverseBenchmark(benchmark::State &state, Distribution distribution, size_t size, int order) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    size_t visited = 0;
+    auto visit = [&](Key &) { visited++; };
+    for (auto _ : state) {
+        switch (order) {
+            case 0: workload.tree.inOrderTraverse(visit); break;
+            case 1: workload.tree.preLeftTraverse(visit); break;
+            case 2: workload.tree.postLeftTraverse(visit); break;
+            default: workload.tree.inOppositeOrderTraverse(visit); break;
+        }
+    }
+    benchmark::DoNotOptimize(visited);
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+// Range covering about one percent of the elements.
+template<typename Key>
+void rangeBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    vector<Key> sorted = workload.keys;
+    sort(sorted.begin(), sorted.end());
+    size_t width = max<size_t>(1, size / 100), i = 0, visited = 0;
+    for (auto _ : state) {
+        size_t low = (i++ * 7919) % (size - width + 1);
+        workload.tree.inRangeTraverse(sorted[low], sorted[low + width - 1], [&](Key &) { visited++; });
+    }
+    state.SetItemsProcessed(visited);
+}
+
+template<typename Key>
+void makeSubtreeBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    for (auto _ : state) {
+        bool take = false;
+        auto subtree = workload.tree.makeElementsSubtree([&](const Key &) { return take = !take; });
+        benchmark::DoNotOptimize(subtree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+template<typename Key>
+void getSubtreeBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    size_t i = 0;
+    for (auto _ : state) {
+        auto subtree = workload.tree.getSubtreeFromElement(workload.probe(i++));
+        benchmark::DoNotOptimize(subtree.size());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Tree with hash index over keys of the matching Workload.
+template<typename Key>
+struct HashedWorkload {
+    static HashedWorkload &get(Distribution distribution, size_t size) {
+        static unique_ptr<HashedWorkload> current;
+        if ( !current || current->distribution != distribution || current->size != size ) {
+            current.reset();
+            current.reset(new HashedWorkload(distribution, size));
+        }
+        return *current;
+    }
+
+    HashedWorkload(Distribution distribution, size_t size) : distribution(distribution), size(size) {
+        for (auto &key : Workload<Key>::get(distribution, size).keys) {
+            tree.insert(key);
+        }
+    }
+
+    Distribution distribution;
+    size_t size;
+    HashIndexedTree<Key> tree;
+};
+
+// insertion pays for the tree and the index, which is the cost of keeping them in sync
+template<typename Key>
+void hashedInsertBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    vector<Key> keys = Workload<Key>::get(distribution, size).keys;
+    size_t index_bytes = 0;
+    for (auto _ : state) {
+        HashIndexedTree<Key> tree;
+        for (auto &key : keys) {
+            tree.insert(key);
+        }
+        index_bytes = tree.indexBytes();
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+    state.counters["index_bytes_per_element"] = (double) index_bytes / size;
+}
+
+template<typename Key>
+void hashedLookupBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    auto &hashed = HashedWorkload<Key>::get(distribution, size);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashed.tree.isMember(workload.probe(i++)));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["index_bytes_per_element"] = (double) hashed.tree.indexBytes() / size;
+}
+
+template<typename Key>
+void hashedRemoveBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    auto &workload = Workload<Key>::get(distribution, size);
+    auto &hashed = HashedWorkload<Key>::get(distribution, size);
+    size_t batch = min(BATCH, size), next = 0, removed = 0;
+    vector<Key> taken;
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            const Key &key = workload.probe(next + i);
+            taken.insert(taken.end(), hashed.tree.remove(key), key);
+            removed++;
+        }
+        state.PauseTiming();
+        for (auto &key : taken) {
+            hashed.tree.insert(key);
+        }
+        taken.clear();
+        next += batch;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(removed);
+}
+
+// keys are made directly, sorted ones would degenerate the tree of a workload
+template<typename Key>
+void lsmInsertBenchmark(benchmark::State &state, Distribution distribution, size_t size) {
+    vector<Key> keys;
+    for (uint64_t value : makeValues(distribution, size)) {
+        keys.push_back(makeKey<Key>(value));
+    }
+    for (auto _ : state) {
+        LsmTree<Key> lsm;
+        for (auto &key : keys) {
+            lsm.insert(key);
+        }
+        lsm.waitForCompaction();
+        benchmark::DoNotOptimize(lsm.size());
+    }
+    state.SetItemsProcessed(state.iterations() * size);
+}
+
+template<typename Key>
+void registerBenchmarks(const char *key_name, size_t max_size) {
+    const Distribution distributions[] = {Uniform, Sorted, Reverse, Zipf, Duplicates};
+    const char *orders[] = {"in-order", "pre-left", "post-left", "in-opposite-order"};
+    for (Distribution distribution : distributions) {
+        size_t limit = distribution == Sorted || distribution == Reverse ? min(max_size, DEGENERATE_LIMIT) : max_size;
+        for (size_t size = 1000; size <= limit; size *= 10) {
+            string suffix = string("/") + key_name + "/" + distributionName(distribution) + "/" + to_string(size);
+            benchmark::RegisterBenchmark(("insert" + suffix).c_str(), insertBenchmark<Key>, distribution, size,
+                                         TreeBalancing::None)
+                    ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("lookup" + suffix).c_str(), lookupBenchmark<Key>, distribution, size,
+                                         TreeBalancing::None);
+            benchmark::RegisterBenchmark(("count" + suffix).c_str(), countBenchmark<Key>, distribution, size);
+            benchmark::RegisterBenchmark(("remove" + suffix).c_str(), removeBenchmark<Key>, distribution, size, false,
+                                         TreeBalancing::None);
+            benchmark::RegisterBenchmark(("removeAll" + suffix).c_str(), removeBenchmark<Key>, distribution, size, true,
+                                         TreeBalancing::None);
+            for (int order = 0; order < 4; order++) {
+                benchmark::RegisterBenchmark((string("traverse-") + orders[order] + suffix).c_str(),
+                                             traverseBenchmark<Key>, distribution, size, order)
+                        ->Unit(benchmark::kMillisecond);
+            }
+            benchmark::RegisterBenchmark(("range" + suffix).c_str(), rangeBenchmark<Key>, distribution, size);
+            benchmark::RegisterBenchmark(("makeElementsSubtree" + suffix).c_str(), makeSubtreeBenchmark<Key>,
+                                         distribution, size)->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("getSubtreeFromElement" + suffix).c_str(), getSubtreeBenchmark<Key>,
+                                         distribution, size);
+        }
+    }
+    // balancing policies against plain tree on random and skewed inputs
+    for (TreeBalancing balancing : POLICIES) {
+        for (Distribution distribution : {Uniform, Zipf}) {
+            for (size_t size = 1000; size <= max_size; size *= 10) {
+                string suffix = string("/") + key_name + "/" + distributionName(distribution) + "/" +
+                                to_string(size) + "/" + policyName(balancing);
+                benchmark::RegisterBenchmark(("insert" + suffix).c_str(), insertBenchmark<Key>, distribution, size,
+                                             balancing)->Unit(benchmark::kMillisecond);
+                benchmark::RegisterBenchmark(("lookup" + suffix).c_str(), lookupBenchmark<Key>, distribution, size,
+                                             balancing);
+                benchmark::RegisterBenchmark(("remove" + suffix).c_str(), removeBenchmark<Key>, distribution, size,
+                                             false, balancing);
+            }
+        }
+    }
+    // write optimized multiset, sorted keys must not slow its memtable down
+    for (Distribution distribution : {Uniform, Sorted}) {
+        for (size_t size = 1000; size <= max_size; size *= 10) {
+            string suffix = string("/") + key_name + "/" + distributionName(distribution) + "/" + to_string(size);
+            benchmark::RegisterBenchmark(("lsm-insert" + suffix).c_str(), lsmInsertBenchmark<Key>, distribution,
+                                         size)->Unit(benchmark::kMillisecond);
+        }
+    }
+    // hash index next to the plain tree
+    for (Distribution distribution : {Uniform, Zipf}) {
+        for (size_t size = 1000; size <= max_size; size *= 10) {
+            string suffix = string("/") + key_name + "/" + distributionName(distribution) + "/" +
+                            to_string(size) + "/hashed";
+            benchmark::RegisterBenchmark(("insert" + suffix).c_str(), hashedInsertBenchmark<Key>, distribution, size)
+                    ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("lookup" + suffix).c_str(), hashedLookupBenchmark<Key>, distribution, size);
+            benchmark::RegisterBenchmark(("remove" + suffix).c_str(), hashedRemoveBenchmark<Key>, distribution, size);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t max_size = 1000000;
+    const char *size_flag = "--tree_max_size=";
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if ( strncmp(argv[i], size_flag, strlen(size_flag)) == 0 ) {
+            max_size = (size_t) atof(argv[i] + strlen(size_flag));
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    registerBenchmarks<int>("int", max_size);
+    registerBenchmarks<double>("double", max_size);
+    registerBenchmarks<string>("string", max_size);
+
+    benchmark::Initialize(&argc, argv);
+    if ( benchmark::ReportUnrecognizedArguments(argc, argv) ) {
+        return 1;
+    }
+    benchmark::AddCustomContext("seed", to_string(SEED));
+    benchmark::AddCustomContext("tree_max_size", to_string(max_size));
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+#include "Tree.h"
+
+#include <thread>
+
+class TreeCountersTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        // perfectly balanced tree of 1..7
+        for (int x : {4, 2, 6, 1, 3, 5, 7}) {
+            tree.insert(x);
+        }
+        resetTreeCounters();
+    }
+
+    Tree<int> tree;
+};
+
+TEST_F(TreeCountersTest, SearchCosts) {
+    EXPECT_TRUE(tree.isMember(4));
+    EXPECT_EQ(1, treeCounters().comparisons);
+    EXPECT_EQ(1, treeCounters().node_visits);
+
+    EXPECT_FALSE(tree.isMember(8));
+    EXPECT_EQ(4, treeCounters().comparisons);
+    EXPECT_EQ(4, treeCounters().node_visits);
+    EXPECT_EQ(0, treeCounters().allocations);
+
+    // plain insert searches from the root
+    resetTreeCounters();
+    tree.insert(8);
+    EXPECT_EQ(3, treeCounters().comparisons);
+    EXPECT_EQ(1, treeCounters().allocations);
+
+    // 9 was inserted last, so 10 goes next to it: one bound check and one step
+    tree.trackLastInsert(true);
+    tree.insert(9);
+    resetTreeCounters();
+    tree.insert(10);
+    EXPECT_EQ(2, treeCounters().comparisons);
+
+    // far from the last insertion: the bound check and full path
+    resetTreeCounters();
+    tree.insert(0);
+    EXPECT_EQ(4, treeCounters().comparisons);
+}
+
+TEST_F(TreeCountersTest, FingerCosts) {
+    Tree<int> sorted;
+    sorted.trackLastInsert(true);
+    for (int x = 0; x < 1000; x++) {
+        sorted.insert(x);
+    }
+    // unbalanced chain, yet every insertion started at the previous one
+    EXPECT_GT(3000, treeCounters().comparisons);
+
+    Tree<int>::Finger finger;
+    sorted.find(finger, 500);
+    resetTreeCounters();
+    for (int x = 501; x < 600; x++) {
+        EXPECT_NE(nullptr, sorted.find(finger, x));
+    }
+    EXPECT_GT(400, treeCounters().comparisons);
+}
+
+TEST_F(TreeCountersTest, TraversalAndCopyOnWriteCosts) {
+    tree.inOrderTraverse([](int &) { });
+    EXPECT_EQ(7, treeCounters().node_visits);
+    EXPECT_EQ(0, treeCounters().comparisons);
+
+    // copy shares all nodes, so removal clones the path to the removed leaf
+    Tree<int> copy = tree;
+    resetTreeCounters();
+    EXPECT_EQ(1, copy.remove(7));
+    EXPECT_EQ(3, treeCounters().allocations);
+    EXPECT_TRUE(tree.isMember(7));
+}
+
+TEST_F(TreeCountersTest, CountersArePerThread) {
+    tree.isMember(1);
+    std::thread other([&]() {
+        EXPECT_EQ(0, treeCounters().comparisons);
+        tree.isMember(7);
+        EXPECT_EQ(3, treeCounters().comparisons);
+    });
+    other.join();
+    EXPECT_EQ(3, treeCounters().comparisons);
+}
@@ -0,0 +1,88 @@
+#include "gtest/gtest.h"
+#include "Tree.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+class TreeDiffTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        for (int x : {4, 2, 6, 1, 3, 5, 7}) {
+            tree.insert(x);
+        }
+    }
+
+    static bool hasMove(const TreeDiff<int> &diff, int el, unsigned int from, unsigned int to, bool subtree) {
+        return std::any_of(diff.moved.begin(), diff.moved.end(), [&](const TreeDiff<int>::Move &move) {
+            return move.element == el && move.old_depth == from && move.new_depth == to && move.subtree == subtree;
+        });
+    }
+
+    Tree<int> tree;
+};
+
+TEST_F(TreeDiffTest, AddedAndRemovedElements) {
+    Tree<int> after = tree;
+    EXPECT_TRUE(Tree<int>::diff(tree, after).empty());
+    EXPECT_EQ(0, Tree<int>::diff(tree, after).examined_nodes);
+
+    after.insert(8);
+    after.insert(3);
+    after.remove(1);
+    TreeDiff<int> diff = Tree<int>::diff(tree, after);
+    EXPECT_EQ(std::vector<int>({3, 8}), diff.added);
+    EXPECT_EQ(std::vector<int>({1}), diff.removed);
+    EXPECT_TRUE(diff.moved.empty());
+
+    // same elements in unrelated nodes
+    Tree<int> rebuilt;
+    for (int x : {4, 2, 6, 1, 3, 5, 7}) {
+        rebuilt.insert(x);
+    }
+    EXPECT_TRUE(Tree<int>::diff(tree, rebuilt).empty());
+    EXPECT_EQ(14, Tree<int>::diff(tree, rebuilt).examined_nodes);
+
+    TreeDiff<int> to_empty = Tree<int>::diff(tree, Tree<int>());
+    EXPECT_EQ(std::vector<int>({1, 2, 3, 4, 5, 6, 7}), to_empty.removed);
+    EXPECT_EQ(std::vector<int>({1, 2, 3, 4, 5, 6, 7}), Tree<int>::diff(Tree<int>(), tree).added);
+}
+
+TEST_F(TreeDiffTest, MovedNodesAndSubtrees) {
+    Tree<int> after = tree;
+    // right subtree is promoted to root, left one goes under 5
+    after.remove(4);
+    TreeDiff<int> diff = Tree<int>::diff(tree, after);
+
+    EXPECT_TRUE(diff.added.empty());
+    EXPECT_EQ(std::vector<int>({4}), diff.removed);
+    EXPECT_EQ(4, diff.moved.size());
+    EXPECT_TRUE(hasMove(diff, 6, 1, 0, false));
+    EXPECT_TRUE(hasMove(diff, 5, 2, 1, false));
+    EXPECT_TRUE(hasMove(diff, 2, 1, 2, true));
+    EXPECT_TRUE(hasMove(diff, 7, 2, 1, true));
+
+    PersistentTree<int> first(tree);
+    PersistentTree<int> second = first.remove(4);
+    EXPECT_EQ(4, first.diff(second).moved.size());
+    EXPECT_EQ(std::vector<int>({4}), second.diff(first).added);
+}
+
+TEST_F(TreeDiffTest, CostFollowsChangedRegion) {
+    Tree<int> big;
+    std::mt19937 generator(42);
+    for (int i = 0; i < 100000; i++) {
+        big.insert(generator() % 1000000);
+    }
+    Tree<int> after = big;
+    for (int i = 0; i < 10; i++) {
+        after.insert(generator() % 1000000);
+    }
+    TreeDiff<int> diff = Tree<int>::diff(big, after);
+
+    EXPECT_EQ(10, diff.added.size());
+    EXPECT_TRUE(diff.removed.empty());
+    EXPECT_TRUE(diff.moved.empty());
+    EXPECT_LT(diff.examined_nodes, 2000);
+}
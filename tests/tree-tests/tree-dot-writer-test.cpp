@@ -0,0 +1,85 @@
+#include "gtest/gtest.h"
+#include "tree-vizualization/TreeDotWriter.h"
+
+#include <sstream>
+#include <string>
+
+TEST(TreeDotWriterTest, WritesNodesAndOrderedEdges) {
+    Tree<int> tree;
+    for (int el : {5, 3, 8, 4}) {
+        tree.insert(el);
+    }
+    std::ostringstream out;
+    TreeDotWriter(out).write(tree);
+
+    EXPECT_EQ("digraph G {\n"
+              "n0 [label=\"5\"];\n"
+              "n0 -> n1;\n"
+              "n0 -> n2;\n"
+              "n1 [label=\"3\"];\n"
+              "n1 -> n3;\n"
+              "n3 [label=\"4\"];\n"
+              "n2 [label=\"8\"];\n"
+              "}\n", out.str());
+
+    std::ostringstream with_nulls;
+    TreeDotWriter(with_nulls, true).write(tree);
+    EXPECT_NE(std::string::npos, with_nulls.str().find("n1 -> n3;\nn3 [label=\"NULL\"];\nn1 -> n4;\n"));
+
+    std::ostringstream empty;
+    TreeDotWriter(empty).write(Tree<int>());
+    EXPECT_EQ("digraph G {\n}\n", empty.str());
+}
+
+TEST(TreeDotWriterTest, EscapesLabelsAndHandlesDegenerateTree) {
+    Tree<std::string> strings;
+    strings.insert("say \"hi\"\\");
+    std::ostringstream out;
+    TreeDotWriter(out).write(strings);
+    EXPECT_NE(std::string::npos, out.str().find("[label=\"say \\\"hi\\\"\\\\\"]"));
+
+    // list shaped tree, every level waits on the explicit stack
+    Tree<int> list;
+    const int size = 5000;
+    for (int i = 0; i < size; i++) {
+        list.insert(i);
+    }
+    std::ostringstream dot;
+    TreeDotWriter(dot).write(list);
+    std::string text = dot.str();
+    size_t edges = 0;
+    for (size_t at = text.find("->"); at != std::string::npos; at = text.find("->", at + 2)) {
+        edges++;
+    }
+    EXPECT_EQ(size - 1, edges);
+}
+
+TEST(TreeDotWriterTest, CollapsesSubtreesIntoSummaries) {
+    Tree<int> tree;
+    for (int el : {50, 20, 80, 10, 30, 70, 90, 25}) {
+        tree.insert(el);
+    }
+    TreeDotOptions options;
+    options.max_depth = 1;
+    std::ostringstream out;
+    TreeDotWriter(out, options).write(tree);
+    std::string text = out.str();
+
+    EXPECT_NE(std::string::npos, text.find("n1 [label=\"20\"];"));
+    EXPECT_NE(std::string::npos, text.find("n3 [shape=box, style=dashed, label=\"size 1\\n10 .. 10\\nheight 1\"];"));
+    EXPECT_NE(std::string::npos, text.find("n4 [shape=box, style=dashed, label=\"size 2\\n25 .. 30\\nheight 2\"];"));
+    EXPECT_EQ(std::string::npos, text.find("label=\"25\""));
+
+    options.summary_budget = 1;
+    std::ostringstream bounded;
+    TreeDotWriter(bounded, options).write(tree);
+    EXPECT_NE(std::string::npos, bounded.str().find("label=\"size >=1\\n25 .. 30\\nheight >=1\""));
+
+    TreeDotOptions sampled;
+    sampled.sample_rate = 0;
+    std::ostringstream root_only;
+    TreeDotWriter(root_only, sampled).write(tree);
+    EXPECT_NE(std::string::npos, root_only.str().find("n0 [label=\"50\"];"));
+    EXPECT_NE(std::string::npos, root_only.str().find("n1 [shape=box, style=dashed, label=\"size 4\\n10 .. 30\\nheight 3\"];"));
+    EXPECT_NE(std::string::npos, root_only.str().find("n2 [shape=box, style=dashed, label=\"size 3\\n70 .. 90\\nheight 2\"];"));
+}
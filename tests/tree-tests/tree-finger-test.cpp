@@ -0,0 +1,143 @@
+#include "gtest/gtest.h"
+#include "Tree.h"
+
+#include <random>
+#include <set>
+#include <vector>
+
+static std::vector<int> inOrder(const Tree<int> &tree) {
+    std::vector<int> elements;
+    tree.inOrderTraverse([&](const int &el) { elements.push_back(el); });
+    return elements;
+}
+
+static void checkLocalStream(TreeBalancing balancing) {
+    Tree<int> tree(balancing);
+    std::multiset<int> expected;
+    std::mt19937 generator(11);
+    Tree<int>::Finger inserting, probing;
+    int position = 0;
+    for (int i = 0; i < 6000; i++) {
+        // mostly local stream with occasional jumps and removals
+        position = i % 500 == 0 ? (int) (generator() % 2000) : position + (int) (generator() % 7) - 2;
+        tree.insert(inserting, position);
+        expected.insert(position);
+        if ( i % 700 == 0 ) {
+            EXPECT_EQ(expected.erase(position + 1), tree.removeAll(position + 1));
+        }
+        int probe = position + (int) (generator() % 9) - 4;
+        const int *found = tree.find(probing, probe);
+        ASSERT_EQ(expected.count(probe) > 0, found != nullptr);
+        if ( found != nullptr ) {
+            EXPECT_EQ(probe, *found);
+        }
+    }
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_EQ(std::vector<int>(expected.begin(), expected.end()), inOrder(tree));
+    for (int probe = -10; probe < 2010; probe++) {
+        ASSERT_EQ(expected.count(probe), tree.countElements(probe));
+    }
+}
+
+TEST(TreeFingerTest, KeepsContentsOfMultiset) {
+    checkLocalStream(TreeBalancing::None);
+    checkLocalStream(TreeBalancing::Scapegoat);
+}
+
+TEST(TreeFingerTest, IgnoredByRestructuringPolicies) {
+    checkLocalStream(TreeBalancing::Treap);
+    checkLocalStream(TreeBalancing::Splay);
+}
+
+TEST(TreeFingerTest, CopiesAreNotChangedThroughFingers) {
+    Tree<int> tree;
+    Tree<int>::Finger finger;
+    for (int i = 0; i < 100; i++) {
+        tree.insert(finger, i);
+    }
+    Tree<int> copy = tree;
+    PersistentTree<int, ThreeWayCompare<int>> snapshot = tree.snapshot();
+    Tree<int> subtree = tree.getSubtreeFromElement(50);
+    for (int i = 100; i < 200; i++) {
+        tree.insert(finger, i);
+        tree.insert(i);
+    }
+    EXPECT_EQ(100, copy.size());
+    EXPECT_EQ(100, inOrder(copy).size());
+    EXPECT_FALSE(copy.isMember(150));
+    EXPECT_FALSE(snapshot.isMember(150));
+    EXPECT_EQ(50, inOrder(subtree).size());
+    EXPECT_EQ(300, inOrder(tree).size());
+
+    // finger of another tree is not used
+    Tree<int> other;
+    other.insert(finger, 5);
+    EXPECT_EQ(std::vector<int>({5}), inOrder(other));
+    EXPECT_EQ(nullptr, copy.find(finger, 150));
+    EXPECT_NE(nullptr, copy.find(finger, 99));
+    EXPECT_EQ(300, inOrder(tree).size());
+}
+
+TEST(TreeFingerTest, CopyingConstTreeLeavesItUntouched) {
+    Tree<int> tree;
+    Tree<int>::Finger finger;
+    for (int i = 0; i < 100; i++) {
+        tree.insert(finger, i);
+    }
+    const Tree<int> &source = tree;
+    Tree<int> copy = source;
+    Tree<int> subtree = source.getSubtreeFromElement(50);
+    for (int i = 100; i < 200; i++) {
+        tree.insert(finger, i);
+    }
+    EXPECT_EQ(100, inOrder(copy).size());
+    EXPECT_EQ(50, inOrder(subtree).size());
+    EXPECT_EQ(200, inOrder(tree).size());
+
+    // finger of a destroyed tree is not used by a new one
+    Tree<int>::Finger stale;
+    {
+        Tree<int> gone;
+        gone.insert(stale, 1);
+    }
+    Tree<int> fresh;
+    fresh.insert(stale, 2);
+    EXPECT_EQ(std::vector<int>({2}), inOrder(fresh));
+}
+
+TEST(TreeFingerTest, LastInsertTracking) {
+    Tree<int> tree;
+    tree.trackLastInsert(true);
+    for (int i = 0; i < 100; i++) {
+        tree.insert(i % 2 == 0 ? i : -i);
+    }
+    Tree<int> copy = tree;
+    for (int i = 100; i < 150; i++) {
+        tree.insert(i);
+        copy.insert(-i);
+    }
+    EXPECT_EQ(150, inOrder(tree).size());
+    EXPECT_EQ(150, inOrder(copy).size());
+    EXPECT_FALSE(copy.isMember(120));
+    EXPECT_FALSE(tree.isMember(-121));
+    tree.trackLastInsert(false);
+    tree.insert(50);
+    EXPECT_EQ(2, tree.countElements(50));
+}
+
+TEST(TreeFingerTest, EqualElements) {
+    Tree<int> tree;
+    Tree<int>::Finger finger;
+    for (int i = 0; i < 50; i++) {
+        tree.insert(finger, i % 5);
+        tree.insert(finger, 2);
+    }
+    EXPECT_EQ(60, tree.countElements(2));
+    Tree<int>::Finger probing;
+    for (int i = 4; i >= -1; i--) {
+        EXPECT_EQ(i >= 0, tree.find(probing, i) != nullptr);
+    }
+    EXPECT_EQ(60, tree.removeAll(2));
+    EXPECT_EQ(nullptr, tree.find(probing, 2));
+    EXPECT_EQ(40, tree.size());
+}
@@ -0,0 +1,25 @@
+#include "gtest/gtest.h"
+#include "tree-vizualization/TreeGraphBuilder.h"
+
+#include <sstream>
+#include <string>
+
+TEST(TreeGraphDiffTest, HighlightsChanges) {
+    Tree<int> before;
+    for (int x : {4, 2, 6, 1, 3, 5, 7}) {
+        before.insert(x);
+    }
+    Tree<int> after = before;
+    after.remove(4);
+    after.insert(8);
+
+    std::ostringstream out;
+    out << TreeGraphBuilder(before, after).getGraph();
+    std::string graph = out.str();
+
+    EXPECT_NE(std::string::npos, graph.find("[label=\"8\", style=filled, fillcolor=\"palegreen\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"6\", style=filled, fillcolor=\"orange\", xlabel=\"was d1\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"2\", style=filled, fillcolor=\"orange\", xlabel=\"was d1\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"4\", style=\"filled,dashed\", fillcolor=\"lightpink\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"1\"]"));
+}
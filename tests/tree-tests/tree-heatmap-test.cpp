@@ -0,0 +1,59 @@
+#include "gtest/gtest.h"
+#include "tree-vizualization/TreeGraphBuilder.h"
+
+#include <sstream>
+#include <string>
+
+class TreeHeatmapTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        for (int x : {4, 2, 6, 1, 3, 5, 7}) {
+            tree.insert(x);
+        }
+    }
+
+    std::string draw() {
+        std::ostringstream out;
+        out << TreeGraphBuilder(tree, true).getGraph();
+        return out.str();
+    }
+
+    Tree<int> tree;
+};
+
+TEST_F(TreeHeatmapTest, CountsSampledLookupPaths) {
+    tree.isMember(1);
+    EXPECT_NE(std::string::npos, draw().find("[label=\"4\", style=filled, fillcolor=\"#ffffff\", xlabel=\"d0: 0\"]"));
+
+    tree.sampleAccesses(1);
+    for (int i = 0; i < 3; i++) {
+        tree.isMember(1);
+    }
+    tree.isMember(3);
+    tree.sampleAccesses(0);
+    tree.isMember(7);
+
+    std::string graph = draw();
+    EXPECT_NE(std::string::npos, graph.find("[label=\"4\", style=filled, fillcolor=\"#ff0000\", xlabel=\"d0: 4\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"2\", style=filled, fillcolor=\"#ff0000\", xlabel=\"d1: 4\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"1\", style=filled, fillcolor=\"#ff2323\", xlabel=\"d2: 3\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"3\", style=filled, fillcolor=\"#ff9191\", xlabel=\"d2: 1\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"7\", style=filled, fillcolor=\"#ffffff\", xlabel=\"d2: 0\"]"));
+    EXPECT_NE(std::string::npos, graph.find("[label=\"NULL\"]"));
+}
+
+TEST_F(TreeHeatmapTest, SamplesEveryPeriodLookupAndSurvivesCopyOnWrite) {
+    tree.sampleAccesses(4);
+    for (int i = 0; i < 40; i++) {
+        tree.isMember(4);
+    }
+    Tree<int> copy = tree;
+    // unshares root, the copy keeps its counter
+    tree.insert(8);
+    EXPECT_NE(std::string::npos, draw().find("[label=\"4\", style=filled, fillcolor=\"#ff0000\", xlabel=\"d0: 10\"]"));
+
+    std::ostringstream plain;
+    plain << TreeGraphBuilder(tree).getGraph();
+    EXPECT_EQ(std::string::npos, plain.str().find("fillcolor"));
+}
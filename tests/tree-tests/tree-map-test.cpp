@@ -0,0 +1,135 @@
+#include "gtest/gtest.h"
+#include "TreeMap.h"
+
+#include <string>
+#include <vector>
+
+class TreeMapTest : public ::testing::Test {
+public:
+
+    virtual void SetUp() {
+        ages["Leha"] = 21;
+        ages["Petia"] = 34;
+        ages["Slava"] = 19;
+        ages["Andriy"] = 22;
+
+        for (int i = 0; i < 3; i++) {
+            phones.insert("Andriy", "phone" + std::to_string(i));
+        }
+        phones.insert("Anton", "home");
+        phones.insert("Vika", "work");
+    }
+
+    virtual void TearDown() {
+
+    }
+
+    TreeMap<std::string, int> ages;
+    TreeMultiMap<std::string, std::string> phones;
+};
+
+TEST_F(TreeMapTest, FindAndSubscript) {
+    EXPECT_EQ(4, ages.size());
+    ASSERT_NE(nullptr, ages.find("Petia"));
+    EXPECT_EQ(34, *ages.find("Petia"));
+    EXPECT_EQ(nullptr, ages.find("Vika"));
+    EXPECT_FALSE(ages.isMember("Vika"));
+
+    ages["Petia"]++;
+    EXPECT_EQ(35, *ages.find("Petia"));
+    EXPECT_EQ(0, ages["Vika"]) << "Subscript inserts default value";
+    EXPECT_EQ(5, ages.size());
+}
+
+TEST_F(TreeMapTest, TryEmplaceAndInsertOrAssign) {
+    EXPECT_FALSE(ages.tryEmplace("Leha", 99)) << "Existing value is kept";
+    EXPECT_EQ(21, *ages.find("Leha"));
+    EXPECT_TRUE(ages.tryEmplace("Konstantin", 40));
+    EXPECT_EQ(40, *ages.find("Konstantin"));
+
+    EXPECT_FALSE(ages.insertOrAssign("Leha", 99));
+    EXPECT_EQ(99, *ages.find("Leha"));
+    EXPECT_TRUE(ages.insertOrAssign("Evgenija", 30));
+    EXPECT_EQ(6, ages.size());
+
+    EXPECT_TRUE(ages.remove("Leha"));
+    EXPECT_FALSE(ages.remove("Leha"));
+    EXPECT_EQ(5, ages.size());
+}
+
+TEST_F(TreeMapTest, CopiesDoNotSeeWritesThroughFind) {
+    TreeMap<std::string, int> copy = ages;
+    *copy.find("Petia") = 50;
+    *ages.find("Leha") = 60;
+    EXPECT_EQ(34, *ages.find("Petia"));
+    EXPECT_EQ(50, *copy.find("Petia"));
+    EXPECT_EQ(21, *copy.find("Leha"));
+    EXPECT_EQ(60, ages["Leha"]);
+}
+
+TEST_F(TreeMapTest, OrderedTraversal) {
+    std::vector<std::string> keys;
+    ages.inOrderTraverse([&](const std::string &key, const int &) {
+        keys.push_back(key);
+    });
+    ASSERT_EQ(4, keys.size());
+    EXPECT_EQ("Andriy", keys.front());
+    EXPECT_EQ("Slava", keys.back());
+
+    int total = 0;
+    ages.inRangeTraverse("B", "R", [&](const std::string &, const int &age) {
+        total += age;
+    });
+    EXPECT_EQ(21 + 34, total);
+    EXPECT_EQ(2, ages.countElements("B", "R"));
+}
+
+TEST_F(TreeMapTest, MultiMap) {
+    EXPECT_EQ(5, phones.size());
+    EXPECT_EQ(3, phones.countElements("Andriy"));
+    EXPECT_EQ(4, phones.countElements("A", "B"));
+
+    std::vector<std::string> values;
+    phones.equalRangeTraverse("Andriy", [&](const std::string &, const std::string &phone) {
+        values.push_back(phone);
+    });
+    EXPECT_EQ(3, values.size());
+
+    EXPECT_EQ(2, phones.remove("Andriy", 2));
+    EXPECT_EQ(1, phones.countElements("Andriy"));
+    EXPECT_EQ(1, phones.removeAll("Andriy"));
+    EXPECT_FALSE(phones.isMember("Andriy"));
+    EXPECT_EQ(2, phones.size());
+    ASSERT_NE(nullptr, phones.find("Vika"));
+    EXPECT_EQ("work", *phones.find("Vika"));
+}
+
+TEST(BalancedTreeMapTest, SortedKeysKeepMapShallow) {
+    for (TreeBalancing balancing : {TreeBalancing::Splay, TreeBalancing::Treap, TreeBalancing::Scapegoat}) {
+        TreeMap<int, int> squares(balancing);
+        TreeMultiMap<int, int> halves(balancing);
+        for (int i = 0; i < 10000; i++) {
+            squares[i] = i * i;
+            EXPECT_FALSE(squares.tryEmplace(i, 0));
+            halves.insert(i / 2, i);
+        }
+        EXPECT_EQ(balancing, squares.balancingPolicy());
+        EXPECT_EQ(10000, squares.size());
+        EXPECT_EQ(10000, halves.size());
+        if ( balancing != TreeBalancing::Splay ) {
+            EXPECT_GT(60, squares.stats().height);
+            EXPECT_GT(60, halves.stats().height);
+        }
+        for (int i = 0; i < 10000; i += 7) {
+            ASSERT_NE(nullptr, squares.find(i));
+            EXPECT_EQ(i * i, *squares.find(i));
+            EXPECT_EQ(2, halves.countElements(i / 2));
+        }
+        EXPECT_TRUE(squares.insertOrAssign(-1, 1));
+        EXPECT_TRUE(squares.remove(5000));
+        EXPECT_EQ(2, halves.removeAll(2500));
+        EXPECT_EQ(10000, squares.size());
+        EXPECT_EQ(9998, halves.size());
+        EXPECT_EQ(nullptr, squares.find(5000));
+    }
+}
@@ -6,8 +6,10 @@
 #include "Tree.h"
 
 #include <string>
+#include <sstream>
 #include <vector>
 #include <functional>
+#include <thread>
 
 class BinaryTreeTest : public ::testing::Test {
 public:
@@ -234,6 +236,317 @@ TEST_F(BinaryTreeTest, TestOtherTraversals) {
     TEST_TRAVERSAL(increasing_numbers_tree.postRightTraverse);
 }
 
+TEST_F(BinaryTreeTest, RangeQueries) {
+    EXPECT_EQ(10, name_tree.countElements("A", "B"));
+    EXPECT_EQ(8, name_tree.countElements("Andriy", "Anton"));
+    EXPECT_EQ(0, name_tree.countElements("B", "A")) << "Empty interval";
+    EXPECT_EQ(0, initially_empty_tree.countElements(0, 100));
+
+    std::vector<double> visited;
+    increasing_numbers_tree.inRangeTraverse(5.0, 12.0, [&](const double& x) {
+        visited.push_back(x);
+    });
+    ASSERT_FALSE(visited.empty());
+    for (size_t i = 0; i < visited.size(); i++) {
+        EXPECT_LE(5.0, visited[i]);
+        EXPECT_GE(12.0, visited[i]);
+        if ( i > 0 ) {
+            EXPECT_LT(visited[i - 1], visited[i]) << "Range is traversed in order";
+        }
+    }
+    EXPECT_EQ(visited.size(), increasing_numbers_tree.countElements(5.0, 12.0));
+}
+
+TEST_F(BinaryTreeTest, CustomComparator) {
+    struct Descending {
+        int operator()(int a, int b) const {
+            return (b > a) - (b < a);
+        }
+    };
+    Tree<int, Descending> tree;
+    for (int i = 0; i < 10; i++) {
+        tree.insert(i);
+        tree.insert(i);
+    }
+    EXPECT_EQ(2, tree.countElements(3));
+    EXPECT_TRUE(tree.isMember(9));
+    EXPECT_EQ(8, tree.countElements(7, 4)) << "Bounds follow comparator order";
+
+    int prev = 10;
+    tree.inOrderTraverse([&](const int &x) {
+        EXPECT_LE(x, prev);
+        prev = x;
+    });
+    EXPECT_EQ(2, tree.removeAll(5));
+    EXPECT_EQ(1, tree.remove(6));
+    EXPECT_EQ(0, tree.countElements(5));
+    EXPECT_EQ(1, tree.countElements(6));
+}
+
+
+TEST_F(BinaryTreeTest, CopiesDoNotShareModifications) {
+    Tree<std::string> copy = name_tree;
+    copy.insert("Zoryana");
+    copy.removeAll("Andriy");
+    copy.remove("Anton");
+    EXPECT_FALSE(name_tree.isMember("Zoryana"));
+    EXPECT_EQ(3, name_tree.countElements("Andriy"));
+    EXPECT_EQ(5, name_tree.countElements("Anton"));
+    EXPECT_EQ(4, copy.countElements("Anton"));
+
+    auto subtree = name_tree.getSubtreeFromElement("Slava");
+    name_tree.removeAll(startsFromA);
+    name_tree.removeAll("Vika");
+    EXPECT_TRUE(subtree.isMember("Vika"));
+    EXPECT_EQ(6, copy.countElements(startsFromA));
+}
+
+TEST_F(BinaryTreeTest, SnapshotIsNotAffectedByWrites) {
+    auto snapshot = name_tree.snapshot();
+    name_tree.removeAll(startsFromA);
+    name_tree.insert("Zoryana");
+    name_tree.remove("Vika");
+
+    EXPECT_EQ(16, snapshot.size());
+    EXPECT_EQ(10, snapshot.countElements(startsFromA));
+    EXPECT_TRUE(snapshot.isMember("Vika"));
+    EXPECT_FALSE(snapshot.isMember("Zoryana"));
+    EXPECT_EQ(0, name_tree.countElements(startsFromA));
+    EXPECT_TRUE(name_tree.isMember("Zoryana"));
+}
+
+TEST_F(BinaryTreeTest, WritesThroughTraversalStayInTree) {
+    auto snapshot = name_tree.snapshot();
+    Tree<std::string> copy = name_tree;
+    name_tree.inOrderTraverse([](std::string &name) {
+        name += "!";
+    });
+    EXPECT_TRUE(name_tree.isMember("Vika!"));
+    EXPECT_FALSE(name_tree.isMember("Vika"));
+    EXPECT_TRUE(snapshot.isMember("Vika"));
+    EXPECT_TRUE(copy.isMember("Vika"));
+
+    const Tree<std::string> &readonly = copy;
+    unsigned int visited = 0;
+    readonly.inRangeTraverse("A", "B", [&](const std::string &) { visited++; });
+    EXPECT_EQ(10, visited);
+}
+
+TEST_F(BinaryTreeTest, SnapshotScanRunsAlongsideWrites) {
+    for (int i = 0; i < 20000; i++) {
+        initially_empty_tree.insert((i * 7919) % 20000);
+    }
+    auto snapshot = initially_empty_tree.snapshot();
+
+    long long sum = 0;
+    unsigned int visited = 0;
+    std::thread exporter([&]() {
+        for (int round = 0; round < 5; round++) {
+            snapshot.inOrderTraverse([&](const int &x) {
+                sum += x;
+                visited++;
+            });
+        }
+    });
+    for (int i = 0; i < 20000; i++) {
+        initially_empty_tree.insert(20000 + i);
+        if ( i % 2 == 0 ) {
+            initially_empty_tree.remove(i);
+        }
+    }
+    exporter.join();
+
+    EXPECT_EQ(5 * 20000, visited);
+    EXPECT_EQ(5LL * 19999 * 20000 / 2, sum);
+    EXPECT_EQ(30000, initially_empty_tree.size());
+}
+
+TEST_F(BinaryTreeTest, SerializationRoundTrip) {
+    for (bool with_shape : {false, true}) {
+        std::stringstream stream;
+        name_tree.serialize(stream, with_shape);
+        auto loaded = Tree<std::string>::deserialize(stream);
+
+        EXPECT_EQ(name_tree.size(), loaded.size());
+        EXPECT_EQ(5, loaded.countElements("Anton"));
+        EXPECT_EQ(10, loaded.countElements(startsFromA));
+        for (auto &name : names_not_from_a) {
+            EXPECT_TRUE(loaded.isMember(name));
+        }
+        EXPECT_EQ(5, loaded.remove("Anton", 10));
+
+        std::vector<std::string> original_order, loaded_order;
+        name_tree.inOrderTraverse([&](const std::string &name) { original_order.push_back(name); });
+        stream.clear();
+        Tree<std::string>::deserialize(stream.seekg(0)).inOrderTraverse([&](const std::string &name) {
+            loaded_order.push_back(name);
+        });
+        EXPECT_EQ(original_order, loaded_order);
+    }
+
+    std::stringstream two_trees;
+    initially_empty_tree.serialize(two_trees, true);
+    increasing_numbers_tree.serialize(two_trees);
+    EXPECT_EQ(0, Tree<int>::deserialize(two_trees).size());
+    EXPECT_EQ(increasing_numbers_tree.size(), Tree<double>::deserialize(two_trees).size());
+}
+
+TEST_F(BinaryTreeTest, SerializationFromForwardOnlyStream) {
+    // hands data out in small pieces and cannot seek, like a pipe
+    class ForwardOnlyBuffer : public std::streambuf {
+    public:
+        ForwardOnlyBuffer(std::string data) : data(std::move(data)) { }
+
+    protected:
+        int_type underflow() override {
+            if ( offset == data.size() ) {
+                return traits_type::eof();
+            }
+            size_t piece = std::min<size_t>(7, data.size() - offset);
+            char *begin = &data[offset];
+            setg(begin, begin, begin + piece);
+            offset += piece;
+            return traits_type::to_int_type(*begin);
+        }
+
+    private:
+        std::string data;
+        size_t offset = 0;
+    };
+
+    std::stringstream two_trees;
+    name_tree.serialize(two_trees, true);
+    increasing_numbers_tree.serialize(two_trees);
+    ForwardOnlyBuffer buffer(two_trees.str());
+    std::istream pipe(&buffer);
+    EXPECT_EQ(name_tree.size(), Tree<std::string>::deserialize(pipe).size());
+    EXPECT_EQ(increasing_numbers_tree.size(), Tree<double>::deserialize(pipe).size());
+    EXPECT_EQ(std::char_traits<char>::eof(), pipe.peek());
+}
+
+TEST_F(BinaryTreeTest, SerializationKeepsShape) {
+    std::stringstream stream;
+    decreasing_numbers_tree.serialize(stream, true);
+    auto loaded = Tree<double>::deserialize(stream);
+
+    std::vector<double> original_order, loaded_order;
+    decreasing_numbers_tree.preLeftTraverse([&](const double &x) { original_order.push_back(x); });
+    loaded.preLeftTraverse([&](const double &x) { loaded_order.push_back(x); });
+    EXPECT_EQ(original_order, loaded_order);
+}
+
+TEST_F(BinaryTreeTest, SerializationDetectsCorruption) {
+    std::stringstream stream;
+    increasing_numbers_tree.serialize(stream);
+    std::string data = stream.str();
+
+    std::string corrupted = data;
+    corrupted[corrupted.size() / 2] ^= 0x40;
+    std::stringstream corrupted_stream(corrupted);
+    EXPECT_THROW(Tree<double>::deserialize(corrupted_stream), std::string);
+
+    std::stringstream truncated_stream(data.substr(0, data.size() - 3));
+    EXPECT_THROW(Tree<double>::deserialize(truncated_stream), std::string);
+
+    std::stringstream garbage_stream("not a tree at all");
+    EXPECT_THROW(Tree<double>::deserialize(garbage_stream), std::string);
+}
+
+TEST_F(BinaryTreeTest, SerializationRejectsCorruptedSizes) {
+    // count is stored after magic, version and flags, first string length right after it
+    auto corruptAt = [](const std::string &data, size_t offset) {
+        std::string corrupted = data;
+        for (size_t i = 0; i < sizeof(uint64_t); i++) {
+            corrupted[offset + i] = (char) 0xff;
+        }
+        return corrupted;
+    };
+
+    Tree<std::string> names;
+    names.insert("alpha");
+    names.insert("beta");
+    std::stringstream names_stream;
+    names.serialize(names_stream);
+    std::stringstream long_string(corruptAt(names_stream.str(), 16));
+    EXPECT_THROW(Tree<std::string>::deserialize(long_string), std::string);
+
+    std::stringstream shaped_stream;
+    increasing_numbers_tree.serialize(shaped_stream, true);
+    std::stringstream huge_shape(corruptAt(shaped_stream.str(), 8));
+    EXPECT_THROW(Tree<double>::deserialize(huge_shape), std::string);
+
+    std::string data = shaped_stream.str();
+    data[12] = 1;
+    std::stringstream truncated_count(data);
+    EXPECT_THROW(Tree<double>::deserialize(truncated_count), std::string);
+}
+
+TEST_F(BinaryTreeTest, ShapeStatistics) {
+    // 14 decreasing numbers form a left chain
+    TreeStats chain = decreasing_numbers_tree.stats();
+    EXPECT_EQ(14, chain.size);
+    EXPECT_EQ(14, chain.height);
+    EXPECT_EQ(13, chain.max_depth);
+    EXPECT_DOUBLE_EQ(6.5, chain.average_depth);
+    EXPECT_EQ(std::vector<unsigned int>(14, 1), chain.depth_histogram);
+    EXPECT_EQ(1, chain.leaf_count);
+    EXPECT_EQ(1, chain.balance_factors[0]);
+    EXPECT_EQ(1, chain.balance_factors[-13]);
+    EXPECT_LE(14 * sizeof(double), chain.node_bytes);
+    EXPECT_LT(0, chain.allocator_overhead);
+
+    Tree<int> balanced;
+    for (int x : {4, 2, 6, 1, 3, 5, 7}) {
+        balanced.insert(x);
+    }
+    TreeStats full = balanced.stats();
+    EXPECT_EQ(3, full.height);
+    EXPECT_EQ(4, full.leaf_count);
+    EXPECT_EQ((std::vector<unsigned int>{1, 2, 4}), full.depth_histogram);
+    EXPECT_EQ(7, full.balance_factors[0]);
+    EXPECT_EQ(0, Tree<int>().stats().height);
+}
+
+TEST_F(BinaryTreeTest, IncrementalShapeTracking) {
+    Tree<int> tree;
+    tree.insert(10);
+    tree.insert(5);
+    tree.trackShape(true);
+    EXPECT_EQ(2, tree.shapeTracking().height);
+
+    for (int x = 11; x < 20; x++) {
+        tree.insert(x);
+    }
+    EXPECT_EQ(10, tree.shapeTracking().height);
+    EXPECT_EQ(9, tree.shapeTracking().max_depth);
+    EXPECT_EQ(tree.stats().height, tree.shapeTracking().height);
+    EXPECT_EQ(9, tree.shapeTracking().inserts);
+    EXPECT_DOUBLE_EQ(5.0, tree.shapeTracking().averageInsertDepth());
+
+    tree.removeAll([](const int &x) { return x > 10; });
+    EXPECT_EQ(10, tree.shapeTracking().height);
+    EXPECT_EQ(2, tree.stats().height);
+    EXPECT_EQ(10, tree.shapeTracking().height);
+    tree.trackShape(true);
+    EXPECT_EQ(2, tree.shapeTracking().height);
+    tree.clear();
+    EXPECT_EQ(0, tree.shapeTracking().height);
+}
+
+TEST_F(BinaryTreeTest, ShapeTrackingFollowsReattachedSubtrees) {
+    Tree<int> tree;
+    for (int x : {50, 25, 75, 60, 20, 55, 10}) {
+        tree.insert(x);
+    }
+    tree.trackShape(true);
+    EXPECT_EQ(3, tree.shapeTracking().max_depth);
+
+    // right subtree takes the root, left one hangs below 55 two levels deeper
+    tree.remove(50);
+    EXPECT_EQ(5, tree.stats().max_depth);
+    EXPECT_EQ(5, tree.shapeTracking().max_depth);
+    EXPECT_EQ(6, tree.shapeTracking().height);
+}
 
 
 // tree traversals
@@ -0,0 +1,174 @@
+#ifndef BINARY_TREE_TREEDOTWRITER_H
+#define BINARY_TREE_TREEDOTWRITER_H
+
+#include <climits>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Tree.h"
+
+// Level of detail of TreeDotWriter output. Collapsed subtree is drawn as
+// one box with its size, key range and height; the figures are exact for
+// subtrees up to summary_budget nodes and lower bounds (">=") for bigger
+// ones, so output of any tree takes time proportional to its own size.
+struct TreeDotOptions {
+    // draw "NULL" vertex for every missing child of expanded nodes
+    bool null_children = false;
+    // nodes deeper than this are collapsed, root has depth 0
+    unsigned int max_depth = UINT_MAX;
+    // nodes examined per collapsed subtree
+    unsigned int summary_budget = 4096;
+    // share of non-root nodes drawn expanded, the rest is collapsed at random
+    double sample_rate = 1.0;
+    uint64_t seed = 1;
+};
+
+// Writes Graphviz DOT description of a tree straight to a stream.
+// Nodes are visited in pre order with an explicit stack, so memory is
+// O(depth) and nothing is copied, unlike TreeGraphBuilder. Nodes are named
+// n0, n1, ... in the order of their discovery; left edge of a node is
+// always written before the right one, which keeps children ordered.
+class TreeDotWriter {
+public:
+    explicit TreeDotWriter(std::ostream &out, bool null_children = false) : out(out) {
+        options.null_children = null_children;
+    }
+    TreeDotWriter(std::ostream &out, const TreeDotOptions &options) : out(out), options(options) { }
+
+    template<typename TreeElement, typename Compare>
+    void write(const Tree<TreeElement, Compare> &tree);
+
+private:
+    void writeNode(unsigned long id, const std::string &label);
+    void writeEdge(unsigned long parent, unsigned long child);
+    bool collapsed(unsigned int depth, std::mt19937_64 &sampler) const;
+    template<typename Node>
+    void writeSummary(unsigned long id, Node *subtree);
+
+    template<typename Value>
+    const std::string &label(Value &value);
+
+    std::ostream &out;
+    TreeDotOptions options;
+    std::ostringstream formatted;
+    std::string escaped;
+};
+
+template<typename TreeElement, typename Compare>
+void TreeDotWriter::write(const Tree<TreeElement, Compare> &tree) {
+    typedef typename Tree<TreeElement, Compare>::Node Node;
+
+    out << "digraph G {\n";
+    std::mt19937_64 sampler(options.seed);
+    unsigned long next_id = 0;
+    struct Pending {
+        Node *node;
+        unsigned long id;
+        unsigned int depth;
+    };
+    std::vector<Pending> stack;
+    if ( tree.root != nullptr ) {
+        stack.push_back(Pending{tree.root.get(), next_id++, 0});
+    }
+    while ( !stack.empty() ) {
+        Pending pending = stack.back();
+        Node *node = pending.node;
+        unsigned long id = pending.id;
+        stack.pop_back();
+        if ( collapsed(pending.depth, sampler) ) {
+            writeSummary(id, node);
+            continue;
+        }
+        writeNode(id, label(node->getValue()));
+
+        Node *children[] = {node->getLeft().get(), node->getRight().get()};
+        unsigned long child_ids[2];
+        for (int i = 0; i < 2; i++) {
+            if ( children[i] != nullptr || options.null_children ) {
+                child_ids[i] = next_id++;
+                writeEdge(id, child_ids[i]);
+                if ( children[i] == nullptr ) {
+                    writeNode(child_ids[i], "NULL");
+                }
+            }
+        }
+        for (int i = 1; i >= 0; i--) {
+            if ( children[i] != nullptr ) {
+                stack.push_back(Pending{children[i], child_ids[i], pending.depth + 1});
+            }
+        }
+    }
+    out << "}\n";
+}
+
+inline void TreeDotWriter::writeNode(unsigned long id, const std::string &label) {
+    out << "n" << id << " [label=\"" << label << "\"];\n";
+}
+
+inline void TreeDotWriter::writeEdge(unsigned long parent, unsigned long child) {
+    out << "n" << parent << " -> n" << child << ";\n";
+}
+
+inline bool TreeDotWriter::collapsed(unsigned int depth, std::mt19937_64 &sampler) const {
+    if ( depth > options.max_depth ) {
+        return true;
+    }
+    return depth > 0 && options.sample_rate < 1.0 &&
+           std::uniform_real_distribution<double>(0.0, 1.0)(sampler) >= options.sample_rate;
+}
+
+// Counts at most summary_budget nodes of the subtree, key range comes from
+// its leftmost and rightmost paths.
+template<typename Node>
+void TreeDotWriter::writeSummary(unsigned long id, Node *subtree) {
+    unsigned long size = 0;
+    unsigned int height = 0;
+    std::vector<std::pair<Node*, unsigned int>> stack(1, std::make_pair(subtree, 1u));
+    while ( !stack.empty() && size < options.summary_budget ) {
+        Node *node = stack.back().first;
+        unsigned int level = stack.back().second;
+        stack.pop_back();
+        size++;
+        height = level > height ? level : height;
+        if ( node->getRight() != nullptr ) {
+            stack.push_back(std::make_pair(node->getRight().get(), level + 1));
+        }
+        if ( node->getLeft() != nullptr ) {
+            stack.push_back(std::make_pair(node->getLeft().get(), level + 1));
+        }
+    }
+    const char *bound = stack.empty() ? "" : ">=";
+
+    Node *min = subtree, *max = subtree;
+    while ( min->getLeft() != nullptr ) {
+        min = min->getLeft().get();
+    }
+    while ( max->getRight() != nullptr ) {
+        max = max->getRight().get();
+    }
+    out << "n" << id << " [shape=box, style=dashed, label=\"size " << bound << size << "\\n";
+    out << label(min->getValue()) << " .. ";
+    out << label(max->getValue()) << "\\nheight " << bound << height << "\"];\n";
+}
+
+template<typename Value>
+const std::string &TreeDotWriter::label(Value &value) {
+    formatted.str("");
+    formatted << value;
+    const std::string &text = formatted.str();
+    escaped.clear();
+    for (char c : text) {
+        if ( c == '"' || c == '\\' ) {
+            escaped += '\\';
+        }
+        escaped += c == '\n' ? ' ' : c;
+    }
+    return escaped;
+}
+
+#endif //BINARY_TREE_TREEDOTWRITER_H
@@ -20,20 +20,27 @@ private:
             boost::property<boost::edge_weight_t, int>> LibGraph;
 
 
-    TreeGraph(std::vector<std::string> vertexNames, std::vector<Edge> edges) : vertexNames(vertexNames) {
-        int weights[edges.size()];
-        std::fill(weights, weights + edges.size(), 1);
-        g = LibGraph(begin(edges), end(edges), weights, 0);
+    TreeGraph(std::vector<std::string> vertexNames, std::vector<Edge> edges,
+              std::vector<std::string> vertexAttributes = std::vector<std::string>())
+            : vertexNames(vertexNames), vertexAttributes(vertexAttributes) {
+        std::vector<int> weights(edges.size(), 1);
+        g = LibGraph(begin(edges), end(edges), weights.data(), vertexNames.size());
     }
 
     LibGraph g;
     std::vector<std::string> vertexNames;
+    // extra graphviz attributes of every vertex, may be empty
+    std::vector<std::string> vertexAttributes;
 
     class VertexLabelWriter {
     public:
         VertexLabelWriter(const TreeGraph *g) : g(g) { }
         void operator()(std::ostream &os, unsigned const int vertex) {
-            os << "[label=\"" << g->vertexNames.at(vertex) << "\"]";
+            os << "[label=\"" << g->vertexNames.at(vertex) << "\"";
+            if ( vertex < g->vertexAttributes.size() ) {
+                os << g->vertexAttributes[vertex];
+            }
+            os << "]";
         }
     private:
         const TreeGraph *g;
@@ -10,17 +10,29 @@
 #include <map>
 #include <functional>
 #include <sstream>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 
 #include "TreeGraph.h"
 #include "Tree.h"
 
+// With heatmap every node is filled from white to red by the number of
+// sampled lookups through it (log scale, see TreeHeatmap.h) and gets
+// external label "d<depth>: <accesses>".
+//
+// Diff mode draws the later version with its added nodes green, moved
+// nodes and re-attached shared subtrees orange, labeled with their former
+// depth, and removed elements as detached red vertices (see Tree::diff).
 class TreeGraphBuilder {
 public:
     template <typename TreeElement>
-    TreeGraphBuilder(Tree<TreeElement> tree);
+    TreeGraphBuilder(const Tree<TreeElement> &tree, bool heatmap = false);
+    template <typename TreeElement>
+    TreeGraphBuilder(const Tree<TreeElement> &before, const Tree<TreeElement> &after);
 
     TreeGraph getGraph() {
-        return std::move(TreeGraph(vertexLabels, edges));
+        return std::move(TreeGraph(vertexLabels, edges, vertexAttributes));
     }
 private:
 
@@ -47,13 +59,42 @@ private:
     template<typename TreeElement>
     std::string convertNodeToString(const typename  Tree<TreeElement>::NodePtr& node);
 
+    void buildHeatmap();
+
+    template<typename TreeElement>
+    void buildGraph(const Tree<TreeElement> &tree);
+
     int node_counter;
 
     std::map<void*, int> node_id_map;
     std::vector<Edge> edges;
     std::vector<std::string> vertexLabels;
+    std::vector<std::string> vertexAttributes;
+    std::vector<unsigned int> vertexDepths;
+    // -1 for NULL vertices
+    std::vector<int64_t> vertexAccesses;
 };
 
+inline void TreeGraphBuilder::buildHeatmap() {
+    int64_t hottest = 0;
+    for (int64_t accesses : vertexAccesses) {
+        hottest = accesses > hottest ? accesses : hottest;
+    }
+    for (size_t vertex = 0; vertex < vertexAccesses.size(); vertex++) {
+        int64_t accesses = vertexAccesses[vertex];
+        if ( accesses < 0 ) {
+            vertexAttributes.push_back("");
+            continue;
+        }
+        double heat = hottest == 0 ? 0.0 : std::log1p((double) accesses) / std::log1p((double) hottest);
+        int cool = (int) std::lround(255 * (1.0 - heat));
+        char attributes[96];
+        snprintf(attributes, sizeof(attributes), ", style=filled, fillcolor=\"#ff%02x%02x\", xlabel=\"d%u: %lld\"",
+                 cool, cool, vertexDepths[vertex], (long long) accesses);
+        vertexAttributes.push_back(attributes);
+    }
+}
+
 template<typename TreeElement>
 std::string TreeGraphBuilder::convertNodeToString(const typename Tree<TreeElement>::NodePtr& node) {
     std::ostringstream o;
@@ -66,6 +107,8 @@ void TreeGraphBuilder::buildOrdinaryEdge(typename Tree<TreeElement>::NodePtr& pa
                                          typename Tree<TreeElement>::NodePtr& child) {
     node_id_map[(void*)child.get()] = node_counter++;
     vertexLabels.push_back(convertNodeToString<TreeElement>(child));
+    vertexDepths.push_back(vertexDepths[node_id_map[(void*)parent.get()]] + 1);
+    vertexAccesses.push_back(child->accessCount());
     edges.push_back(Edge(node_id_map[(void*)parent.get()], node_id_map[(void*)child.get()]));
 }
 
@@ -73,6 +116,8 @@ template<typename TreeElement>
 void TreeGraphBuilder::buildNullNode(typename Tree<TreeElement>::NodePtr& parent) {
     edges.push_back(Edge(node_id_map[(void*)parent.get()], node_counter++));
     vertexLabels.push_back("NULL");
+    vertexDepths.push_back(vertexDepths[node_id_map[(void*)parent.get()]] + 1);
+    vertexAccesses.push_back(-1);
 }
 
 template<typename TreeElement>
@@ -80,6 +125,8 @@ void TreeGraphBuilder::buildRoot(typename Tree<TreeElement>::NodePtr& node) {
     if ( node != nullptr ) {
         node_id_map[(void*)node.get()] = node_counter++;
         vertexLabels.push_back(convertNodeToString<TreeElement>(node));
+        vertexDepths.push_back(0);
+        vertexAccesses.push_back(node->accessCount());
     }
 }
 
@@ -110,9 +157,41 @@ void TreeGraphBuilder::treeTraverse(typename Tree<TreeElement>::NodePtr& iter_pa
 }
 
 template<typename TreeElement>
-TreeGraphBuilder::TreeGraphBuilder(Tree<TreeElement> tree) : node_counter(0) {
+TreeGraphBuilder::TreeGraphBuilder(const Tree<TreeElement> &tree, bool heatmap) : node_counter(0) {
+    buildGraph(tree);
+    if ( heatmap ) {
+        buildHeatmap();
+    }
+}
+
+template<typename TreeElement>
+TreeGraphBuilder::TreeGraphBuilder(const Tree<TreeElement> &before, const Tree<TreeElement> &after)
+        : node_counter(0) {
+    typedef Tree<TreeElement> DiffedTree;
+    buildGraph(after);
+    auto diff = DiffedTree::diffNodes(before.root, after.root, after.compare);
+    vertexAttributes.assign(vertexLabels.size(), "");
+    for (auto node : diff.added) {
+        vertexAttributes[node_id_map[(void*)node]] = ", style=filled, fillcolor=\"palegreen\"";
+    }
+    for (auto &move : diff.moved) {
+        vertexAttributes[node_id_map[(void*)move.after]] =
+                ", style=filled, fillcolor=\"orange\", xlabel=\"was d" + std::to_string(move.old_depth) + "\"";
+    }
+    for (auto node : diff.removed) {
+        std::ostringstream o;
+        o << node->getValue();
+        vertexLabels.push_back(o.str());
+        vertexAttributes.push_back(", style=\"filled,dashed\", fillcolor=\"lightpink\"");
+        node_counter++;
+    }
+}
+
+template<typename TreeElement>
+void TreeGraphBuilder::buildGraph(const Tree<TreeElement> &tree) {
     typename Tree<TreeElement>::NodePtr fake_parent;
-    treeTraverse<TreeElement>(fake_parent, tree.root,
+    typename Tree<TreeElement>::NodePtr root = tree.root;
+    treeTraverse<TreeElement>(fake_parent, root,
                               [&](typename Tree<TreeElement>::NodePtr& iter_parent,
                                   typename Tree<TreeElement>::NodePtr& iter) {
                                   buildEdge<TreeElement>(iter_parent, iter);